@@ -2,6 +2,7 @@
 */
 
 #include <math.h>
+#include <stdint.h>
 #include "complex.h"
 
 #ifndef QUDA_GATE
@@ -19,37 +20,18 @@ int QUDA_BRANCH_CUT_UPPER = QUDA_PI;
 #endif
 
 #ifdef __QUDA_USE_BRANCH_CUT
-QUDA_GATE void quda_complex_set_branch_cut(float lower) {
+QUDA_GATE void quda_complex_set_branch_cut(quda_float_t lower) {
 	QUDA_BRANCH_CUT_LOWER = lower;
 	QUDA_BRANCH_CUT_UPPER = lower+2*QUDA_PI;
 }
 #endif
 
-QUDA_GATE complex_t quda_complex_copy(complex_t c) {
-	complex_t res;
-	res.real = c.real;
-	res.imag = c.imag;
-	return res;
-}
-
-// TODO: Implement float-tolerant approximate equivalence check
-QUDA_GATE int quda_complex_eq(complex_t op1, complex_t op2) {
-	if(op1.real == op2.real && op1.imag == op2.imag) {
-		return 1;
-	}
-	return 0;
-}
-
-QUDA_GATE float quda_complex_abs_square(complex_t c) {
-	return c.real*c.real + c.imag*c.imag;
-}
-
-QUDA_GATE float quda_complex_abs(complex_t c) {
-	float res = c.real*c.real + c.imag*c.imag;
+QUDA_GATE quda_float_t quda_complex_abs(complex_t c) {
+	quda_float_t res = quda_complex_abs_square(c);
 	return sqrt(res);
 }
 
-QUDA_GATE float quda_complex_arg(complex_t c) {
+QUDA_GATE quda_float_t quda_complex_arg(complex_t c) {
 	if(c.real == 0.0f) {
 		if(c.imag > 0) {
 			return QUDA_PI/2.0f;
@@ -57,7 +39,7 @@ QUDA_GATE float quda_complex_arg(complex_t c) {
 			return QUDA_PI/-2.0f;
 		}
 	}
-	float res = atan(c.imag/c.real);
+	quda_float_t res = atan((quda_float_t)c.imag/c.real);
 	#ifdef __CUDA_USE_BRANCH_CUT
 	// TODO: Implement cleaner branch cut enforcement
 	while(res <= QUDA_BRANCH_CUT_LOWER) res+=2*QUDA_PI;
@@ -66,93 +48,16 @@ QUDA_GATE float quda_complex_arg(complex_t c) {
   return res;
 }
 
-QUDA_GATE complex_t quda_complex_conj(complex_t c) {
-	complex_t res;
-	res.real = c.real;
-	res.imag = -c.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_neg(complex_t c) {
-	complex_t res;
-	res.real = -c.real;
-	res.imag = -c.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_radd(complex_t c, float f) {
-	complex_t res;
-	res.real = c.real+f;
-	res.imag = c.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_rsub(complex_t c, float f) {
-	complex_t res;
-	res.real = c.real - f;
-	res.imag = c.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_rmul(complex_t c, float f) {
-	complex_t res;
-	res.real = c.real*f;
-	res.imag = c.imag*f;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_rdiv(complex_t c, float f) {
-	complex_t res;
-	res.real = c.real/f;
-	res.imag = c.imag/f;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_add(complex_t op1, complex_t op2) {
-	complex_t res;
-	res.real = op1.real + op2.real;
-	res.imag = op1.imag + op2.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_sub(complex_t op1, complex_t op2) {
-	complex_t res;
-	res.real = op1.real - op2.real;
-	res.imag = op1.imag - op2.imag;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_mul(complex_t op1, complex_t op2) {
-	complex_t res;
-	res.real = op1.real*op2.real - op1.imag*op2.imag;
-	res.imag = op1.imag*op2.real + op1.real*op2.imag;
-	return res;
-}
-
 QUDA_GATE complex_t quda_complex_div(complex_t op1, complex_t op2) {
-	float denom = op2.real*op2.real + op2.imag*op2.imag;
+	quda_float_t denom = quda_complex_abs_square(op2);
 	complex_t res;
-	res.real = (op1.real*op2.real + op1.imag*op2.imag)/denom;
-	res.imag = (op1.imag*op2.real - op1.real*op2.imag)/denom;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_mul_i(complex_t c) {
-	complex_t res;
-	res.real = -c.imag;
-	res.imag = c.real;
-	return res;
-}
-
-QUDA_GATE complex_t quda_complex_mul_ni(complex_t c) {
-	complex_t res;
-	res.real = c.imag;
-	res.imag = -c.real;
+	res.real = ((quda_float_t)op1.real*op2.real + (quda_float_t)op1.imag*op2.imag)/denom;
+	res.imag = ((quda_float_t)op1.imag*op2.real - (quda_float_t)op1.real*op2.imag)/denom;
 	return res;
 }
 
 QUDA_GATE complex_t quda_complex_rcp(complex_t c) {
-	float denom = c.real*c.real + c.imag*c.imag;
+	quda_float_t denom = quda_complex_abs_square(c);
 	complex_t res;
 	res.real = c.real/denom;
 	res.imag = -c.imag/denom;
@@ -160,7 +65,7 @@ QUDA_GATE complex_t quda_complex_rcp(complex_t c) {
 }
 
 QUDA_GATE complex_t quda_complex_exp(complex_t c) {
-	float expo = exp(c.real);
+	quda_float_t expo = exp(c.real);
 	complex_t res;
 	res.real = expo*cos(c.imag);
 	res.imag = expo*sin(c.imag);
@@ -173,8 +78,8 @@ QUDA_GATE complex_t quda_complex_ipow(complex_t c,int p) {
 	if(quda_complex_eq(c,QUDA_COMPLEX_ZERO)) {
 		res = QUDA_COMPLEX_ZERO;
 	} else {
-		float r2 = pow(quda_complex_abs(c),p);
-		float theta = p*quda_complex_arg(c);
+		quda_float_t r2 = pow(quda_complex_abs(c),p);
+		quda_float_t theta = p*quda_complex_arg(c);
 		res.real = r2*cos(theta);
 		res.imag = r2*sin(theta);
 	}
@@ -276,3 +181,272 @@ QUDA_GATE complex_t quda_complex_atanh(complex_t c) {
 	return quda_complex_rmul(quda_complex_log(quda_complex_div(quda_complex_radd(c,1.0f),
 			quda_complex_sub(QUDA_COMPLEX_ONE,c))),0.5f);
 }
+
+#if QUDA_PRECISION != QUDA_PRECISION_DOUBLE
+/* Single-precision kernels for the array functions below. They use no libm calls and
+ * select instead of branching so that loops over them vectorize. The polynomials are the
+ * Cephes minimax fits with Cody-Waite range reduction.
+ */
+typedef union quda_float_bits {
+	float f;
+	int32_t i;
+} quda_float_bits;
+
+// 2^k for -64 <= k <= 64
+QUDA_INLINE float quda_array_exp2i(int k) {
+	quda_float_bits b;
+	b.i = (k + 127) << 23;
+	return b.f;
+}
+
+// a where mask is all ones and b where it is zero, without a branch compilers keep
+QUDA_INLINE float quda_array_select(int32_t mask, float a, float b) {
+	quda_float_bits ba,bb;
+	ba.f = a;
+	bb.f = b;
+	ba.i = (ba.i & mask) | (bb.i & ~mask);
+	return ba.f;
+}
+
+QUDA_INLINE float quda_array_exp(float x) {
+	int32_t nan = -(x != x);
+	float c = quda_array_select(-(x > 89.0f),89.0f,x);
+	c = quda_array_select(-(x < -104.0f) | nan,-104.0f,c); // NaN is restored below
+	float t = c*1.44269504088896341f + 0.5f;
+	int k = (int)t;
+	k -= ((float)k > t);
+	float r = c - (float)k*0.693359375f + (float)k*2.12194440e-4f;
+	float p = (((((1.9875691500E-4f*r + 1.3981999507E-3f)*r + 8.3334519073E-3f)*r
+			+ 4.1665795894E-2f)*r + 1.6666665459E-1f)*r + 5.0000001201E-1f)*r*r + r + 1.0f;
+	// Two factors cover both the largest results and the subnormal ones
+	p = p*quda_array_exp2i(k >> 1)*quda_array_exp2i(k - (k >> 1));
+	return quda_array_select(nan,x,p);
+}
+
+// sin(x) and cos(x) for |x| <= 8192
+QUDA_INLINE void quda_array_sincos(float x, float* s, float* c) {
+	float ax = (x < 0) ? -x : x;
+	ax = (ax <= 1e9f) ? ax : 0.0f; // keeps the conversion below defined
+	int j = (int)(ax*1.27323954473516f);
+	j = (j + 1) & ~1;
+	float y = (float)j;
+	float r = ((ax - y*0.78515625f) - y*2.4187564849853515625e-4f) - y*3.77489497744594108e-8f;
+	float z = r*r;
+	float ps = ((-1.9515295891E-4f*z + 8.3321608736E-3f)*z - 1.6666654611E-1f)*z*r + r;
+	float pc = ((2.443315711809948E-5f*z - 1.388731625493765E-3f)*z
+			+ 4.166664568298827E-2f)*z*z - 0.5f*z + 1.0f;
+
+	// j/2 counts quarter turns: each one rotates (cos,sin) by 90 degrees
+	int q = (j >> 1) & 3;
+	float sv = (q & 1) ? pc : ps;
+	float cv = (q & 1) ? ps : pc;
+	sv = (q & 2) ? -sv : sv;
+	cv = ((q + 1) & 2) ? -cv : cv;
+	*s = (x < 0) ? -sv : sv;
+	*c = cv;
+}
+
+// sinh(x) and cosh(x), which overflow together past |x| = 89.4
+QUDA_INLINE void quda_array_sinhcosh(float x, float* sh, float* ch) {
+	float ax = (x < 0) ? -x : x;
+	// e^|x|/2 as a product of two halves, so that it only overflows where cosh does
+	float e = quda_array_exp(0.5f*ax);
+	float h = 0.5f*e*e;
+	float q = 0.25f/h;
+	// e^|x|/2 - e^-|x|/2 cancels for small |x|, where a polynomial takes over
+	float z = ax*ax;
+	float p = ((2.03721912945E-4f*z + 8.33028376239E-3f)*z + 1.66667160211E-1f)*z*ax + ax;
+	float s = (ax < 1.0f) ? p : h - q;
+	*sh = (x < 0) ? -s : s;
+	*ch = h + q;
+}
+
+// Natural logarithm of x > 0
+QUDA_INLINE float quda_array_log(float x) {
+	// Subnormals are scaled into the normal range first
+	int tiny = x < 1.17549435e-38f;
+	quda_float_bits b;
+	b.f = tiny ? x*8388608.0f : x;
+	int e = ((b.i >> 23) & 0xff) - 126 - (tiny ? 23 : 0);
+	b.i = (b.i & 0x807fffff) | 0x3f000000;
+	int low = b.f < 0.707106781186547524f;
+	e -= low;
+	float m = low ? b.f + b.f - 1.0f : b.f - 1.0f;
+	float z = m*m;
+	float y = ((((((((7.0376836292E-2f*m - 1.1514610310E-1f)*m + 1.1676998740E-1f)*m
+			- 1.2420140846E-1f)*m + 1.4249322787E-1f)*m - 1.6668057665E-1f)*m
+			+ 2.0000714765E-1f)*m - 2.4999993993E-1f)*m + 3.3333331174E-1f)*m*z;
+	float fe = (float)e;
+	y += -2.12194440e-4f*fe - 0.5f*z;
+	return m + y + 0.693359375f*fe;
+}
+
+// Principal argument of x + iy in (-PI,PI]
+QUDA_INLINE float quda_array_atan2(float y, float x) {
+	float ax = (x < 0) ? -x : x;
+	float ay = (y < 0) ? -y : y;
+	int swap = ay > ax;
+	float num = swap ? ax : ay;
+	float den = swap ? ay : ax;
+	float t = (den > 0) ? num/den : 0.0f;
+	int big = t > 0.4142135623730950f;
+	float r = big ? (t - 1.0f)/(t + 1.0f) : t;
+	float z = r*r;
+	float a = (((8.05374449538e-2f*z - 1.38776856032E-1f)*z + 1.99777106478E-1f)*z
+			- 3.33329491539E-1f)*z*r + r;
+	a += big ? 0.785398163397448f : 0.0f;
+	a = swap ? 1.57079632679490f - a : a;
+	a = (x < 0) ? 3.14159265358979f - a : a;
+	return (y < 0) ? -a : a;
+}
+
+QUDA_GATE void quda_complex_cis_array(const quda_float_t* theta, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		float s,c;
+		quda_array_sincos(theta[i],&s,&c);
+		out[i].real = c;
+		out[i].imag = s;
+	}
+}
+
+QUDA_GATE void quda_complex_exp_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		float s,c;
+		float m = quda_array_exp(in[i].real);
+		quda_array_sincos(in[i].imag,&s,&c);
+		out[i].real = m*c;
+		out[i].imag = m*s;
+	}
+}
+
+QUDA_GATE void quda_complex_log_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		// log|c| = log(max) + log(1 + (min/max)^2)/2 cannot overflow
+		float x = in[i].real, y = in[i].imag;
+		float ax = (x < 0) ? -x : x;
+		float ay = (y < 0) ? -y : y;
+		float hi = (ax > ay) ? ax : ay;
+		float lo = (ax > ay) ? ay : ax;
+		float q = (hi > 0) ? lo/hi : 0.0f;
+		float arg = quda_array_atan2(y,x);
+		out[i].real = (hi > 0) ? quda_array_log(hi) + 0.5f*quda_array_log(1.0f + q*q) : -INFINITY;
+		out[i].imag = arg;
+	}
+}
+
+QUDA_GATE void quda_complex_sin_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		// sin(x + iy) = sin(x)cosh(y) + i cos(x)sinh(y)
+		float s,c,sh,ch;
+		quda_array_sincos(in[i].real,&s,&c);
+		quda_array_sinhcosh(in[i].imag,&sh,&ch);
+		out[i].real = s*ch;
+		out[i].imag = c*sh;
+	}
+}
+
+QUDA_GATE void quda_complex_cos_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		// cos(x + iy) = cos(x)cosh(y) - i sin(x)sinh(y)
+		float s,c,sh,ch;
+		quda_array_sincos(in[i].real,&s,&c);
+		quda_array_sinhcosh(in[i].imag,&sh,&ch);
+		out[i].real = c*ch;
+		out[i].imag = -s*sh;
+	}
+}
+
+QUDA_GATE void quda_complex_tanh_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		// tanh(x + iy) = (sinh(x)cosh(x) + i sin(y)cos(y)) / (sinh(x)^2 + cos(y)^2), whose
+		// denominator, unlike cosh(2x) + cos(2y), does not cancel near the poles
+		float x = in[i].real;
+		float s,c,sh,ch;
+		quda_array_sincos(in[i].imag,&s,&c);
+		quda_array_sinhcosh(x,&sh,&ch);
+		float d = sh*sh + c*c;
+		// Past |x| = 9 the real part rounds to +-1, and sinh(x)^2 overflows from 44.7
+		float one = (x < 0) ? -1.0f : 1.0f;
+		out[i].real = (x > 9.0f || x < -9.0f) ? one : sh*ch/d;
+		out[i].imag = s*c/d;
+	}
+}
+
+QUDA_GATE void quda_complex_pow_array(const complex_t* in, complex_t p, complex_t* out,
+		int count) {
+	int i;
+	quda_complex_log_array(in,out,count);
+	for(i=0;i<count;i++) {
+		// Only zero has an infinite logarithm ('out' may be 'in', which is overwritten by now)
+		int zero = out[i].real == -INFINITY;
+		complex_t e = quda_complex_mul(zero ? QUDA_COMPLEX_ZERO : out[i],p);
+		float s,c;
+		float m = quda_array_exp(e.real);
+		quda_array_sincos(e.imag,&s,&c);
+		out[i].real = zero ? 0.0f : m*c;
+		out[i].imag = zero ? 0.0f : m*s;
+	}
+}
+#else
+// Double precision has no vectorized kernels: each element goes through libm
+QUDA_GATE void quda_complex_cis_array(const quda_float_t* theta, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		out[i].real = cos(theta[i]);
+		out[i].imag = sin(theta[i]);
+	}
+}
+
+QUDA_GATE void quda_complex_exp_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		out[i] = quda_complex_exp(in[i]);
+	}
+}
+
+QUDA_GATE void quda_complex_log_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		complex_t c = in[i];
+		out[i].real = (c.real == 0 && c.imag == 0) ? -INFINITY : log(hypot(c.real,c.imag));
+		out[i].imag = atan2(c.imag,c.real);
+	}
+}
+
+QUDA_GATE void quda_complex_sin_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		out[i] = quda_complex_sin(in[i]);
+	}
+}
+
+QUDA_GATE void quda_complex_cos_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		out[i] = quda_complex_cos(in[i]);
+	}
+}
+
+QUDA_GATE void quda_complex_tanh_array(const complex_t* in, complex_t* out, int count) {
+	int i;
+	for(i=0;i<count;i++) {
+		out[i] = quda_complex_tanh(in[i]);
+	}
+}
+
+QUDA_GATE void quda_complex_pow_array(const complex_t* in, complex_t p, complex_t* out,
+		int count) {
+	int i;
+	quda_complex_log_array(in,out,count);
+	for(i=0;i<count;i++) {
+		int zero = out[i].real == -INFINITY;
+		out[i] = zero ? QUDA_COMPLEX_ZERO : quda_complex_exp(quda_complex_mul(out[i],p));
+	}
+}
+#endif
@@ -4,15 +4,62 @@
 #ifndef __QUDA_COMPLEX_H
 #define __QUDA_COMPLEX_H
 
+/* Amplitude precision, chosen when the library is built (-DQUDA_PRECISION=16, 32 or 64; see
+ * the Makefile). Every module must be built with the same value. quda_real_t is the type
+ * complex numbers store, quda_float_t the type their arithmetic is carried out in, and
+ * quda_accum_t the wider type sums over many states accumulate in. Half precision stores
+ * fp16 and computes each operation in fp32, rounding results back when they are stored.
+ */
+#define QUDA_PRECISION_HALF 16
+#define QUDA_PRECISION_SINGLE 32
+#define QUDA_PRECISION_DOUBLE 64
+#ifndef QUDA_PRECISION
+#define QUDA_PRECISION QUDA_PRECISION_SINGLE
+#endif
+
+#if QUDA_PRECISION == QUDA_PRECISION_HALF
+#ifdef __CUDACC__
+#error "Half-precision amplitudes are not supported in CUDA builds"
+#endif
+__extension__ typedef _Float16 quda_real_t;
+typedef float quda_float_t;
+typedef double quda_accum_t;
+#elif QUDA_PRECISION == QUDA_PRECISION_SINGLE
+typedef float quda_real_t;
+typedef float quda_float_t;
+typedef double quda_accum_t;
+#elif QUDA_PRECISION == QUDA_PRECISION_DOUBLE
+typedef double quda_real_t;
+typedef double quda_float_t;
+#ifdef __CUDACC__
+typedef double quda_accum_t; // devices have no wider type
+#else
+typedef long double quda_accum_t;
+#endif
+#else
+#error "QUDA_PRECISION must be 16, 32 or 64"
+#endif
+
 #define __QUDA_USE_BRANCH_CUT
-#define QUDA_PI 3.141592654f
-#define QUDA_E  2.718281828f
+#define QUDA_PI ((quda_float_t)3.14159265358979323846)
+#define QUDA_E  ((quda_float_t)2.71828182845904523536)
 
 typedef struct complex_t {
-	float real;
-	float imag;
+	quda_real_t real;
+	quda_real_t imag;
 } complex_t;
 
+/* The arithmetic used per state by every gate is defined here so that it inlines into the
+ * kernels. CUDA builds compile it for both the host and the device.
+ */
+#ifndef QUDA_INLINE
+#ifdef __CUDACC__
+#define QUDA_INLINE static inline __host__ __device__
+#else
+#define QUDA_INLINE static inline
+#endif
+#endif
+
 #ifndef QUDA_GATE
 extern const complex_t QUDA_I;
 extern const complex_t QUDA_COMPLEX_ZERO;
@@ -25,51 +72,124 @@ extern int QUDA_BRANCH_CUT_LOWER;
 extern int QUDA_BRANCH_CUT_UPPER;
 
 /* Set branch cut for use in arg/log to (lower, lower+2*PI) */
-void quda_complex_set_branch_cut(float lower);
+void quda_complex_set_branch_cut(quda_float_t lower);
 #endif
 
 /* Copy a complex number */
-complex_t quda_complex_copy(complex_t c);
+QUDA_INLINE complex_t quda_complex_copy(complex_t c) {
+	complex_t res;
+	res.real = c.real;
+	res.imag = c.imag;
+	return res;
+}
 
 /* Test equality of two complex numbers (returns 1 if equal, 0 otherwise) */
-int quda_complex_eq(complex_t op1, complex_t op2);
+// TODO: Implement float-tolerant approximate equivalence check
+QUDA_INLINE int quda_complex_eq(complex_t op1, complex_t op2) {
+	if(op1.real == op2.real && op1.imag == op2.imag) {
+		return 1;
+	}
+	return 0;
+}
 
 /* Complex absolute square
  * Equivalent to a complex number times its conjugate
  * For a quantum state amplitude, this value represents the probability
  * of the quantum state.
  */
-float quda_complex_abs_square(complex_t c);
+QUDA_INLINE quda_float_t quda_complex_abs_square(complex_t c) {
+	return (quda_float_t)c.real*c.real + (quda_float_t)c.imag*c.imag;
+}
 
 /* Complex modulus (absolute value) */
-float quda_complex_abs(complex_t c);
+quda_float_t quda_complex_abs(complex_t c);
 
 /* Complex argument (vector angle) -- explicitly dependent on branch cut */
-float quda_complex_arg(complex_t c);
+quda_float_t quda_complex_arg(complex_t c);
 
 /* Complex conjugate */
-complex_t quda_complex_conj(complex_t c);
+QUDA_INLINE complex_t quda_complex_conj(complex_t c) {
+	complex_t res;
+	res.real = c.real;
+	res.imag = -c.imag;
+	return res;
+}
 
 /* Complex negation */
-complex_t quda_complex_neg(complex_t c);
+QUDA_INLINE complex_t quda_complex_neg(complex_t c) {
+	complex_t res;
+	res.real = -c.real;
+	res.imag = -c.imag;
+	return res;
+}
 
 /* Standard mathematical operations between complex numbers and reals */
-complex_t quda_complex_radd(complex_t c, float f);
-complex_t quda_complex_rsub(complex_t c, float f);
-complex_t quda_complex_rmul(complex_t c, float f);
-complex_t quda_complex_rdiv(complex_t c, float f);
+QUDA_INLINE complex_t quda_complex_radd(complex_t c, quda_float_t f) {
+	complex_t res;
+	res.real = c.real+f;
+	res.imag = c.imag;
+	return res;
+}
+
+QUDA_INLINE complex_t quda_complex_rsub(complex_t c, quda_float_t f) {
+	complex_t res;
+	res.real = c.real - f;
+	res.imag = c.imag;
+	return res;
+}
+
+QUDA_INLINE complex_t quda_complex_rmul(complex_t c, quda_float_t f) {
+	complex_t res;
+	res.real = c.real*f;
+	res.imag = c.imag*f;
+	return res;
+}
+
+QUDA_INLINE complex_t quda_complex_rdiv(complex_t c, quda_float_t f) {
+	complex_t res;
+	res.real = c.real/f;
+	res.imag = c.imag/f;
+	return res;
+}
 
 /* Standard mathematical operations between complex numbers */
-complex_t quda_complex_add(complex_t op1, complex_t op2);
-complex_t quda_complex_sub(complex_t op1, complex_t op2);
-complex_t quda_complex_mul(complex_t op1, complex_t op2);
+QUDA_INLINE complex_t quda_complex_add(complex_t op1, complex_t op2) {
+	complex_t res;
+	res.real = op1.real + op2.real;
+	res.imag = op1.imag + op2.imag;
+	return res;
+}
+
+QUDA_INLINE complex_t quda_complex_sub(complex_t op1, complex_t op2) {
+	complex_t res;
+	res.real = op1.real - op2.real;
+	res.imag = op1.imag - op2.imag;
+	return res;
+}
+
+QUDA_INLINE complex_t quda_complex_mul(complex_t op1, complex_t op2) {
+	complex_t res;
+	res.real = (quda_float_t)op1.real*op2.real - (quda_float_t)op1.imag*op2.imag;
+	res.imag = (quda_float_t)op1.imag*op2.real + (quda_float_t)op1.real*op2.imag;
+	return res;
+}
 complex_t quda_complex_div(complex_t op1, complex_t op2);
 
 /* Multiplication by imaginary number i (QUDA_I) */
-complex_t quda_complex_mul_i(complex_t c);
+QUDA_INLINE complex_t quda_complex_mul_i(complex_t c) {
+	complex_t res;
+	res.real = -c.imag;
+	res.imag = c.real;
+	return res;
+}
 
 /* Multiplication by imaginary number -i (QUDA_I) */
-complex_t quda_complex_mul_ni(complex_t c);
+QUDA_INLINE complex_t quda_complex_mul_ni(complex_t c) {
+	complex_t res;
+	res.real = c.imag;
+	res.imag = -c.real;
+	return res;
+}
 
 /* Complex reciprocal */
 complex_t quda_complex_rcp(complex_t c);
@@ -86,6 +206,29 @@ complex_t quda_complex_pow(complex_t op1, complex_t op2);
 /* Complex natural logarithm -- implicitly dependent on branch cut */
 complex_t quda_complex_log(complex_t c);
 
+/* Array versions of exp, log, pow, sin, cos and tanh, and e^(i*theta) for real angles, which
+ * write 'count' results to 'out' ('out' may be 'in'). They evaluate single-precision polynomials instead of
+ * calling libm, so that the loops vectorize; the scalar functions remain the reference.
+ * Measured against double precision over finite inputs, with errors in ULPs of the modulus
+ * of the exact result:
+ *   cis:  within 2 ULPs for |theta| <= 8192 (accuracy degrades beyond)
+ *   exp:  within 3 ULPs for |imag| <= 8192 while the modulus is a normal float
+ *   log:  the argument, always the principal one in (-PI,PI] regardless of the branch cut,
+ *         within 4 ULPs, and log|c| within 3 ULPs or 1e-7 absolute
+ *   pow:  the error of exp on top of that of log, scaled by |p log c|
+ *   sin, cos: within 5 ULPs for |real| <= 8192 while the modulus is a normal float
+ *   tanh: within 7 ULPs for |imag| <= 8192, poles included
+ * Like the scalar version, pow returns 0 for a zero base. Half-precision builds round the
+ * results to fp16; double-precision builds call libm for every element instead.
+ */
+void quda_complex_cis_array(const quda_float_t* theta, complex_t* out, int count);
+void quda_complex_exp_array(const complex_t* in, complex_t* out, int count);
+void quda_complex_log_array(const complex_t* in, complex_t* out, int count);
+void quda_complex_pow_array(const complex_t* in, complex_t p, complex_t* out, int count);
+void quda_complex_sin_array(const complex_t* in, complex_t* out, int count);
+void quda_complex_cos_array(const complex_t* in, complex_t* out, int count);
+void quda_complex_tanh_array(const complex_t* in, complex_t* out, int count);
+
 /* Complex trigonometric functions */
 complex_t quda_complex_sin(complex_t c);
 complex_t quda_complex_cos(complex_t c);
@@ -1,5 +1,6 @@
 #define QUDA_GATE __device__
 #define CUSTOM_HADAMARD
+#define GATE_DISPATCH(status, qreg, op, a, b, c, k) status = 0
 #define FOR_EACH_STATE(qreg, i) \
   for (i = blockIdx.x * blockDim.x + threadIdx.x; i < qreg->num_states; \
       i += blockDim.x * gridDim.x)
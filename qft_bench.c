@@ -0,0 +1,201 @@
+/* qft_bench.c: compares the quantum fourier transform on sparse, dense and MPS registers
+ * Build it once per amplitude precision (make clean; make PRECISION=16|32|64 qft_bench) to
+ * compare their speed, memory traffic and normalization drift.
+ * The transform of a GHZ state stays at bond dimension 2 until the final bit reversal, whose
+ * swaps leave some bonds wider, so MPS registers are also given an entangled input under a
+ * small bond cap to measure the fidelity truncation costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include "quantum_stdlib.h"
+#include "quantum_gates.h"
+#include "quantum_batch.h"
+
+// Sparse registers hold up to 2^n states after the transform, so they stop here
+#define QFT_BENCH_SPARSE_LIMIT 18
+#define QFT_BENCH_DENSE_LIMIT 24 // 2^24 states take 256 MiB at single precision
+// The bandwidth test streams a batch of 2^24 amplitudes
+#define QFT_BENCH_BATCH_COUNT 1024
+#define QFT_BENCH_BATCH_QUBITS 14
+// The entangled input is this many brickwork layers of H, T and CNOT gates
+#define QFT_BENCH_LAYERS 2
+#define QFT_BENCH_CAPPED_BOND 8
+
+/* Prepares a GHZ state */
+static void qft_bench_ghz(int n, quantum_reg* qreg) {
+	int i;
+	quda_quantum_hadamard_gate(0,qreg);
+	for(i=0;i<n-1;i++) {
+		quda_quantum_controlled_not_gate(i,i+1,qreg);
+	}
+}
+
+/* Prepares an entangled state whose bond dimension grows with each layer */
+static void qft_bench_brickwork(int n, quantum_reg* qreg) {
+	int layer,i;
+	for(layer=0;layer<QFT_BENCH_LAYERS;layer++) {
+		for(i=0;i<n;i++) {
+			quda_quantum_hadamard_gate(i,qreg);
+			quda_quantum_rotate_k_gate(i,qreg,3);
+		}
+		for(i=layer % 2;i<n-1;i+=2) {
+			quda_quantum_controlled_not_gate(i,i+1,qreg);
+		}
+	}
+}
+
+/* Applies the gates of quda_quantum_fourier_transform(), which also prints the state count
+ * after every hadamard, so that only the gates are timed
+ */
+static void qft_bench_transform(int n, quantum_reg* qreg) {
+	int i,j;
+	for(i=n-1;i>=0;i--) {
+		for(j=n-1;j>i;j--) {
+			quda_quantum_controlled_rotate_k_gate(j,i,qreg,j-i+1);
+		}
+		quda_quantum_hadamard_gate(i,qreg);
+	}
+	for(i=0;i<n/2;i++) {
+		quda_quantum_swap_gate(i,n-1-i,qreg);
+	}
+}
+
+/* Prepares an input state on n qubits in the given representation and transforms it.
+ * Returns the time the transform took in seconds, or a negative value on failure, in which
+ * case the register is not left initialized.
+ */
+static double qft_bench_run(int n, int repr, int max_bond, void (*prepare)(int,quantum_reg*),
+		quantum_reg* qreg) {
+	if(quda_quantum_reg_init(qreg,n) == -1) return -1;
+	quda_quantum_reg_set(qreg,0);
+	if(quda_quantum_reg_set_repr(qreg,repr) == -1) {
+		quda_quantum_reg_delete(qreg);
+		return -1;
+	}
+	quda_quantum_reg_set_max_bond(qreg,max_bond);
+	prepare(n,qreg);
+
+	clock_t start = clock();
+	qft_bench_transform(n,qreg);
+	return (clock()-start)/(double)CLOCKS_PER_SEC;
+}
+
+/* Returns the largest bond dimension of an MPS register */
+static int qft_bench_bond(int n, quantum_reg* qreg) {
+	int bond = 0;
+	int i;
+	for(i=0;qreg->repr == QUDA_REPR_MPS && i<=n;i++) {
+		if(qreg->mps_bonds[i] > bond) bond = qreg->mps_bonds[i];
+	}
+	return bond;
+}
+
+/* Returns |<exact|approx>|^2 for two registers with the same dense basis, or a negative value
+ * if 'approx' cannot be expanded.
+ */
+static double qft_bench_overlap(quantum_reg* exact, quantum_reg* approx) {
+	if(quda_quantum_reg_set_repr(approx,QUDA_REPR_DENSE) == -1) return -1;
+	double re = 0, im = 0;
+	int i;
+	for(i=0;i<exact->num_states;i++) {
+		complex_t c = quda_complex_mul(quda_complex_conj(exact->states[i].amplitude),
+				approx->states[i].amplitude);
+		re += c.real;
+		im += c.imag;
+	}
+	return re*re + im*im;
+}
+
+/* Applies a hadamard to every qubit of a batch of registers, each of which reads and writes
+ * all of the batch's amplitudes once. Returns the memory traffic in GB/s, or a negative value
+ * on failure.
+ */
+static double qft_bench_stream(void) {
+	quantum_batch qb;
+	if(quda_quantum_batch_init(&qb,QFT_BENCH_BATCH_COUNT,QFT_BENCH_BATCH_QUBITS) == -1) return -1;
+	clock_t start = clock();
+	int i;
+	for(i=0;i<QFT_BENCH_BATCH_QUBITS;i++) {
+		quda_quantum_batch_hadamard_gate(i,&qb);
+	}
+	double t = (clock()-start)/(double)CLOCKS_PER_SEC;
+	quda_quantum_batch_delete(&qb);
+	double bytes = 2.0*QFT_BENCH_BATCH_QUBITS*QFT_BENCH_BATCH_COUNT*(2*sizeof(quda_real_t))
+			*((uint64_t)1 << QFT_BENCH_BATCH_QUBITS);
+	return (t > 0) ? bytes/t/1e9 : -1;
+}
+
+int main(int argc, char** argv) {
+	int max_qubits = 40;
+	int max_bond = DEFAULT_MAX_BOND;
+	if(argc > 1) {
+		max_qubits = atoi(argv[1]);
+	}
+	if(argc > 2) {
+		max_bond = atoi(argv[2]);
+	}
+
+	printf("QFT_BENCH precision: %d-bit amplitudes, %d bytes per state, %d per batched amplitude\n",
+			QUDA_PRECISION,(int)sizeof(quantum_state_t),(int)(2*sizeof(quda_real_t)));
+	printf("QFT_BENCH batch bandwidth: %.2f GB/s\n",qft_bench_stream());
+	quantum_reg qreg,exact;
+	int n;
+	for(n=4;n<=max_qubits;n+=4) {
+		if(n <= QFT_BENCH_SPARSE_LIMIT) {
+			double t = qft_bench_run(n,QUDA_REPR_SPARSE,max_bond,qft_bench_ghz,&qreg);
+			if(t < 0) {
+				printf("QFT_BENCH sparse n=%d: failed\n",n);
+			} else {
+				printf("QFT_BENCH sparse n=%d: %.3fs, %d states\n",n,t,qreg.num_states);
+				quda_quantum_reg_delete(&qreg);
+			}
+		}
+
+		if(n <= QFT_BENCH_DENSE_LIMIT) {
+			double t = qft_bench_run(n,QUDA_REPR_DENSE,max_bond,qft_bench_ghz,&qreg);
+			if(t < 0) {
+				printf("QFT_BENCH dense n=%d: failed\n",n);
+			} else {
+				double drift = fabs(1 - (double)quda_states_norm(qreg.states,qreg.num_states));
+				printf("QFT_BENCH dense n=%d: %.3fs, %.1f MiB, norm drift %.2e\n",n,t,
+						qreg.num_states*sizeof(quantum_state_t)/1048576.0,drift);
+				quda_quantum_reg_delete(&qreg);
+			}
+		}
+
+		double t = qft_bench_run(n,QUDA_REPR_MPS,max_bond,qft_bench_ghz,&qreg);
+		if(t < 0) {
+			printf("QFT_BENCH mps n=%d: failed\n",n);
+		} else {
+			printf("QFT_BENCH mps n=%d: %.3fs, largest bond %d, fidelity %f\n",n,t,
+					qft_bench_bond(n,&qreg),qreg.fidelity);
+			quda_quantum_reg_delete(&qreg);
+		}
+
+		// The fidelity is an estimate; small registers are also compared with an exact run
+		t = qft_bench_run(n,QUDA_REPR_MPS,QFT_BENCH_CAPPED_BOND,qft_bench_brickwork,&qreg);
+		if(t < 0) {
+			printf("QFT_BENCH mps entangled n=%d: failed\n",n);
+			continue;
+		}
+		int bond = qft_bench_bond(n,&qreg);
+		double overlap = -1;
+		if(n <= QFT_BENCH_SPARSE_LIMIT
+				&& qft_bench_run(n,QUDA_REPR_DENSE,max_bond,qft_bench_brickwork,&exact) >= 0) {
+			overlap = qft_bench_overlap(&exact,&qreg);
+			quda_quantum_reg_delete(&exact);
+		}
+		printf("QFT_BENCH mps entangled n=%d: %.3fs, largest bond %d of %d, fidelity %f",n,t,
+				bond,QFT_BENCH_CAPPED_BOND,qreg.fidelity);
+		if(overlap >= 0) {
+			printf(", overlap with exact %f",overlap);
+		}
+		printf("\n");
+		quda_quantum_reg_delete(&qreg);
+	}
+
+	return 0;
+}
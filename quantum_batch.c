@@ -0,0 +1,335 @@
+/* quantum_batch.c: batches of equal-width dense registers
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include "quantum_batch.h"
+#include "quantum_dispatch.h"
+#include "quantum_dense.h"
+#include "quantum_gates.h"
+#include "complex.h"
+
+#define QUDA_BATCH_BLOCK 512 // registers one thread updates per row before moving on
+#define QUDA_BATCH_PARTS 64  // most parts the rows of a probability sum are split into
+#define QUDA_BATCH_PART 64   // fewest rows a part of a probability sum is given
+
+int quda_quantum_batch_init(quantum_batch* qb, int count, int qubits) {
+	qb->count = count;
+	qb->qubits = qubits;
+	qb->real = NULL;
+	qb->imag = NULL;
+	if(qubits > 30 || count < 1) return -1;
+
+	size_t size = ((size_t)1 << qubits)*count;
+	qb->real = malloc(2*size*sizeof(quda_real_t));
+	if(qb->real == NULL) {
+		return -1;
+	}
+	qb->imag = qb->real + size;
+	quda_quantum_batch_set(qb,0);
+	return 0;
+}
+
+void quda_quantum_batch_delete(quantum_batch* qb) {
+	free(qb->real);
+	qb->real = NULL;
+	qb->imag = NULL;
+}
+
+void quda_quantum_batch_set(quantum_batch* qb, uint64_t state) {
+	size_t size = ((size_t)1 << qb->qubits)*qb->count;
+	size_t i;
+	for(i=0;i<size;i++) {
+		qb->real[i] = 0;
+		qb->imag[i] = 0;
+	}
+	for(i=0;i<(size_t)qb->count;i++) {
+		qb->real[state*qb->count+i] = 1;
+	}
+}
+
+void quda_quantum_batch_set_register(quantum_batch* qb, int index, uint64_t state) {
+	uint64_t i;
+	for(i=0;i<((uint64_t)1 << qb->qubits);i++) {
+		qb->real[i*qb->count+index] = (i == state) ? 1 : 0;
+		qb->imag[i*qb->count+index] = 0;
+	}
+}
+
+complex_t quda_quantum_batch_amplitude(quantum_batch* qb, int index, uint64_t state) {
+	complex_t a = { .real = qb->real[state*qb->count+index], .imag = qb->imag[state*qb->count+index] };
+	return a;
+}
+
+/* Applies one base operation to registers [start,end) of the amplitude rows (r0,i0) and
+ * (r1,i1). Diagonal operations multiply the second row by c.
+ */
+static void quda_quantum_batch_kernel(int op, complex_t c, quda_real_t* restrict r0,
+		quda_real_t* restrict i0, quda_real_t* restrict r1, quda_real_t* restrict i1, int start,
+		int end) {
+	int r;
+	quda_float_t x,y;
+	switch(op) {
+		case QUDA_OP_HADAMARD:
+			for(r=start;r<end;r++) {
+				x = r0[r];
+				y = i0[r];
+				r0[r] = (x + r1[r])*ONE_OVER_SQRT_2;
+				i0[r] = (y + i1[r])*ONE_OVER_SQRT_2;
+				r1[r] = (x - r1[r])*ONE_OVER_SQRT_2;
+				i1[r] = (y - i1[r])*ONE_OVER_SQRT_2;
+			}
+			break;
+		case QUDA_OP_PAULI_X:
+		case QUDA_OP_SWAP:
+			for(r=start;r<end;r++) {
+				x = r0[r];
+				y = i0[r];
+				r0[r] = r1[r];
+				i0[r] = i1[r];
+				r1[r] = x;
+				i1[r] = y;
+			}
+			break;
+		case QUDA_OP_PAULI_Y:
+			// Same convention as the sparse kernel: |0> -> -i|1>, |1> -> i|0>
+			for(r=start;r<end;r++) {
+				x = r0[r];
+				y = i0[r];
+				r0[r] = -i1[r];
+				i0[r] = r1[r];
+				r1[r] = y;
+				i1[r] = -x;
+			}
+			break;
+		default:
+			for(r=start;r<end;r++) {
+				x = r1[r];
+				y = i1[r];
+				r1[r] = x*c.real - y*c.imag;
+				i1[r] = x*c.imag + y*c.real;
+			}
+			break;
+	}
+}
+
+static void quda_quantum_batch_gate(quantum_batch* qb, int gate_op, int a, int b, int c, int k) {
+	quantum_gate_t gate = { gate_op, { a, b, c }, k, NULL };
+	int op,target1,target2;
+	uint64_t controls;
+	quda_gate_decompose(&gate,&op,&controls,&target1,&target2);
+
+	uint64_t mask0 = 0;
+	uint64_t mask1 = (uint64_t)1 << target1;
+	uint64_t fixed = controls | mask1;
+	if(op == QUDA_OP_SWAP) {
+		// The pair is (target1 set, target2 clear) and (target1 clear, target2 set)
+		mask0 = mask1;
+		mask1 = (uint64_t)1 << target2;
+		fixed |= mask1;
+	}
+
+	complex_t factor = QUDA_COMPLEX_ONE;
+	uint64_t mask;
+	quda_gate_diagonal(&gate,&mask,&factor);
+
+	// Every pair of rows and block of registers is independent, so small batches still
+	// spread their pairs over the threads
+	uint64_t pairs = (uint64_t)1 << (qb->qubits - __builtin_popcountll(fixed));
+	int count = qb->count;
+	uint64_t p;
+	int block;
+	#ifdef _OPENMP
+	#pragma omp parallel for collapse(2) schedule(static)
+	#endif
+	for(p=0;p<pairs;p++) {
+		for(block=0;block<count;block+=QUDA_BATCH_BLOCK) {
+			int end = (block+QUDA_BATCH_BLOCK < count) ? block+QUDA_BATCH_BLOCK : count;
+			uint64_t base = quda_dense_insert_zeros(p,fixed) | controls;
+			size_t row0 = (base | mask0)*count;
+			size_t row1 = (base | mask1)*count;
+			quda_quantum_batch_kernel(op,factor,qb->real+row0,qb->imag+row0,
+					qb->real+row1,qb->imag+row1,block,end);
+		}
+	}
+}
+
+void quda_quantum_batch_hadamard_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_HADAMARD,target,-1,-1,0);
+}
+
+void quda_quantum_batch_pauli_x_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_PAULI_X,target,-1,-1,0);
+}
+
+void quda_quantum_batch_pauli_y_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_PAULI_Y,target,-1,-1,0);
+}
+
+void quda_quantum_batch_pauli_z_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_PAULI_Z,target,-1,-1,0);
+}
+
+void quda_quantum_batch_phase_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_PHASE,target,-1,-1,0);
+}
+
+void quda_quantum_batch_pi_over_8_gate(int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_PI_OVER_8,target,-1,-1,0);
+}
+
+void quda_quantum_batch_rotate_k_gate(int target, quantum_batch* qb, int k) {
+	quda_quantum_batch_gate(qb,QUDA_OP_ROTATE_K,target,-1,-1,k);
+}
+
+void quda_quantum_batch_swap_gate(int target1, int target2, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_SWAP,target1,target2,-1,0);
+}
+
+void quda_quantum_batch_controlled_not_gate(int control, int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_CONTROLLED_NOT,control,target,-1,0);
+}
+
+void quda_quantum_batch_controlled_y_gate(int control, int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_CONTROLLED_Y,control,target,-1,0);
+}
+
+void quda_quantum_batch_controlled_z_gate(int control, int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_CONTROLLED_Z,control,target,-1,0);
+}
+
+void quda_quantum_batch_controlled_phase_gate(int control, int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_CONTROLLED_PHASE,control,target,-1,0);
+}
+
+void quda_quantum_batch_controlled_rotate_k_gate(int control, int target, quantum_batch* qb, int k) {
+	quda_quantum_batch_gate(qb,QUDA_OP_CONTROLLED_ROTATE_K,control,target,-1,k);
+}
+
+void quda_quantum_batch_toffoli_gate(int control1, int control2, int target, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_TOFFOLI,control1,control2,target,0);
+}
+
+void quda_quantum_batch_fredkin_gate(int control, int target1, int target2, quantum_batch* qb) {
+	quda_quantum_batch_gate(qb,QUDA_OP_FREDKIN,control,target1,target2,0);
+}
+
+int quda_quantum_batch_measure(quantum_batch* qb, uint64_t* results) {
+	if(results == NULL) return -2;
+	int count = qb->count;
+	quda_accum_t* f = malloc(count*sizeof(quda_accum_t));
+	if(f == NULL) {
+		return -1;
+	}
+
+	// rand() is not thread-safe, so every register draws up front
+	int r;
+	for(r=0;r<count;r++) {
+		f[r] = quda_rand_float();
+		results[r] = 0;
+	}
+
+	uint64_t states = (uint64_t)1 << qb->qubits;
+	int block;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for(block=0;block<count;block+=QUDA_BATCH_BLOCK) {
+		int end = (block+QUDA_BATCH_BLOCK < count) ? block+QUDA_BATCH_BLOCK : count;
+		uint64_t j;
+		int i;
+		for(j=0;j<states;j++) {
+			const quda_real_t* re = qb->real + j*count;
+			const quda_real_t* im = qb->imag + j*count;
+			for(i=block;i<end;i++) {
+				// The last state with any probability absorbs rounding errors
+				quda_float_t p = (quda_float_t)re[i]*re[i] + (quda_float_t)im[i]*im[i];
+				if(f[i] >= 0 && p > 0) {
+					results[i] = j;
+					f[i] -= p;
+				}
+			}
+		}
+	}
+
+	free(f);
+	return 0;
+}
+
+int quda_quantum_batch_bit_measure_and_collapse(int target, quantum_batch* qb, int* results) {
+	if(results == NULL) return -2;
+	int count = qb->count;
+	uint64_t states = (uint64_t)1 << qb->qubits;
+	uint64_t mask = (uint64_t)1 << target;
+	uint64_t half = states/2;
+
+	/* The rows with the bit set are split into parts whose number only depends on the
+	 * register width. Each part sums its rows in order for every register, and the parts
+	 * are added in order, so the probabilities do not depend on the number of threads.
+	 */
+	int parts = (half/QUDA_BATCH_PART > QUDA_BATCH_PARTS) ? QUDA_BATCH_PARTS : (int)(half/QUDA_BATCH_PART);
+	if(parts < 1) parts = 1;
+	quda_accum_t* p1 = malloc((size_t)(parts+1)*count*sizeof(quda_accum_t));
+	if(p1 == NULL) {
+		return -1;
+	}
+	quda_accum_t* scale = p1 + (size_t)parts*count;
+
+	int part,block,r;
+	#ifdef _OPENMP
+	#pragma omp parallel for collapse(2) schedule(static)
+	#endif
+	for(part=0;part<parts;part++) {
+		for(block=0;block<count;block+=QUDA_BATCH_BLOCK) {
+			int end = (block+QUDA_BATCH_BLOCK < count) ? block+QUDA_BATCH_BLOCK : count;
+			quda_accum_t* sum = p1 + (size_t)part*count;
+			uint64_t k;
+			int i;
+			for(i=block;i<end;i++) {
+				sum[i] = 0;
+			}
+			for(k=part*half/parts;k<(part+1)*half/parts;k++) {
+				uint64_t j = quda_dense_insert_zeros(k,mask) | mask;
+				const quda_real_t* re = qb->real + j*count;
+				const quda_real_t* im = qb->imag + j*count;
+				for(i=block;i<end;i++) {
+					sum[i] += (quda_float_t)re[i]*re[i] + (quda_float_t)im[i]*im[i];
+				}
+			}
+		}
+	}
+	for(part=1;part<parts;part++) {
+		for(r=0;r<count;r++) {
+			p1[r] += p1[(size_t)part*count+r];
+		}
+	}
+
+	// As quda_quantum_bit_measure(): the bit is 1 if its probability exceeds the draw
+	for(r=0;r<count;r++) {
+		results[r] = (p1[r] > quda_rand_float()) ? 1 : 0;
+		quda_accum_t p = results[r] ? p1[r] : 1 - p1[r];
+		scale[r] = (p > 0) ? 1/sqrt(p) : 0;
+	}
+
+	uint64_t j;
+	#ifdef _OPENMP
+	#pragma omp parallel for collapse(2) schedule(static)
+	#endif
+	for(j=0;j<states;j++) {
+		for(block=0;block<count;block+=QUDA_BATCH_BLOCK) {
+			int end = (block+QUDA_BATCH_BLOCK < count) ? block+QUDA_BATCH_BLOCK : count;
+			quda_real_t* re = qb->real + j*count;
+			quda_real_t* im = qb->imag + j*count;
+			int value = (j & mask) ? 1 : 0;
+			int i;
+			for(i=block;i<end;i++) {
+				quda_float_t k = (results[i] == value) ? scale[i] : 0;
+				re[i] *= k;
+				im[i] *= k;
+			}
+		}
+	}
+
+	free(p1);
+	return 0;
+}
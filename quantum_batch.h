@@ -0,0 +1,68 @@
+/* quantum_batch.h: header for batches of equal-width dense registers
+*/
+
+#ifndef __QUDA_QUANTUM_BATCH_H
+#define __QUDA_QUANTUM_BATCH_H
+
+#include "quantum_reg.h"
+
+/* Many registers of the same width, all dense, in one structure-of-arrays buffer.
+ * Amplitude 'state' of register r is (real[state*count+r], imag[state*count+r]), so each
+ * gate walks its index pairs once and updates every register of the batch in a contiguous,
+ * vectorizable inner loop. Rows of amplitudes and blocks of registers within them are
+ * spread over OpenMP threads when the library is built with OpenMP.
+ */
+typedef struct quantum_batch {
+	int count;
+	int qubits;
+	quda_real_t* real;
+	quda_real_t* imag;
+} quantum_batch;
+
+/* Initializes a batch of 'count' registers of 'qubits' qubits each, all in state 0.
+ * Returns 0 on success or -1 if allocation fails or the registers exceed 30 qubits.
+ */
+int quda_quantum_batch_init(quantum_batch* qb, int count, int qubits);
+
+/* Frees the batch's buffer */
+void quda_quantum_batch_delete(quantum_batch* qb);
+
+/* Sets every register of the batch to 'state' with probability 1 */
+void quda_quantum_batch_set(quantum_batch* qb, uint64_t state);
+
+/* Sets register 'index' of the batch to 'state' with probability 1 */
+void quda_quantum_batch_set_register(quantum_batch* qb, int index, uint64_t state);
+
+/* Returns the amplitude of 'state' in register 'index' */
+complex_t quda_quantum_batch_amplitude(quantum_batch* qb, int index, uint64_t state);
+
+// Batched gates, applied to every register (see quantum_gates.h)
+void quda_quantum_batch_hadamard_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_pauli_x_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_pauli_y_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_pauli_z_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_phase_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_pi_over_8_gate(int target, quantum_batch* qb);
+void quda_quantum_batch_rotate_k_gate(int target, quantum_batch* qb, int k);
+void quda_quantum_batch_swap_gate(int target1, int target2, quantum_batch* qb);
+void quda_quantum_batch_controlled_not_gate(int control, int target, quantum_batch* qb);
+void quda_quantum_batch_controlled_y_gate(int control, int target, quantum_batch* qb);
+void quda_quantum_batch_controlled_z_gate(int control, int target, quantum_batch* qb);
+void quda_quantum_batch_controlled_phase_gate(int control, int target, quantum_batch* qb);
+void quda_quantum_batch_controlled_rotate_k_gate(int control, int target, quantum_batch* qb, int k);
+void quda_quantum_batch_toffoli_gate(int control1, int control2, int target, quantum_batch* qb);
+void quda_quantum_batch_fredkin_gate(int control, int target1, int target2, quantum_batch* qb);
+
+/* Measures every register of the batch without collapsing it, storing one state per
+ * register in 'results'. Returns 0 on success, -1 if allocation fails or -2 if 'results'
+ * is NULL.
+ */
+int quda_quantum_batch_measure(quantum_batch* qb, uint64_t* results);
+
+/* Measures one bit of every register and collapses each register to its outcome, storing
+ * one outcome per register in 'results'. Returns 0 on success, -1 if allocation fails or -2
+ * if 'results' is NULL.
+ */
+int quda_quantum_batch_bit_measure_and_collapse(int target, quantum_batch* qb, int* results);
+
+#endif // __QUDA_QUANTUM_BATCH_H
@@ -0,0 +1,267 @@
+/* quantum_dense.c: in-place gate kernels on dense registers
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "quantum_dense.h"
+#include "quantum_gates.h"
+#include "complex.h"
+
+#define QUDA_DENSE_MIN_SHARD 14   // log2 of the fewest states an automatic shard holds
+#define QUDA_DENSE_EXCHANGE 1024  // partner amplitudes copied per shard between barriers
+
+uint64_t quda_dense_insert_zeros(uint64_t k, uint64_t fixed) {
+#ifdef __BMI2__
+	return _pdep_u64(k,~fixed);
+#else
+	// Insert a zero at each fixed position, lowest first, so later positions stay aligned
+	while(fixed) {
+		uint64_t low = (fixed & -fixed)-1;
+		k = ((k & ~low) << 1) | (k & low);
+		fixed &= fixed-1;
+	}
+	return k;
+#endif
+}
+
+int quda_dense_shard_bits(quantum_reg* qreg, int bits) {
+	int shards = qreg->shards;
+	int limit = bits;
+	if(shards == 0) {
+		#ifdef _OPENMP
+		shards = omp_get_max_threads();
+		#else
+		shards = 1;
+		#endif
+		limit = bits - QUDA_DENSE_MIN_SHARD;
+	}
+
+	int p = 0;
+	while(p < limit && ((int64_t)2 << p) <= shards) {
+		p++;
+	}
+	return p;
+}
+
+void quda_dense_init_states(quantum_reg* qreg, quantum_state_t* s, int bits) {
+	int p = quda_dense_shard_bits(qreg,bits);
+	int64_t shards = (int64_t)1 << p;
+	uint64_t per_shard = (uint64_t)1 << (bits - p);
+	int64_t shard;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static) num_threads(shards) if(shards > 1)
+	#endif
+	for(shard=0;shard<shards;shard++) {
+		uint64_t i;
+		for(i=shard*per_shard;i<(shard+1)*per_shard;i++) {
+			s[i].state = i;
+			s[i].amplitude = QUDA_COMPLEX_ZERO;
+		}
+	}
+}
+
+/* Applies a diagonal factor or a basis operation to the indices of one partition, stored
+ * from 's' on. 'fixed' and 'set' are the enumerated and required bits below the partition
+ * bits. Pair operations act on (i | tmask, i | t2mask) for swaps and (i, i | tmask) otherwise.
+ */
+static void quda_dense_apply_shard(quantum_state_t* s, int op, complex_t c, uint64_t fixed,
+		uint64_t set, uint64_t tmask, uint64_t t2mask, uint64_t count) {
+	complex_t a0,a1;
+	uint64_t k,i0,i1;
+
+	switch(op) {
+		case QUDA_OP_HADAMARD:
+			for(k=0;k<count;k++) {
+				i0 = quda_dense_insert_zeros(k,fixed) | set;
+				i1 = i0 | tmask;
+				a0 = s[i0].amplitude;
+				a1 = s[i1].amplitude;
+				s[i0].amplitude = quda_complex_rmul(quda_complex_add(a0,a1),ONE_OVER_SQRT_2);
+				s[i1].amplitude = quda_complex_rmul(quda_complex_sub(a0,a1),ONE_OVER_SQRT_2);
+			}
+			break;
+		case QUDA_OP_PAULI_X:
+			for(k=0;k<count;k++) {
+				i0 = quda_dense_insert_zeros(k,fixed) | set;
+				i1 = i0 | tmask;
+				a0 = s[i0].amplitude;
+				s[i0].amplitude = s[i1].amplitude;
+				s[i1].amplitude = a0;
+			}
+			break;
+		case QUDA_OP_PAULI_Y:
+			for(k=0;k<count;k++) {
+				i0 = quda_dense_insert_zeros(k,fixed) | set;
+				i1 = i0 | tmask;
+				a0 = s[i0].amplitude;
+				// Same convention as the sparse kernel: |0> -> -i|1>, |1> -> i|0>
+				s[i0].amplitude = quda_complex_mul_i(s[i1].amplitude);
+				s[i1].amplitude = quda_complex_mul_ni(a0);
+			}
+			break;
+		case QUDA_OP_SWAP:
+			for(k=0;k<count;k++) {
+				i0 = quda_dense_insert_zeros(k,fixed) | set;
+				i1 = i0 | t2mask;
+				i0 |= tmask;
+				a0 = s[i0].amplitude;
+				s[i0].amplitude = s[i1].amplitude;
+				s[i1].amplitude = a0;
+			}
+			break;
+		default:
+			// Diagonal gates: 'set' already includes the target
+			for(k=0;k<count;k++) {
+				i1 = quda_dense_insert_zeros(k,fixed) | set;
+				s[i1].amplitude = quda_complex_mul(s[i1].amplitude,c);
+			}
+			break;
+	}
+}
+
+void quda_dense_apply_partition(quantum_state_t* s, const quantum_gate_t* gate, uint64_t base,
+		int bits) {
+	int op,target1,target2;
+	uint64_t controls;
+	quda_gate_decompose(gate,&op,&controls,&target1,&target2);
+
+	uint64_t tmask = (uint64_t)1 << target1;
+	uint64_t t2mask = (op == QUDA_OP_SWAP) ? (uint64_t)1 << target2 : 0;
+	complex_t c = QUDA_COMPLEX_ONE;
+	uint64_t fixed = controls | tmask | t2mask;
+	uint64_t set = controls;
+	uint64_t mask;
+	if(quda_gate_diagonal(gate,&mask,&c)) {
+		op = -1;
+		set = mask;
+	}
+
+	// Partitions whose index bits clear a required bit hold nothing to update
+	uint64_t low = ((uint64_t)1 << bits) - 1;
+	if((base & set & ~low) != (set & ~low)) return;
+
+	uint64_t count = (uint64_t)1 << (bits - __builtin_popcountll(fixed & low));
+	quda_dense_apply_shard(s,op,c,fixed & low,set & low,tmask,t2mask,count);
+}
+
+int quda_dense_pair_matrix(const quantum_gate_t* gate, complex_t* u, uint64_t* controls,
+		uint64_t* lo, uint64_t* hi) {
+	int op,target1,target2;
+	uint64_t mask;
+	complex_t c;
+	quda_gate_decompose(gate,&op,controls,&target1,&target2);
+	if(quda_gate_diagonal(gate,&mask,&c)) return 0;
+
+	const complex_t h = { .real = ONE_OVER_SQRT_2, .imag = 0 };
+	u[0] = u[3] = QUDA_COMPLEX_ZERO;
+	u[1] = u[2] = QUDA_COMPLEX_ONE;
+	if(op == QUDA_OP_HADAMARD) {
+		u[0] = u[1] = u[2] = h;
+		u[3] = quda_complex_neg(h);
+	} else if(op == QUDA_OP_PAULI_Y) {
+		u[1] = QUDA_I;
+		u[2] = quda_complex_neg(QUDA_I);
+	}
+
+	// A swap is an X between the two states in which exactly one target bit is set
+	*lo = (op == QUDA_OP_SWAP) ? (uint64_t)1 << target1 : 0;
+	*hi = (uint64_t)1 << ((op == QUDA_OP_SWAP) ? target2 : target1);
+	return 1;
+}
+
+/* Applies a pair operation whose two indices lie in different shards. Every shard only
+ * writes its own amplitudes: it first copies a block of its partners' amplitudes into a
+ * buffer of its own and, once every shard has done so, updates that block in place from the
+ * buffer (see quda_dense_pair_matrix() for u, controls, lo and hi).
+ */
+static int quda_dense_exchange(quantum_reg* qreg, const complex_t* u, uint64_t controls,
+		uint64_t lo, uint64_t hi, int p, int high) {
+	int64_t shards = (int64_t)1 << p;
+	uint64_t pair = lo | hi;
+	uint64_t local = (uint64_t)1 << high;
+	complex_t* buffer = malloc(shards*QUDA_DENSE_EXCHANGE*sizeof(complex_t));
+	if(buffer == NULL) {
+		return -1;
+	}
+	quantum_state_t* s = qreg->states;
+
+	#ifdef _OPENMP
+	#pragma omp parallel num_threads(shards)
+	#endif
+	{
+		int64_t first = 0, step = 1;
+		#ifdef _OPENMP
+		first = omp_get_thread_num();
+		step = omp_get_num_threads();
+		#endif
+		uint64_t block,j;
+		int64_t shard;
+		for(block=0;block<local;block+=QUDA_DENSE_EXCHANGE) {
+			uint64_t end = (block+QUDA_DENSE_EXCHANGE < local) ? block+QUDA_DENSE_EXCHANGE : local;
+			for(shard=first;shard<shards;shard+=step) {
+				complex_t* b = buffer + shard*QUDA_DENSE_EXCHANGE - block;
+				for(j=block;j<end;j++) {
+					uint64_t i = ((uint64_t)shard << high) | j;
+					uint64_t role = i & pair;
+					if((i & controls) == controls && (role == lo || role == hi)) {
+						b[j] = s[i ^ pair].amplitude;
+					}
+				}
+			}
+			#ifdef _OPENMP
+			#pragma omp barrier
+			#endif
+			for(shard=first;shard<shards;shard+=step) {
+				complex_t* b = buffer + shard*QUDA_DENSE_EXCHANGE - block;
+				for(j=block;j<end;j++) {
+					uint64_t i = ((uint64_t)shard << high) | j;
+					uint64_t role = i & pair;
+					if((i & controls) == controls && (role == lo || role == hi)) {
+						int r = (role == hi);
+						s[i].amplitude = quda_complex_add(quda_complex_mul(u[r*2+r],s[i].amplitude),
+								quda_complex_mul(u[r*2+1-r],b[j]));
+					}
+				}
+			}
+			#ifdef _OPENMP
+			#pragma omp barrier
+			#endif
+		}
+	}
+
+	free(buffer);
+	return 0;
+}
+
+void quda_dense_apply(quantum_reg* qreg, const quantum_gate_t* gate) {
+	// The top p index bits select the partition
+	int bits = qreg->qubits + qreg->scratch;
+	int p = quda_dense_shard_bits(qreg,bits);
+	int high = bits - p;
+	uint64_t low = ((uint64_t)1 << high) - 1;
+	int64_t shards = (int64_t)1 << p;
+
+	complex_t u[4];
+	uint64_t controls,lo,hi;
+	if(quda_dense_pair_matrix(gate,u,&controls,&lo,&hi) && ((lo | hi) & ~low)) {
+		if(quda_dense_exchange(qreg,u,controls,lo,hi,p,high) == 0) return;
+		// Without an exchange buffer the register is processed as a single partition
+		high = bits;
+		shards = 1;
+	}
+
+	int64_t shard;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static) num_threads(shards) if(shards > 1)
+	#endif
+	for(shard=0;shard<shards;shard++) {
+		uint64_t base = (uint64_t)shard << high;
+		quda_dense_apply_partition(qreg->states + base,gate,base,high);
+	}
+}
@@ -0,0 +1,47 @@
+/* quantum_dense.h: header for in-place gate kernels on dense registers
+*/
+
+#ifndef __QUDA_QUANTUM_DENSE_H
+#define __QUDA_QUANTUM_DENSE_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* Applies a gate in place to a register in the dense representation.
+ * Only the index pairs (or single indices, for diagonal gates) whose control bits are all
+ * set are visited, and no states are created, sorted or coalesced. Each partition of the
+ * register is updated by its own thread.
+ */
+void quda_dense_apply(quantum_reg* qreg, const quantum_gate_t* gate);
+
+/* Applies a gate to the 2^bits amplitudes 's' of the partition of a dense register whose
+ * index bits above 'bits' are those of 'base'. Pair gates must not act on those bits.
+ */
+void quda_dense_apply_partition(quantum_state_t* s, const quantum_gate_t* gate, uint64_t base,
+		int bits);
+
+/* Describes a gate that is not diagonal as the 2x2 matrix u (entry [out*2+in]) acting on the
+ * pairs of states with all 'controls' bits set whose lo | hi bits equal 'lo' (role 0) and
+ * 'hi' (role 1) respectively.
+ * Returns 1 if the gate was described or 0 for diagonal gates.
+ */
+int quda_dense_pair_matrix(const quantum_gate_t* gate, complex_t* u, uint64_t* controls,
+		uint64_t* lo, uint64_t* hi);
+
+/* Spreads the bits of k over the zero bits of 'fixed' (PDEP with the complement mask).
+ * Counting k through 2^(n-popcount(fixed)) enumerates every n-bit index whose 'fixed' bits
+ * are all zero.
+ */
+uint64_t quda_dense_insert_zeros(uint64_t k, uint64_t fixed);
+
+/* Returns log2 of the number of partitions a dense register of 'bits' bits is split into
+ * (see quda_quantum_reg_set_shards()).
+ */
+int quda_dense_shard_bits(quantum_reg* qreg, int bits);
+
+/* Initializes 's' to the 2^bits zero-amplitude dense states, each partition from the thread
+ * that later updates it.
+ */
+void quda_dense_init_states(quantum_reg* qreg, quantum_state_t* s, int bits);
+
+#endif // __QUDA_QUANTUM_DENSE_H
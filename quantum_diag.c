@@ -0,0 +1,60 @@
+/* quantum_diag.c: deferred diagonal-gate queue
+*/
+
+#include "quantum_diag.h"
+#include "complex.h"
+
+int quda_diag_queue(quantum_gate_t* gate) {
+	quantum_reg* qreg = gate->reg;
+	uint64_t mask;
+	complex_t factor;
+	if(!quda_gate_diagonal(gate,&mask,&factor)) return 0;
+
+	int i;
+	for(i=0;i<qreg->diag_count;i++) {
+		if(qreg->diag_terms[i].mask == mask) {
+			qreg->diag_terms[i].factor = quda_complex_mul(qreg->diag_terms[i].factor,factor);
+			return 1;
+		}
+	}
+
+	if(qreg->diag_count == qreg->diag_size) {
+		int size = qreg->diag_size ? 2*qreg->diag_size : 16;
+		quantum_phase_t* temp_terms = realloc(qreg->diag_terms,size*sizeof(quantum_phase_t));
+		if(temp_terms == NULL) {
+			return 0;
+		}
+		qreg->diag_terms = temp_terms;
+		qreg->diag_size = size;
+	}
+
+	qreg->diag_terms[qreg->diag_count].mask = mask;
+	qreg->diag_terms[qreg->diag_count].factor = factor;
+	qreg->diag_count++;
+	return 1;
+}
+
+void quda_diag_flush(quantum_reg* qreg) {
+	if(qreg->diag_count == 0) return;
+
+	// Dense registers store states[i].state == i, so one loop serves both representations
+	if(qreg->diag_count == 1) {
+		quda_states_mask_mul(qreg->states,qreg->num_states,qreg->diag_terms[0].mask,
+				qreg->diag_terms[0].mask,qreg->diag_terms[0].factor);
+		qreg->diag_count = 0;
+		return;
+	}
+	int i,j;
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t s = qreg->states[i].state;
+		complex_t a = qreg->states[i].amplitude;
+		for(j=0;j<qreg->diag_count;j++) {
+			if((s & qreg->diag_terms[j].mask) == qreg->diag_terms[j].mask) {
+				a = quda_complex_mul(a,qreg->diag_terms[j].factor);
+			}
+		}
+		qreg->states[i].amplitude = a;
+	}
+
+	qreg->diag_count = 0;
+}
@@ -0,0 +1,19 @@
+/* quantum_diag.h: header for the deferred diagonal-gate queue
+*/
+
+#ifndef __QUDA_QUANTUM_DIAG_H
+#define __QUDA_QUANTUM_DIAG_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* Queues a diagonal gate on its register as a phase term over the state bits.
+ * Terms with the same mask are merged. Returns 1 if the gate was queued, or 0 if it is not
+ * diagonal (or the queue could not grow), in which case it must be applied normally.
+ */
+int quda_diag_queue(quantum_gate_t* gate);
+
+/* Applies every queued phase term to the stored states in one pass and empties the queue. */
+void quda_diag_flush(quantum_reg* qreg);
+
+#endif // __QUDA_QUANTUM_DIAG_H
@@ -0,0 +1,148 @@
+/* quantum_dispatch.c: routes gates to the register's representation
+*/
+
+#include "quantum_dispatch.h"
+#include "quantum_dense.h"
+#include "quantum_frame.h"
+#include "quantum_diag.h"
+#include "quantum_factor.h"
+#include "quantum_stabilizer.h"
+#include "quantum_mps.h"
+#include "quantum_shard.h"
+#include "quantum_gates.h"
+#include <math.h>
+
+/* Rewrites the gate's logical qubits as physical ones. Swaps only exchange two entries of the
+ * qubit map, so 1 is returned if the gate needs no further work.
+ */
+static int quda_gate_relabel(quantum_gate_t* gate) {
+	unsigned char* map = gate->reg->qubit_map;
+	if(gate->op == QUDA_OP_SWAP) {
+		unsigned char temp = map[gate->q[0]];
+		map[gate->q[0]] = map[gate->q[1]];
+		map[gate->q[1]] = temp;
+		return 1;
+	}
+
+	int i;
+	for(i=0;i<3;i++) {
+		if(gate->q[i] >= 0) gate->q[i] = map[gate->q[i]];
+	}
+	return 0;
+}
+
+int quda_gate_dispatch(quantum_gate_t* gate) {
+	if(gate->reg->repr == QUDA_REPR_SHARDED) {
+		// Sharding applied every flag's deferred work and cleared the flags
+		return quda_shard_apply(gate);
+	}
+
+	if(gate->reg->flags & QUDA_REG_VIRTUAL_QUBITS) {
+		if(quda_gate_relabel(gate)) return 1;
+	}
+
+	if(gate->reg->factors != NULL) {
+		// The gate continues on the factor that now holds all of its qubits
+		int status = quda_factor_redirect(gate);
+		if(status != 0) return status;
+		return quda_gate_dispatch(gate);
+	}
+
+	if(gate->reg->repr == QUDA_REPR_STABILIZER) {
+		if(quda_stabilizer_apply(gate)) return 1;
+		// Any other gate needs amplitudes
+		if(quda_quantum_reg_unshare(gate->reg) == -1) return -1;
+		if(quda_stabilizer_leave(gate->reg) == -1) return -1;
+	}
+	if(gate->reg->repr == QUDA_REPR_MPS) {
+		return quda_mps_apply(gate);
+	}
+
+	// Everything below may write the stored states, which a clone must not see
+	if(quda_quantum_reg_unshare(gate->reg) == -1) return -1;
+
+	if(gate->reg->flags & QUDA_REG_PAULI_FRAME) {
+		if(quda_frame_absorb(gate)) return 1;
+	}
+
+	if(gate->reg->flags & QUDA_REG_DIAGONAL_QUEUE) {
+		if(quda_diag_queue(gate)) return 1;
+		// Anything else must see the queued phases first
+		quda_diag_flush(gate->reg);
+	}
+
+	if(gate->reg->repr == QUDA_REPR_DENSE) {
+		quda_dense_apply(gate->reg,gate);
+		return 1;
+	}
+
+	return 0;
+}
+
+void quda_gate_decompose(const quantum_gate_t* gate, int* op, uint64_t* controls,
+		int* target1, int* target2) {
+	*controls = 0;
+	*target1 = gate->q[0];
+	*target2 = -1;
+
+	switch(gate->op) {
+		case QUDA_OP_SWAP:
+			*op = QUDA_OP_SWAP;
+			*target2 = gate->q[1];
+			return;
+		case QUDA_OP_TOFFOLI:
+			*op = QUDA_OP_PAULI_X;
+			*controls = ((uint64_t)1 << gate->q[0]) | ((uint64_t)1 << gate->q[1]);
+			*target1 = gate->q[2];
+			return;
+		case QUDA_OP_FREDKIN:
+			*op = QUDA_OP_SWAP;
+			*controls = (uint64_t)1 << gate->q[0];
+			*target1 = gate->q[1];
+			*target2 = gate->q[2];
+			return;
+		case QUDA_OP_CONTROLLED_NOT: *op = QUDA_OP_PAULI_X; break;
+		case QUDA_OP_CONTROLLED_Y: *op = QUDA_OP_PAULI_Y; break;
+		case QUDA_OP_CONTROLLED_Z: *op = QUDA_OP_PAULI_Z; break;
+		case QUDA_OP_CONTROLLED_PHASE: *op = QUDA_OP_PHASE; break;
+		case QUDA_OP_CONTROLLED_ROTATE_K: *op = QUDA_OP_ROTATE_K; break;
+		default:
+			// Uncontrolled single-qubit gate
+			*op = gate->op;
+			return;
+	}
+
+	// Singly-controlled gates take (control, target)
+	*controls = (uint64_t)1 << gate->q[0];
+	*target1 = gate->q[1];
+}
+
+int quda_gate_diagonal(const quantum_gate_t* gate, uint64_t* mask, complex_t* factor) {
+	int op,target1,target2;
+	uint64_t controls;
+	quda_gate_decompose(gate,&op,&controls,&target1,&target2);
+	*mask = controls | ((uint64_t)1 << target1);
+
+	quda_float_t temp;
+	switch(op) {
+		case QUDA_OP_PAULI_Z:
+			factor->real = -1;
+			factor->imag = 0;
+			return 1;
+		case QUDA_OP_PHASE:
+			factor->real = 0;
+			factor->imag = 1;
+			return 1;
+		case QUDA_OP_PI_OVER_8:
+			factor->real = ONE_OVER_SQRT_2;
+			factor->imag = ONE_OVER_SQRT_2;
+			return 1;
+		case QUDA_OP_ROTATE_K:
+			temp = QUDA_PI / (1 << (gate->k-1));
+			factor->real = cos(temp);
+			factor->imag = sin(temp);
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+/* quantum_dispatch.h: header for routing gates to the register's representation
+*/
+
+#ifndef __QUDA_QUANTUM_DISPATCH_H
+#define __QUDA_QUANTUM_DISPATCH_H
+
+#include "quantum_reg.h"
+
+// One entry per public gate in quantum_gates.h
+enum {
+	QUDA_OP_HADAMARD,
+	QUDA_OP_PAULI_X,
+	QUDA_OP_PAULI_Y,
+	QUDA_OP_PAULI_Z,
+	QUDA_OP_PHASE,
+	QUDA_OP_PI_OVER_8,
+	QUDA_OP_ROTATE_K,
+	QUDA_OP_SWAP,
+	QUDA_OP_CONTROLLED_NOT,
+	QUDA_OP_CONTROLLED_Y,
+	QUDA_OP_CONTROLLED_Z,
+	QUDA_OP_CONTROLLED_PHASE,
+	QUDA_OP_CONTROLLED_ROTATE_K,
+	QUDA_OP_TOFFOLI,
+	QUDA_OP_FREDKIN
+};
+
+/* Describes one gate application.
+ * 'q' holds the gate's qubit arguments in the order of the public gate function
+ * (unused slots are -1) and 'k' holds the rotation parameter of the rotate_k gates.
+ */
+typedef struct quantum_gate_t {
+	int op;
+	int q[3];
+	int k;
+	quantum_reg* reg;
+} quantum_gate_t;
+
+/* Offers a gate to the register's representation before the sparse kernel runs.
+ * The gate's qubits and register may be rewritten (see QUDA_REG_VIRTUAL_QUBITS and
+ * QUDA_REG_FACTORED), in which case the sparse kernel must use the rewritten ones.
+ * Returns 1 if the gate was fully applied, 0 if the sparse kernel must still run,
+ * or -1 on failure.
+ */
+int quda_gate_dispatch(quantum_gate_t* gate);
+
+/* Reduces a gate to its single- or two-target base operation (one of QUDA_OP_HADAMARD
+ * through QUDA_OP_SWAP) acting on 'target1' (and 'target2' for swaps) whenever every
+ * bit in 'controls' is set.
+ */
+void quda_gate_decompose(const quantum_gate_t* gate, int* op, uint64_t* controls,
+		int* target1, int* target2);
+
+/* Returns 1 if the gate is diagonal in the computational basis, in which case it multiplies
+ * the amplitude of every state with all 'mask' bits set by 'factor'. Returns 0 otherwise.
+ */
+int quda_gate_diagonal(const quantum_gate_t* gate, uint64_t* mask, complex_t* factor);
+
+#endif // __QUDA_QUANTUM_DISPATCH_H
@@ -0,0 +1,334 @@
+/* quantum_factor.c: product-state factorization of registers
+*/
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include "quantum_factor.h"
+#include "complex.h"
+
+/* Initializes an empty factor that inherits the register's per-gate settings */
+static int quda_factor_init(quantum_reg* qreg, quantum_factor_t* f, int qubits) {
+	if(quda_quantum_reg_init(&f->reg,qubits) == -1) {
+		return -1;
+	}
+	f->reg.truncation = qreg->truncation;
+	f->reg.coalesce_ratio = qreg->coalesce_ratio;
+	f->reg.flags = qreg->flags & (QUDA_REG_PAULI_FRAME | QUDA_REG_DIAGONAL_QUEUE);
+	return 0;
+}
+
+/* Initializes a single-qubit factor holding 'bit' in the basis state 'value' */
+static int quda_factor_init_bit(quantum_reg* qreg, quantum_factor_t* f, int bit, int value) {
+	if(quda_factor_init(qreg,f,1) == -1) {
+		return -1;
+	}
+	quda_quantum_reg_set(&f->reg,value);
+	f->bits[0] = bit;
+	return 0;
+}
+
+/* Ensures room for 'count' factors */
+static int quda_factor_reserve(quantum_reg* qreg, int count) {
+	if(count <= qreg->factor_size) return 0;
+
+	quantum_factor_t* temp = realloc(qreg->factors,count*sizeof(quantum_factor_t));
+	if(temp == NULL) {
+		return -1;
+	}
+	qreg->factors = temp;
+	qreg->factor_size = count;
+	return 0;
+}
+
+/* Returns the factor's qubit holding the given register bit */
+static int quda_factor_local(const quantum_factor_t* f, int bit) {
+	int i;
+	for(i=0;i<f->reg.qubits && f->bits[i] != bit;i++);
+	return i;
+}
+
+/* Spreads a factor's state over the register bits it holds */
+static uint64_t quda_factor_scatter(const quantum_factor_t* f, uint64_t state) {
+	uint64_t s = 0;
+	int i;
+	for(i=0;i<f->reg.qubits;i++) {
+		s |= ((state >> i) & 1) << f->bits[i];
+	}
+	return s;
+}
+
+/* Removes a factor from the list (without freeing it) by moving the last one into its slot */
+static void quda_factor_remove(quantum_reg* qreg, int index) {
+	int last = --qreg->num_factors;
+	if(index == last) return;
+
+	qreg->factors[index] = qreg->factors[last];
+	int i;
+	for(i=0;i<qreg->factors[index].reg.qubits;i++) {
+		qreg->factor_of[qreg->factors[index].bits[i]] = index;
+	}
+}
+
+/* Replaces factors a and b by their product. Returns the product's index or -1 on failure. */
+static int quda_factor_merge(quantum_reg* qreg, int a, int b) {
+	quantum_factor_t* fa = &qreg->factors[a];
+	quantum_factor_t* fb = &qreg->factors[b];
+	if(quda_quantum_reg_flush(&fa->reg) == -1 || quda_quantum_reg_flush(&fb->reg) == -1) {
+		return -1;
+	}
+	if((int64_t)fa->reg.num_states*fb->reg.num_states > INT_MAX) return -1;
+
+	int count = fa->reg.num_states*fb->reg.num_states;
+	quantum_factor_t f;
+	if(quda_factor_init(qreg,&f,fa->reg.qubits+fb->reg.qubits) == -1) {
+		return -1;
+	}
+	if(count > f.reg.size && quda_quantum_reg_enlarge(&f.reg,count-f.reg.size) == -1) {
+		quda_quantum_reg_delete(&f.reg);
+		return -1;
+	}
+
+	// Factor a keeps the low qubits of the product
+	int i,j,n = 0;
+	for(j=0;j<fb->reg.num_states;j++) {
+		uint64_t high = fb->reg.states[j].state << fa->reg.qubits;
+		for(i=0;i<fa->reg.num_states;i++) {
+			f.reg.states[n].state = fa->reg.states[i].state | high;
+			f.reg.states[n].amplitude = quda_complex_mul(fa->reg.states[i].amplitude,
+					fb->reg.states[j].amplitude);
+			n++;
+		}
+	}
+	f.reg.num_states = count;
+	f.reg.coalesced_states = count;
+	for(i=0;i<fa->reg.qubits;i++) {
+		f.bits[i] = fa->bits[i];
+	}
+	for(j=0;j<fb->reg.qubits;j++) {
+		f.bits[i+j] = fb->bits[j];
+	}
+
+	quda_quantum_reg_delete(&fa->reg);
+	quda_quantum_reg_delete(&fb->reg);
+	qreg->factors[a] = f;
+	for(i=0;i<f.reg.qubits;i++) {
+		qreg->factor_of[f.bits[i]] = a;
+	}
+
+	// The last factor moves into b's slot, which may be the product itself
+	int last = qreg->num_factors-1;
+	quda_factor_remove(qreg,b);
+	return (a == last) ? b : a;
+}
+
+int quda_factor_split(quantum_reg* qreg, uint64_t state) {
+	int bits = qreg->qubits + qreg->scratch;
+	if(bits == 0) return -1;
+
+	quantum_factor_t* factors = malloc(bits*sizeof(quantum_factor_t));
+	if(factors == NULL) {
+		return -1;
+	}
+
+	int i;
+	for(i=0;i<bits;i++) {
+		if(quda_factor_init_bit(qreg,&factors[i],i,(state >> i) & 1) == -1) {
+			while(--i >= 0) {
+				quda_quantum_reg_delete(&factors[i].reg);
+			}
+			free(factors);
+			return -1;
+		}
+	}
+
+	quda_factor_delete(qreg);
+	qreg->factors = factors;
+	qreg->num_factors = bits;
+	qreg->factor_size = bits;
+	for(i=0;i<bits;i++) {
+		qreg->factor_of[i] = i;
+	}
+	return 0;
+}
+
+int quda_factor_join(quantum_reg* qreg) {
+	if(qreg->factors == NULL) return 0;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+
+	int64_t count = 1;
+	int f;
+	for(f=0;f<qreg->num_factors;f++) {
+		if(quda_quantum_reg_flush(&qreg->factors[f].reg) == -1) return -1;
+		count *= qreg->factors[f].reg.num_states;
+		if(count > INT_MAX) return -1;
+	}
+
+	if(count > qreg->size) {
+		quantum_state_t* temp_states = realloc(qreg->states,count*sizeof(quantum_state_t));
+		if(temp_states == NULL) {
+			return -1;
+		}
+		qreg->states = temp_states;
+		qreg->size = count;
+	}
+
+	/* Multiply the factors in one at a time. Each step widens the list in place, writing the
+	 * copies for later factor states first so that the entries still to be read stay intact.
+	 */
+	quantum_state_t* s = qreg->states;
+	int n = 1;
+	s[0].state = 0;
+	s[0].amplitude = QUDA_COMPLEX_ONE;
+	for(f=0;f<qreg->num_factors;f++) {
+		quantum_factor_t* factor = &qreg->factors[f];
+		int i,j;
+		for(j=factor->reg.num_states-1;j>=0;j--) {
+			uint64_t bits = quda_factor_scatter(factor,factor->reg.states[j].state);
+			complex_t a = factor->reg.states[j].amplitude;
+			for(i=n-1;i>=0;i--) {
+				s[j*n+i].state = s[i].state | bits;
+				s[j*n+i].amplitude = quda_complex_mul(s[i].amplitude,a);
+			}
+		}
+		n *= factor->reg.num_states;
+	}
+
+	int repr = qreg->repr;
+	quda_factor_delete(qreg);
+	qreg->num_states = n;
+	qreg->repr = QUDA_REPR_SPARSE;
+	qreg->dirty = 0;
+	qreg->coalesced_states = n;
+	if(repr == QUDA_REPR_DENSE) {
+		quda_quantum_reg_set_repr(qreg,QUDA_REPR_DENSE);
+	}
+	return 0;
+}
+
+int quda_factor_redirect(quantum_gate_t* gate) {
+	quantum_reg* qreg = gate->reg;
+	int f = qreg->factor_of[gate->q[0]];
+	int i;
+
+	if(gate->op == QUDA_OP_SWAP) {
+		int g = qreg->factor_of[gate->q[1]];
+		if(f != g) {
+			// The two bits simply trade factors
+			quantum_factor_t* fa = &qreg->factors[f];
+			quantum_factor_t* fb = &qreg->factors[g];
+			fa->bits[quda_factor_local(fa,gate->q[0])] = gate->q[1];
+			fb->bits[quda_factor_local(fb,gate->q[1])] = gate->q[0];
+			qreg->factor_of[gate->q[0]] = g;
+			qreg->factor_of[gate->q[1]] = f;
+			return 1;
+		}
+	}
+
+	for(i=1;i<3;i++) {
+		if(gate->q[i] < 0) continue;
+		int g = qreg->factor_of[gate->q[i]];
+		if(g != f) {
+			f = quda_factor_merge(qreg,f,g);
+			if(f < 0) return -1;
+		}
+	}
+
+	quantum_factor_t* factor = &qreg->factors[f];
+	for(i=0;i<3;i++) {
+		if(gate->q[i] >= 0) {
+			gate->q[i] = quda_factor_local(factor,gate->q[i]);
+		}
+	}
+	gate->reg = &factor->reg;
+	return 0;
+}
+
+quantum_reg* quda_factor_of(quantum_reg* qreg, int* bit) {
+	quantum_factor_t* f = &qreg->factors[qreg->factor_of[*bit]];
+	*bit = quda_factor_local(f,*bit);
+	return &f->reg;
+}
+
+void quda_factor_release(quantum_reg* qreg, int bit) {
+	int index = qreg->factor_of[bit];
+	if(qreg->factors[index].reg.qubits == 1) return;
+	if(quda_factor_reserve(qreg,qreg->num_factors+1) == -1) return;
+
+	quantum_factor_t* f = &qreg->factors[index];
+	if(quda_quantum_reg_flush(&f->reg) == -1 || f->reg.num_states == 0) return;
+
+	int local = quda_factor_local(f,bit);
+	uint64_t mask = (uint64_t)1 << local;
+	uint64_t value = f->reg.states[0].state & mask;
+	int i;
+	for(i=1;i<f->reg.num_states;i++) {
+		if((f->reg.states[i].state & mask) != value) return;
+	}
+
+	if(quda_quantum_reg_unshare(&f->reg) == -1) return;
+	if(quda_factor_init_bit(qreg,&qreg->factors[qreg->num_factors],bit,value != 0) == -1) {
+		return;
+	}
+
+	// Close the gap the bit leaves in the factor's states
+	uint64_t low = mask-1;
+	for(i=0;i<f->reg.num_states;i++) {
+		uint64_t s = f->reg.states[i].state;
+		f->reg.states[i].state = (s & low) | ((s >> 1) & ~low);
+	}
+	f->reg.qubits--;
+	for(i=local;i<f->reg.qubits;i++) {
+		f->bits[i] = f->bits[i+1];
+	}
+	qreg->factor_of[bit] = qreg->num_factors++;
+}
+
+int quda_factor_append(quantum_reg* qreg, int n) {
+	if(quda_factor_reserve(qreg,qreg->num_factors+n) == -1) return -1;
+
+	int bits = qreg->qubits + qreg->scratch;
+	int i;
+	for(i=0;i<n;i++) {
+		if(quda_factor_init_bit(qreg,&qreg->factors[qreg->num_factors+i],bits+i,0) == -1) {
+			while(--i >= 0) {
+				quda_quantum_reg_delete(&qreg->factors[qreg->num_factors+i].reg);
+			}
+			return -1;
+		}
+	}
+	for(i=0;i<n;i++) {
+		qreg->factor_of[bits+i] = qreg->num_factors++;
+	}
+	return 0;
+}
+
+int quda_factor_copy(quantum_reg* dest, quantum_reg* src) {
+	dest->factors = NULL;
+	dest->num_factors = 0;
+	dest->factor_size = 0;
+	if(src->factors == NULL) return 0;
+	if(quda_factor_reserve(dest,src->num_factors) == -1) return -1;
+
+	int i;
+	for(i=0;i<src->num_factors;i++) {
+		if(quda_quantum_reg_clone(&dest->factors[i].reg,&src->factors[i].reg) == -1) {
+			quda_factor_delete(dest);
+			return -1;
+		}
+		memcpy(dest->factors[i].bits,src->factors[i].bits,sizeof(src->factors[i].bits));
+		dest->num_factors++;
+	}
+	return 0;
+}
+
+void quda_factor_delete(quantum_reg* qreg) {
+	int i;
+	for(i=0;i<qreg->num_factors;i++) {
+		quda_quantum_reg_delete(&qreg->factors[i].reg);
+	}
+	free(qreg->factors);
+	qreg->factors = NULL;
+	qreg->num_factors = 0;
+	qreg->factor_size = 0;
+}
@@ -0,0 +1,49 @@
+/* quantum_factor.h: header for product-state factorization of registers
+*/
+
+#ifndef __QUDA_QUANTUM_FACTOR_H
+#define __QUDA_QUANTUM_FACTOR_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* Replaces the register's state by one single-qubit factor per bit of the basis 'state'.
+ * Returns 0 on success or -1 if allocation fails (in which case the register is unchanged).
+ */
+int quda_factor_split(quantum_reg* qreg, uint64_t state);
+
+/* Multiplies every factor back into the register's own states and frees the factors.
+ * Returns 0 on success (or if the register is not factored) or -1 if allocation fails, in
+ * which case the register stays factored.
+ */
+int quda_factor_join(quantum_reg* qreg);
+
+/* Redirects a gate to the single factor holding all of its qubits, multiplying factors
+ * together first if the gate spans several. Swaps across factors only exchange the bits'
+ * factors. Returns 1 if the gate needs no further work, 0 if it must still be applied to
+ * gate->reg (now the factor, with its qubits rewritten as the factor's own), or -1 on failure.
+ */
+int quda_factor_redirect(quantum_gate_t* gate);
+
+/* Returns the factor holding the given physical bit and rewrites 'bit' as the factor's qubit. */
+quantum_reg* quda_factor_of(quantum_reg* qreg, int* bit);
+
+/* Splits a bit that is no longer in superposition (after measuring or setting it) off its
+ * factor into a single-qubit factor of its own. Does nothing if this cannot be done.
+ */
+void quda_factor_release(quantum_reg* qreg, int bit);
+
+/* Adds n single-qubit factors in state |0> for new bits above the register's current ones.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_factor_append(quantum_reg* qreg, int n);
+
+/* Gives 'dest' clones of the factors of 'src' (see quda_quantum_reg_clone()).
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_factor_copy(quantum_reg* dest, quantum_reg* src);
+
+/* Frees the register's factors without joining them. */
+void quda_factor_delete(quantum_reg* qreg);
+
+#endif // __QUDA_QUANTUM_FACTOR_H
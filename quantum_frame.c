@@ -0,0 +1,150 @@
+/* quantum_frame.c: lazy Pauli frame tracking
+*/
+
+#include "quantum_frame.h"
+#include "quantum_diag.h"
+#include "complex.h"
+
+/* Multiplies an amplitude by i^phase */
+static complex_t quda_frame_rotate(complex_t c, int phase) {
+	switch(phase & 3) {
+		case 1: return quda_complex_mul_i(c);
+		case 2: return quda_complex_neg(c);
+		case 3: return quda_complex_mul_ni(c);
+	}
+	return c;
+}
+
+/* Exchanges bits a and b of 'bits' */
+static uint64_t quda_frame_swap_bits(uint64_t bits, uint64_t a, uint64_t b) {
+	if(((bits & a) != 0) != ((bits & b) != 0)) {
+		bits ^= a | b;
+	}
+	return bits;
+}
+
+int quda_frame_absorb(quantum_gate_t* gate) {
+	quantum_reg* qreg = gate->reg;
+	uint64_t x = qreg->frame_x;
+	uint64_t z = qreg->frame_z;
+	uint64_t a = (uint64_t)1 << gate->q[0];
+	uint64_t b = (gate->q[1] < 0) ? 0 : (uint64_t)1 << gate->q[1];
+	uint64_t c = (gate->q[2] < 0) ? 0 : (uint64_t)1 << gate->q[2];
+	uint64_t touched = a | b | c;
+	uint64_t blocking_x,blocking_z; // frame components the gate does not commute with
+
+	/* Each case computes G P G^-1 for the gate G, so that G P = (G P G^-1) G.
+	 * The repository's Pauli Y is -i X Z.
+	 */
+	switch(gate->op) {
+		case QUDA_OP_PAULI_X:
+			qreg->frame_x ^= a;
+			return 1;
+		case QUDA_OP_PAULI_Z:
+			qreg->frame_phase += (x & a) ? 2 : 0;
+			qreg->frame_z ^= a;
+			return 1;
+		case QUDA_OP_PAULI_Y:
+			qreg->frame_phase += (x & a) ? 1 : 3;
+			qreg->frame_x ^= a;
+			qreg->frame_z ^= a;
+			return 1;
+		case QUDA_OP_HADAMARD:
+			// H X H = Z, H Z H = X and H XZ H = -XZ
+			qreg->frame_phase += ((x & a) && (z & a)) ? 2 : 0;
+			qreg->frame_x = (x & ~a) | ((z & a) ? a : 0);
+			qreg->frame_z = (z & ~a) | ((x & a) ? a : 0);
+			return 0;
+		case QUDA_OP_PHASE:
+			// S X S^-1 = i X Z
+			if(x & a) {
+				qreg->frame_phase += 1;
+				qreg->frame_z ^= a;
+			}
+			return 0;
+		case QUDA_OP_SWAP:
+			qreg->frame_x = quda_frame_swap_bits(x,a,b);
+			qreg->frame_z = quda_frame_swap_bits(z,a,b);
+			return 0;
+		case QUDA_OP_CONTROLLED_NOT:
+			// X on the control spreads to the target, Z on the target spreads to the control
+			if(x & a) qreg->frame_x ^= b;
+			if(z & b) qreg->frame_z ^= a;
+			return 0;
+		case QUDA_OP_CONTROLLED_Z:
+			// X on either bit picks up a Z on the other
+			qreg->frame_phase += ((x & a) && (x & b)) ? 2 : 0;
+			if(x & a) qreg->frame_z ^= b;
+			if(x & b) qreg->frame_z ^= a;
+			return 0;
+		case QUDA_OP_PI_OVER_8:
+		case QUDA_OP_ROTATE_K:
+		case QUDA_OP_CONTROLLED_PHASE:
+		case QUDA_OP_CONTROLLED_ROTATE_K:
+			// Diagonal gates commute with Z
+			blocking_x = touched;
+			blocking_z = 0;
+			break;
+		case QUDA_OP_TOFFOLI:
+			// Z on the controls and X on the target commute
+			blocking_x = a | b;
+			blocking_z = c;
+			break;
+		default:
+			blocking_x = touched;
+			blocking_z = touched;
+			break;
+	}
+
+	if((x & blocking_x) || (z & blocking_z)) {
+		quda_frame_materialize(qreg,touched);
+	}
+	return 0;
+}
+
+void quda_frame_apply(quantum_reg* qreg, uint64_t x, uint64_t z, int phase) {
+	int i;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// Index i moves to i^x, so each pair is swapped once
+		for(i=0;i<qreg->num_states;i++) {
+			uint64_t j = i ^ x;
+			if(j < (uint64_t)i) continue;
+			complex_t ai = quda_frame_rotate(qreg->states[i].amplitude,
+					phase + 2*__builtin_parityll(i & z));
+			complex_t aj = quda_frame_rotate(qreg->states[j].amplitude,
+					phase + 2*__builtin_parityll(j & z));
+			qreg->states[i].amplitude = aj;
+			qreg->states[j].amplitude = ai;
+		}
+		return;
+	}
+
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t s = qreg->states[i].state;
+		qreg->states[i].amplitude = quda_frame_rotate(qreg->states[i].amplitude,
+				phase + 2*__builtin_parityll(s & z));
+		qreg->states[i].state = s ^ x;
+	}
+}
+
+void quda_frame_materialize(quantum_reg* qreg, uint64_t mask) {
+	// X and Z on disjoint bits commute, so P splits into (rest of P) * (P on 'mask')
+	uint64_t x = qreg->frame_x & mask;
+	uint64_t z = qreg->frame_z & mask;
+	if(x == 0 && z == 0) return;
+
+	quda_diag_flush(qreg);
+	quda_frame_apply(qreg,x,z,0);
+	qreg->frame_x &= ~mask;
+	qreg->frame_z &= ~mask;
+}
+
+void quda_frame_flush(quantum_reg* qreg) {
+	if(qreg->frame_x == 0 && qreg->frame_z == 0 && (qreg->frame_phase & 3) == 0) return;
+
+	quda_diag_flush(qreg);
+	quda_frame_apply(qreg,qreg->frame_x,qreg->frame_z,qreg->frame_phase);
+	qreg->frame_x = 0;
+	qreg->frame_z = 0;
+	qreg->frame_phase = 0;
+}
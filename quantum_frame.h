@@ -0,0 +1,33 @@
+/* quantum_frame.h: header for lazy Pauli frame tracking
+*/
+
+#ifndef __QUDA_QUANTUM_FRAME_H
+#define __QUDA_QUANTUM_FRAME_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* The frame of a register holds a pending Pauli operator
+ *   P = i^frame_phase * X^frame_x * Z^frame_z
+ * so that the register's actual state is P applied to its stored states (after any queued
+ * diagonal gates, which are flushed before the frame moves into the stored states).
+ */
+
+/* Offers a gate to the register's Pauli frame.
+ * Pauli gates are absorbed into the frame and 1 is returned. Clifford gates (hadamard, phase,
+ * swap, controlled-not and controlled-z) rewrite the frame as they pass through it, and any
+ * other gate first moves the frame's components on its qubits into the stored states; in both
+ * cases 0 is returned and the gate must still be applied to the stored states.
+ */
+int quda_frame_absorb(quantum_gate_t* gate);
+
+/* Applies i^phase * X^x * Z^z to the stored states of a register in one pass. */
+void quda_frame_apply(quantum_reg* qreg, uint64_t x, uint64_t z, int phase);
+
+/* Moves the frame's components on the 'mask' bits into the stored states. */
+void quda_frame_materialize(quantum_reg* qreg, uint64_t mask);
+
+/* Moves the whole frame, including its phase, into the stored states and clears it. */
+void quda_frame_flush(quantum_reg* qreg);
+
+#endif // __QUDA_QUANTUM_FRAME_H
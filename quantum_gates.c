@@ -10,6 +10,31 @@
 #define QUDA_GATE
 #endif
 
+#ifndef GATE_DISPATCH
+#include "quantum_dispatch.h"
+/* Offers the gate to the register's representation first. 'status' is set non-zero if the
+ * gate has already been applied (or failed) there, in which case the sparse kernel that
+ * follows must be skipped. The register and qubit arguments are lvalues and receive the
+ * (possibly redirected) register and qubits the kernel must act on.
+ */
+#define GATE_DISPATCH(status, qreg, op, a, b, c, k) \
+	do { \
+		quantum_gate_t gate__ = { op, { a, b, c }, k, qreg }; \
+		status = quda_gate_dispatch(&gate__); \
+		a = gate__.q[0]; \
+		b = gate__.q[1]; \
+		c = gate__.q[2]; \
+		qreg = gate__.reg; \
+	} while(0)
+#endif
+
+// Dispatch by gate arity; unused qubit slots are passed as -1
+#define GATE_DISPATCH1(status, qreg, op, a, k) \
+	do { int b__ = -1, c__ = -1; GATE_DISPATCH(status, qreg, op, a, b__, c__, k); } while(0)
+#define GATE_DISPATCH2(status, qreg, op, a, b, k) \
+	do { int c__ = -1; GATE_DISPATCH(status, qreg, op, a, b, c__, k); } while(0)
+#define GATE_DISPATCH3(status, qreg, op, a, b, c) GATE_DISPATCH(status, qreg, op, a, b, c, 0)
+
 #ifndef FOR_EACH_STATE
 #define FOR_EACH_STATE(qreg, i) for (i = 0; i < qreg->num_states; i++)
 #define STATE(qreg, i) qreg->states[i].state
@@ -19,9 +44,26 @@
 // One-bit quantum gates
 #ifndef CUSTOM_HADAMARD
 QUDA_GATE int quda_quantum_hadamard_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_HADAMARD, target, 0);
+	if(status) return (status < 0) ? -1 : 0;
+
+	if(qreg->coalesce_ratio <= 1.0f) {
+		// Eagerly coalesced registers only grow by the states that are missing a partner
+		const complex_t h[4] = { { ONE_OVER_SQRT_2, 0 }, { ONE_OVER_SQRT_2, 0 },
+				{ ONE_OVER_SQRT_2, 0 }, { -ONE_OVER_SQRT_2, 0 } };
+		return quda_quantum_reg_pair_apply(qreg,0,0,target,h);
+	}
+
 	// If needed, enlarge qreg to make room for state splits resulting from this gate
   int states = qreg->num_states;
 	int diff = 2*states - qreg->size;
+	if(diff > 0 && qreg->dirty) {
+		// Deferred duplicates are merged before paying for a larger buffer
+		quda_quantum_reg_coalesce(qreg);
+		states = qreg->num_states;
+		diff = 2*states - qreg->size;
+	}
 	if(diff > 0) {
 		if(quda_quantum_reg_enlarge(qreg,diff) == -1) return -1;
 	}
@@ -44,14 +86,17 @@ QUDA_GATE int quda_quantum_hadamard_gate(int target, quantum_reg* qreg) {
 
 	qreg->num_states = 2*states;
 
-	// TODO: Ideally, make this call optional or conditional
-	quda_quantum_reg_coalesce(qreg);
+	quda_quantum_reg_defer_coalesce(qreg);
 
 	return 0;
 }
 #endif
 
 QUDA_GATE void quda_quantum_pauli_x_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_PAULI_X, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << target;
 	FOR_EACH_STATE(qreg, i) {
@@ -60,6 +105,10 @@ QUDA_GATE void quda_quantum_pauli_x_gate(int target, quantum_reg* qreg) {
 }
 
 QUDA_GATE void quda_quantum_pauli_y_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_PAULI_Y, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << target;
 	FOR_EACH_STATE(qreg, i) {
@@ -74,6 +123,10 @@ QUDA_GATE void quda_quantum_pauli_y_gate(int target, quantum_reg* qreg) {
 }
 
 QUDA_GATE void quda_quantum_pauli_z_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_PAULI_Z, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << target;
 	FOR_EACH_STATE(qreg, i) {
@@ -84,6 +137,10 @@ QUDA_GATE void quda_quantum_pauli_z_gate(int target, quantum_reg* qreg) {
 }
 
 QUDA_GATE void quda_quantum_phase_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_PHASE, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << target;
 	FOR_EACH_STATE(qreg, i) {
@@ -94,6 +151,10 @@ QUDA_GATE void quda_quantum_phase_gate(int target, quantum_reg* qreg) {
 }
 
 QUDA_GATE void quda_quantum_pi_over_8_gate(int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_PI_OVER_8, target, 0);
+	if(status) return;
+
 	complex_t c = { .real = ONE_OVER_SQRT_2, .imag = ONE_OVER_SQRT_2 };
 	int i;
 	uint64_t mask = 1 << target;
@@ -105,7 +166,11 @@ QUDA_GATE void quda_quantum_pi_over_8_gate(int target, quantum_reg* qreg) {
 }
 
 QUDA_GATE void quda_quantum_rotate_k_gate(int target, quantum_reg* qreg, int k) {
-	float temp = QUDA_PI / (1 << (k-1));
+	int status;
+	GATE_DISPATCH1(status, qreg, QUDA_OP_ROTATE_K, target, k);
+	if(status) return;
+
+	quda_float_t temp = QUDA_PI / (1 << (k-1));
 	complex_t c = { .real = cos(temp), .imag = sin(temp) };
 	uint64_t mask = 1 << target;
 	int i;
@@ -118,6 +183,10 @@ QUDA_GATE void quda_quantum_rotate_k_gate(int target, quantum_reg* qreg, int k)
 
 // Two-bit quantum gates
 QUDA_GATE void quda_quantum_swap_gate(int target1, int target2, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_SWAP, target1, target2, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << target1;
 	mask |= 1 << target2;
@@ -129,6 +198,10 @@ QUDA_GATE void quda_quantum_swap_gate(int target1, int target2, quantum_reg* qre
 }
 
 QUDA_GATE void quda_quantum_controlled_not_gate(int control, int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_CONTROLLED_NOT, control, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t cmask = 1 << control;
 	uint64_t tmask = 1 << target;
@@ -140,6 +213,10 @@ QUDA_GATE void quda_quantum_controlled_not_gate(int control, int target, quantum
 }
 
 QUDA_GATE void quda_quantum_controlled_y_gate(int control,int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_CONTROLLED_Y, control, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t cmask = 1 << control;
 	uint64_t tmask = 1 << target;
@@ -158,6 +235,10 @@ QUDA_GATE void quda_quantum_controlled_y_gate(int control,int target, quantum_re
 }
 
 QUDA_GATE void quda_quantum_controlled_z_gate(int control, int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_CONTROLLED_Z, control, target, 0);
+	if(status) return;
+
 	int i;
 	uint64_t mask = 1 << control;
 	mask |= 1 << target;
@@ -168,7 +249,11 @@ QUDA_GATE void quda_quantum_controlled_z_gate(int control, int target, quantum_r
 	}
 }
 
-QUDA_GATE void quda_quantum_controlled_phase_gate(int control, int target, quantum_reg* qreg) {	
+QUDA_GATE void quda_quantum_controlled_phase_gate(int control, int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_CONTROLLED_PHASE, control, target, 0);
+	if(status) return;
+
 	uint64_t mask = 1 << control;
 	mask |= 1 << target;
 	int i;
@@ -180,7 +265,11 @@ QUDA_GATE void quda_quantum_controlled_phase_gate(int control, int target, quant
 }
 
 QUDA_GATE void quda_quantum_controlled_rotate_k_gate(int control, int target, quantum_reg* qreg, int k) {
-	float temp = QUDA_PI / (1 << (k-1));
+	int status;
+	GATE_DISPATCH2(status, qreg, QUDA_OP_CONTROLLED_ROTATE_K, control, target, k);
+	if(status) return;
+
+	quda_float_t temp = QUDA_PI / (1 << (k-1));
 	complex_t c = { .real = cos(temp), .imag = sin(temp) };
 	uint64_t mask = 1 << control;
 	mask |= 1 << target;
@@ -194,6 +283,10 @@ QUDA_GATE void quda_quantum_controlled_rotate_k_gate(int control, int target, qu
 
 // Three-bit quantum gates
 QUDA_GATE void quda_quantum_toffoli_gate(int control1, int control2, int target, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH3(status, qreg, QUDA_OP_TOFFOLI, control1, control2, target);
+	if(status) return;
+
 	int i;
 	uint64_t cmask = 1 << control1;
 	cmask |= 1 << control2;
@@ -206,6 +299,10 @@ QUDA_GATE void quda_quantum_toffoli_gate(int control1, int control2, int target,
 }
 
 QUDA_GATE void quda_quantum_fredkin_gate(int control, int target1, int target2, quantum_reg* qreg) {
+	int status;
+	GATE_DISPATCH3(status, qreg, QUDA_OP_FREDKIN, control, target1, target2);
+	if(status) return;
+
 	int i;
 	uint64_t cmask = 1 << control;
 	uint64_t tmask = 1 << target1;
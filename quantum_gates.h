@@ -6,7 +6,7 @@
 
 #include "quantum_reg.h"
 
-#define ONE_OVER_SQRT_2 0.707106781f
+#define ONE_OVER_SQRT_2 ((quda_float_t)0.70710678118654752440)
 
 // One-bit quantum gates
 
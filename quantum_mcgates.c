@@ -0,0 +1,151 @@
+/* quantum_mcgates.c: multi-controlled quantum gates
+*/
+
+#include <math.h>
+#include "quantum_mcgates.h"
+#include "quantum_dense.h"
+#include "complex.h"
+
+/* Brings the register's stored states up to date and translates the masks and target to
+ * physical bits. Returns 0 on success or -1 if the register cannot be expanded.
+ */
+static int quda_mc_prepare(quantum_reg* qreg, uint64_t* controls, uint64_t* anti_controls,
+		int* target) {
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	if(qreg->repr != QUDA_REPR_SPARSE && qreg->repr != QUDA_REPR_DENSE) return -1;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+
+	if(qreg->flags & QUDA_REG_VIRTUAL_QUBITS) {
+		uint64_t c = 0, a = 0;
+		int i;
+		for(i=0;i<qreg->qubits+qreg->scratch;i++) {
+			if((*controls >> i) & 1) c |= (uint64_t)1 << quda_quantum_physical_bit(i,qreg);
+			if((*anti_controls >> i) & 1) a |= (uint64_t)1 << quda_quantum_physical_bit(i,qreg);
+		}
+		*controls = c;
+		*anti_controls = a;
+		*target = quda_quantum_physical_bit(*target,qreg);
+	}
+	return 0;
+}
+
+/* Multiplies every controlled state with the target bit set by 'factor' */
+static int quda_mc_diagonal(uint64_t controls, uint64_t anti_controls, int target,
+		complex_t factor, quantum_reg* qreg) {
+	if(quda_mc_prepare(qreg,&controls,&anti_controls,&target) == -1) return -1;
+
+	uint64_t set = controls | ((uint64_t)1 << target);
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		uint64_t fixed = set | anti_controls;
+		uint64_t count = (uint64_t)1 << (qreg->qubits + qreg->scratch - __builtin_popcountll(fixed));
+		uint64_t k;
+		for(k=0;k<count;k++) {
+			uint64_t index = quda_dense_insert_zeros(k,fixed) | set;
+			qreg->states[index].amplitude = quda_complex_mul(qreg->states[index].amplitude,factor);
+		}
+		return 0;
+	}
+
+	quda_states_mask_mul(qreg->states,qreg->num_states,set | anti_controls,set,factor);
+	return 0;
+}
+
+int quda_quantum_mc_not_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg) {
+	if(quda_mc_prepare(qreg,&controls,&anti_controls,&target) == -1) return -1;
+
+	uint64_t tmask = (uint64_t)1 << target;
+	int i;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		uint64_t fixed = controls | anti_controls | tmask;
+		uint64_t count = (uint64_t)1 << (qreg->qubits + qreg->scratch - __builtin_popcountll(fixed));
+		uint64_t k;
+		for(k=0;k<count;k++) {
+			uint64_t i0 = quda_dense_insert_zeros(k,fixed) | controls;
+			complex_t temp = qreg->states[i0].amplitude;
+			qreg->states[i0].amplitude = qreg->states[i0 | tmask].amplitude;
+			qreg->states[i0 | tmask].amplitude = temp;
+		}
+		return 0;
+	}
+
+	// Flipping a bit of some states is a bijection, so no duplicates are created
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t state = qreg->states[i].state;
+		if((state & controls) == controls && !(state & anti_controls)) {
+			qreg->states[i].state = state ^ tmask;
+		}
+	}
+	return 0;
+}
+
+int quda_quantum_mc_z_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg) {
+	complex_t factor = { .real = -1, .imag = 0 };
+	return quda_mc_diagonal(controls,anti_controls,target,factor,qreg);
+}
+
+int quda_quantum_mc_phase_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg) {
+	return quda_mc_diagonal(controls,anti_controls,target,QUDA_I,qreg);
+}
+
+int quda_quantum_mc_rotate_k_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg, int k) {
+	double angle = ldexp(QUDA_PI,1-k);
+	complex_t factor = { .real = cos(angle), .imag = sin(angle) };
+	return quda_mc_diagonal(controls,anti_controls,target,factor,qreg);
+}
+
+int quda_quantum_mc_unitary_gate(uint64_t controls, uint64_t anti_controls, int target,
+		const complex_t* u, quantum_reg* qreg) {
+	if(quda_mc_prepare(qreg,&controls,&anti_controls,&target) == -1) return -1;
+
+	uint64_t tmask = (uint64_t)1 << target;
+	int i;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		uint64_t fixed = controls | anti_controls | tmask;
+		uint64_t count = (uint64_t)1 << (qreg->qubits + qreg->scratch - __builtin_popcountll(fixed));
+		uint64_t k;
+		for(k=0;k<count;k++) {
+			uint64_t i0 = quda_dense_insert_zeros(k,fixed) | controls;
+			complex_t a0 = qreg->states[i0].amplitude;
+			complex_t a1 = qreg->states[i0 | tmask].amplitude;
+			qreg->states[i0].amplitude = quda_complex_add(quda_complex_mul(u[0],a0),
+					quda_complex_mul(u[1],a1));
+			qreg->states[i0 | tmask].amplitude = quda_complex_add(quda_complex_mul(u[2],a0),
+					quda_complex_mul(u[3],a1));
+		}
+		return 0;
+	}
+
+	if(qreg->coalesce_ratio <= 1.0f) {
+		return quda_quantum_reg_pair_apply(qreg,controls,anti_controls,target,u);
+	}
+
+	// Every controlled state sends part of its amplitude to its partner, created here
+	int matched = 0;
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t state = qreg->states[i].state;
+		if((state & controls) == controls && !(state & anti_controls)) matched++;
+	}
+	int diff = qreg->num_states + matched - qreg->size;
+	if(diff > 0 && quda_quantum_reg_enlarge(qreg,diff) == -1) return -1;
+
+	int states = qreg->num_states;
+	for(i=0;i<states;i++) {
+		uint64_t state = qreg->states[i].state;
+		if((state & controls) != controls || (state & anti_controls)) continue;
+
+		int bit = (state & tmask) ? 1 : 0;
+		complex_t a = qreg->states[i].amplitude;
+		qreg->states[i].amplitude = quda_complex_mul(u[bit*2+bit],a);
+		qreg->states[qreg->num_states].state = state ^ tmask;
+		qreg->states[qreg->num_states++].amplitude = quda_complex_mul(u[(1-bit)*2+bit],a);
+	}
+
+	if(matched > 0) {
+		quda_quantum_reg_defer_coalesce(qreg);
+	}
+	return 0;
+}
@@ -0,0 +1,45 @@
+/* quantum_mcgates.h: header for multi-controlled quantum gates
+*/
+
+#ifndef __QUDA_QUANTUM_MCGATES_H
+#define __QUDA_QUANTUM_MCGATES_H
+
+#include "quantum_reg.h"
+
+/* Each gate acts on the target bit of every state whose 'controls' bits are all set and
+ * whose 'anti_controls' bits are all clear, in a single pass over the register. Any number
+ * of bits may be used in either mask, which must not include the target.
+ * Deferred work is flushed first, and stabilizer and MPS registers are expanded into the
+ * sparse representation.
+ */
+
+/* Flips the target bit. Returns 0 on success or -1 if the register cannot be expanded. */
+int quda_quantum_mc_not_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg);
+
+/* Negates the states with the target bit set. Returns 0 on success or -1 if the register
+ * cannot be expanded.
+ */
+int quda_quantum_mc_z_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg);
+
+/* Multiplies the states with the target bit set by i. Returns 0 on success or -1 if the
+ * register cannot be expanded.
+ */
+int quda_quantum_mc_phase_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg);
+
+/* Multiplies the states with the target bit set by e^(i*pi/2^(k-1)). Returns 0 on success
+ * or -1 if the register cannot be expanded.
+ */
+int quda_quantum_mc_rotate_k_gate(uint64_t controls, uint64_t anti_controls, int target,
+		quantum_reg* qreg, int k);
+
+/* Applies the 2x2 unitary u (entry [out*2+in]) to the target bit. Sparse registers gain a
+ * state per controlled state and coalesce as after a hadamard gate.
+ * Returns 0 on success or -1 if the register cannot be expanded or enlarged.
+ */
+int quda_quantum_mc_unitary_gate(uint64_t controls, uint64_t anti_controls, int target,
+		const complex_t* u, quantum_reg* qreg);
+
+#endif // __QUDA_QUANTUM_MCGATES_H
@@ -0,0 +1,700 @@
+/* quantum_mps.c: matrix product state representation
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "quantum_mps.h"
+#include "quantum_gates.h"
+#include "complex.h"
+
+#define QUDA_MPS_SWEEPS 60    // limit on SVD sweeps (convergence usually takes under 10)
+#define QUDA_MPS_ZERO 1e-12   // probability below which a contracted amplitude is zero
+#if QUDA_PRECISION == QUDA_PRECISION_HALF
+#define QUDA_MPS_EPSILON 1e-3 // relative overlap below which two columns count as orthogonal
+#define QUDA_MPS_NOISE 1e-5   // relative weight of singular values left by rounding errors
+#else
+#define QUDA_MPS_EPSILON 1e-7
+#define QUDA_MPS_NOISE 1e-9
+#endif
+
+// Entry (l,s,r) of site i
+#define QUDA_MPS_SITE(qreg,i,l,s,r) \
+	((qreg)->mps_sites[i][((l)*2+(s))*(qreg)->mps_bonds[(i)+1]+(r)])
+
+static int quda_mps_bits(quantum_reg* qreg) {
+	return qreg->qubits + qreg->scratch;
+}
+
+static void quda_mps_free(complex_t** sites, int* bonds, int n) {
+	int i;
+	if(sites != NULL) {
+		for(i=0;i<n;i++) {
+			free(sites[i]);
+		}
+	}
+	free(sites);
+	free(bonds);
+}
+
+void quda_mps_delete(quantum_reg* qreg) {
+	quda_mps_free(qreg->mps_sites,qreg->mps_bonds,quda_mps_bits(qreg));
+	qreg->mps_sites = NULL;
+	qreg->mps_bonds = NULL;
+}
+
+/* Sets site i to the 1 x 2 x 1 tensor of the basis state |value> */
+static int quda_mps_init_site(complex_t** sites, int i, int value) {
+	sites[i] = malloc(2*sizeof(complex_t));
+	if(sites[i] == NULL) {
+		return -1;
+	}
+	sites[i][value] = QUDA_COMPLEX_ONE;
+	sites[i][!value] = QUDA_COMPLEX_ZERO;
+	return 0;
+}
+
+int quda_mps_init(quantum_reg* qreg, uint64_t state) {
+	int n = quda_mps_bits(qreg);
+	complex_t** sites = calloc(n,sizeof(complex_t*));
+	int* bonds = malloc((n+1)*sizeof(int));
+	if(sites == NULL || bonds == NULL) {
+		quda_mps_free(sites,bonds,0);
+		return -1;
+	}
+
+	int i;
+	for(i=0;i<=n;i++) {
+		bonds[i] = 1;
+	}
+	for(i=0;i<n;i++) {
+		if(quda_mps_init_site(sites,i,(state >> i) & 1) == -1) {
+			quda_mps_free(sites,bonds,n);
+			return -1;
+		}
+	}
+
+	quda_mps_delete(qreg);
+	qreg->mps_sites = sites;
+	qreg->mps_bonds = bonds;
+	qreg->mps_center = 0; // a product state is canonical around any site
+	return 0;
+}
+
+int quda_mps_enter(quantum_reg* qreg) {
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+
+	int i,found = -1;
+	for(i=0;i<qreg->num_states;i++) {
+		if(!quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
+			if(found >= 0) return -1;
+			found = i;
+		}
+	}
+	if(found < 0) return -1;
+
+	if(quda_mps_init(qreg,qreg->states[found].state) == -1) return -1;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// The dense index space is no longer needed
+		quda_quantum_reg_set_repr(qreg,QUDA_REPR_SPARSE);
+	}
+	qreg->repr = QUDA_REPR_MPS;
+	return 0;
+}
+
+int quda_mps_leave(quantum_reg* qreg) {
+	if(qreg->repr != QUDA_REPR_MPS) return 0;
+
+	int n = quda_mps_bits(qreg);
+	if(n > 30) return -1;
+
+	/* Contract the sites from the left. After site i, vec[idx*R+r] is the amplitude of the
+	 * low bits idx with the open bond r.
+	 */
+	complex_t* vec = malloc(sizeof(complex_t));
+	if(vec == NULL) {
+		return -1;
+	}
+	vec[0] = QUDA_COMPLEX_ONE;
+	int count = 1;
+	int i,idx,l,s,r;
+	for(i=0;i<n;i++) {
+		int L = qreg->mps_bonds[i];
+		int R = qreg->mps_bonds[i+1];
+		complex_t* next = malloc((size_t)2*count*R*sizeof(complex_t));
+		if(next == NULL) {
+			free(vec);
+			return -1;
+		}
+		for(idx=0;idx<count;idx++) {
+			for(s=0;s<2;s++) {
+				for(r=0;r<R;r++) {
+					complex_t sum = QUDA_COMPLEX_ZERO;
+					for(l=0;l<L;l++) {
+						sum = quda_complex_add(sum,quda_complex_mul(vec[idx*L+l],
+								QUDA_MPS_SITE(qreg,i,l,s,r)));
+					}
+					next[(idx+s*count)*R+r] = sum;
+				}
+			}
+		}
+		free(vec);
+		vec = next;
+		count *= 2;
+	}
+
+	int kept = 0;
+	for(idx=0;idx<count;idx++) {
+		if(quda_complex_abs_square(vec[idx]) > QUDA_MPS_ZERO) kept++;
+	}
+	if(kept > qreg->size) {
+		quantum_state_t* temp_states = realloc(qreg->states,kept*sizeof(quantum_state_t));
+		if(temp_states == NULL) {
+			free(vec);
+			return -1;
+		}
+		qreg->states = temp_states;
+		qreg->size = kept;
+	}
+
+	qreg->num_states = 0;
+	for(idx=0;idx<count;idx++) {
+		if(quda_complex_abs_square(vec[idx]) > QUDA_MPS_ZERO) {
+			qreg->states[qreg->num_states].state = idx;
+			qreg->states[qreg->num_states++].amplitude = vec[idx];
+		}
+	}
+	free(vec);
+
+	quda_mps_delete(qreg);
+	qreg->repr = QUDA_REPR_SPARSE;
+	qreg->dirty = 0;
+	qreg->coalesced_states = qreg->num_states;
+	return 0;
+}
+
+/* One-sided Jacobi SVD of the rows x cols column-major matrix a. Pairs of columns are
+ * rotated until all of them are orthogonal, so that on return column j of a is the j-th
+ * left singular vector times its singular value, and the original matrix is a v^H with v
+ * (cols x cols, column-major) unitary.
+ */
+static void quda_mps_svd(complex_t* a, complex_t* v, int rows, int cols) {
+	int i,j,p,q,sweep;
+	for(i=0;i<cols;i++) {
+		for(j=0;j<cols;j++) {
+			v[i*cols+j] = (i == j) ? QUDA_COMPLEX_ONE : QUDA_COMPLEX_ZERO;
+		}
+	}
+
+	// Overlaps this far below the whole matrix's weight are at the level of rounding errors
+	double frob = 0;
+	for(i=0;i<rows*cols;i++) {
+		frob += quda_complex_abs_square(a[i]);
+	}
+
+	for(sweep=0;sweep<QUDA_MPS_SWEEPS;sweep++) {
+		int rotated = 0;
+		for(p=0;p<cols;p++) {
+			for(q=p+1;q<cols;q++) {
+				complex_t* ap = &a[p*rows];
+				complex_t* aq = &a[q*rows];
+				double alpha = 0, beta = 0, re = 0, im = 0;
+				for(i=0;i<rows;i++) {
+					alpha += quda_complex_abs_square(ap[i]);
+					beta += quda_complex_abs_square(aq[i]);
+					// <ap,aq>
+					re += (double)ap[i].real*aq[i].real + (double)ap[i].imag*aq[i].imag;
+					im += (double)ap[i].real*aq[i].imag - (double)ap[i].imag*aq[i].real;
+				}
+				double gamma = sqrt(re*re+im*im);
+				if(gamma <= QUDA_MPS_EPSILON*sqrt(alpha*beta) || gamma <= QUDA_MPS_EPSILON*frob) {
+					continue;
+				}
+				rotated = 1;
+
+				// Rotate ap against e^-i*arg(gamma) aq, whose overlap with ap is real
+				double zeta = (beta-alpha)/(2*gamma);
+				double t = ((zeta >= 0) ? 1 : -1)/(fabs(zeta)+sqrt(1+zeta*zeta));
+				double c = 1/sqrt(1+t*t);
+				double s = c*t;
+				complex_t e = { .real = re/gamma, .imag = im/gamma };
+				complex_t se = quda_complex_rmul(e,s);
+				complex_t sec = quda_complex_conj(se);
+				complex_t* cp = &v[p*cols];
+				complex_t* cq = &v[q*cols];
+				for(i=0;i<rows;i++) {
+					complex_t x = ap[i];
+					ap[i] = quda_complex_sub(quda_complex_rmul(x,c),quda_complex_mul(sec,aq[i]));
+					aq[i] = quda_complex_add(quda_complex_mul(se,x),quda_complex_rmul(aq[i],c));
+				}
+				for(i=0;i<cols;i++) {
+					complex_t x = cp[i];
+					cp[i] = quda_complex_sub(quda_complex_rmul(x,c),quda_complex_mul(sec,cq[i]));
+					cq[i] = quda_complex_add(quda_complex_mul(se,x),quda_complex_rmul(cq[i],c));
+				}
+			}
+		}
+		if(!rotated) break;
+	}
+}
+
+/* Applies the 4x4 matrix u (entry [out*4+in]) to sites i and i+1, indexing both with
+ * s_i*2+s_(i+1), or s_(i+1)*2+s_i if 'reversed' is set, and splits them again. The
+ * singular values go to site i+1 if 'right_values' is set and to site i otherwise, and that
+ * site becomes the center. The center must be at site i or i+1.
+ */
+static int quda_mps_split(quantum_reg* qreg, int i, const complex_t* u, int reversed,
+		int right_values) {
+	int L = qreg->mps_bonds[i];
+	int M = qreg->mps_bonds[i+1];
+	int R = qreg->mps_bonds[i+2];
+	int rows = 2*L;
+	int cols = 2*R;
+
+	complex_t* a = malloc((size_t)rows*cols*sizeof(complex_t));
+	complex_t* v = malloc((size_t)cols*cols*sizeof(complex_t));
+	double* weight = malloc(cols*sizeof(double));
+	int* order = malloc(cols*sizeof(int));
+	if(a == NULL || v == NULL || weight == NULL || order == NULL) {
+		free(a);
+		free(v);
+		free(weight);
+		free(order);
+		return -1;
+	}
+
+	// Contract the bond between the sites, apply u and lay the result out as (l,s1) x (s2,r)
+	int l,m,r,in,out,j,k;
+	for(l=0;l<L;l++) {
+		for(r=0;r<R;r++) {
+			complex_t theta[4];
+			for(in=0;in<4;in++) {
+				theta[in] = QUDA_COMPLEX_ZERO;
+				for(m=0;m<M;m++) {
+					theta[in] = quda_complex_add(theta[in],
+							quda_complex_mul(QUDA_MPS_SITE(qreg,i,l,in >> 1,m),
+							QUDA_MPS_SITE(qreg,i+1,m,in & 1,r)));
+				}
+			}
+			for(out=0;out<4;out++) {
+				complex_t sum = QUDA_COMPLEX_ZERO;
+				for(in=0;in<4;in++) {
+					int uo = reversed ? ((out & 1) << 1) | (out >> 1) : out;
+					int ui = reversed ? ((in & 1) << 1) | (in >> 1) : in;
+					sum = quda_complex_add(sum,quda_complex_mul(u[uo*4+ui],theta[in]));
+				}
+				a[((out & 1)*R+r)*rows + l*2+(out >> 1)] = sum;
+			}
+		}
+	}
+
+	quda_mps_svd(a,v,rows,cols);
+
+	// Keep the largest singular values, sorted
+	double total = 0;
+	for(j=0;j<cols;j++) {
+		weight[j] = 0;
+		for(k=0;k<rows;k++) {
+			weight[j] += quda_complex_abs_square(a[j*rows+k]);
+		}
+		total += weight[j];
+		for(k=j;k>0 && weight[order[k-1]] < weight[j];k--) {
+			order[k] = order[k-1];
+		}
+		order[k] = j;
+	}
+	double kept = 0;
+	int bond;
+	for(bond=0;bond<cols && bond<qreg->max_bond;bond++) {
+		double w = weight[order[bond]];
+		if(bond > 0 && (w <= QUDA_MPS_NOISE*total || w < qreg->truncation*total)) break;
+		kept += w;
+	}
+	if(kept < total) {
+		qreg->discarded += (1.0 - qreg->discarded)*(total-kept)/total;
+		qreg->fidelity *= kept/total;
+	}
+
+	complex_t* left = malloc((size_t)rows*bond*sizeof(complex_t));
+	complex_t* right = malloc((size_t)bond*cols*sizeof(complex_t));
+	if(left == NULL || right == NULL) {
+		free(left);
+		free(right);
+		free(a);
+		free(v);
+		free(weight);
+		free(order);
+		return -1;
+	}
+
+	// Each kept column of a is a left singular vector times its value, rescaled to keep the norm
+	quda_float_t scale = (kept > 0) ? sqrt(total/kept) : 1;
+	for(j=0;j<bond;j++) {
+		quda_float_t norm = 1;
+		if(right_values) {
+			// Move the singular value from the column to the row of v^H
+			norm = (weight[order[j]] > 0) ? sqrt(weight[order[j]]) : 1;
+		}
+		for(k=0;k<rows;k++) {
+			left[k*bond+j] = quda_complex_rmul(a[order[j]*rows+k],right_values ? 1/norm : scale);
+		}
+		for(k=0;k<cols;k++) {
+			right[j*cols+k] = quda_complex_rmul(quda_complex_conj(v[order[j]*cols+k]),
+					right_values ? norm*scale : 1);
+		}
+	}
+
+	free(qreg->mps_sites[i]);
+	free(qreg->mps_sites[i+1]);
+	qreg->mps_sites[i] = left;
+	qreg->mps_sites[i+1] = right;
+	qreg->mps_bonds[i+1] = bond;
+	qreg->mps_center = right_values ? i+1 : i;
+	free(a);
+	free(v);
+	free(weight);
+	free(order);
+	return 0;
+}
+
+static const complex_t quda_mps_identity_matrix[16] = {
+	{1,0},{0,0},{0,0},{0,0},
+	{0,0},{1,0},{0,0},{0,0},
+	{0,0},{0,0},{1,0},{0,0},
+	{0,0},{0,0},{0,0},{1,0}
+};
+
+/* Moves the canonical center to site 'to' one split at a time */
+static int quda_mps_move_center(quantum_reg* qreg, int to) {
+	while(qreg->mps_center < to) {
+		if(quda_mps_split(qreg,qreg->mps_center,quda_mps_identity_matrix,0,1) == -1) return -1;
+	}
+	while(qreg->mps_center > to) {
+		if(quda_mps_split(qreg,qreg->mps_center-1,quda_mps_identity_matrix,0,0) == -1) return -1;
+	}
+	return 0;
+}
+
+/* quda_mps_split() after moving the center to site i or i+1 */
+static int quda_mps_pair(quantum_reg* qreg, int i, const complex_t* u, int reversed,
+		int right_values) {
+	int to = (qreg->mps_center < i) ? i : (qreg->mps_center > i+1) ? i+1 : qreg->mps_center;
+	if(quda_mps_move_center(qreg,to) == -1) return -1;
+	return quda_mps_split(qreg,i,u,reversed,right_values);
+}
+
+static const complex_t quda_mps_swap_matrix[16] = {
+	{1,0},{0,0},{0,0},{0,0},
+	{0,0},{0,0},{1,0},{0,0},
+	{0,0},{1,0},{0,0},{0,0},
+	{0,0},{0,0},{0,0},{1,0}
+};
+
+/* Applies u (indexed s_q1*2+s_q2) to any two bits, swapping q2's site next to q1's first.
+ * The center follows the swaps down and back up.
+ */
+static int quda_mps_gate2(quantum_reg* qreg, int q1, int q2, const complex_t* u) {
+	int lo = (q1 < q2) ? q1 : q2;
+	int hi = (q1 < q2) ? q2 : q1;
+	int i;
+	for(i=hi-1;i>lo;i--) {
+		if(quda_mps_pair(qreg,i,quda_mps_swap_matrix,0,0) == -1) return -1;
+	}
+	if(quda_mps_pair(qreg,lo,u,q1 > q2,1) == -1) return -1;
+	for(i=lo+1;i<hi;i++) {
+		if(quda_mps_pair(qreg,i,quda_mps_swap_matrix,0,1) == -1) return -1;
+	}
+	return 0;
+}
+
+/* Applies the 2x2 matrix u (entry [out*2+in]) to one bit */
+static void quda_mps_gate1(quantum_reg* qreg, int bit, const complex_t* u) {
+	int L = qreg->mps_bonds[bit];
+	int R = qreg->mps_bonds[bit+1];
+	int l,r;
+	for(l=0;l<L;l++) {
+		for(r=0;r<R;r++) {
+			complex_t a0 = QUDA_MPS_SITE(qreg,bit,l,0,r);
+			complex_t a1 = QUDA_MPS_SITE(qreg,bit,l,1,r);
+			QUDA_MPS_SITE(qreg,bit,l,0,r) = quda_complex_add(quda_complex_mul(u[0],a0),
+					quda_complex_mul(u[1],a1));
+			QUDA_MPS_SITE(qreg,bit,l,1,r) = quda_complex_add(quda_complex_mul(u[2],a0),
+					quda_complex_mul(u[3],a1));
+		}
+	}
+}
+
+/* Controlled-u on (control, target) */
+static int quda_mps_controlled(quantum_reg* qreg, int control, int target, const complex_t* u) {
+	complex_t cu[16];
+	int i;
+	for(i=0;i<16;i++) {
+		cu[i] = QUDA_COMPLEX_ZERO;
+	}
+	cu[0] = QUDA_COMPLEX_ONE;
+	cu[5] = QUDA_COMPLEX_ONE;
+	cu[10] = u[0];
+	cu[11] = u[1];
+	cu[14] = u[2];
+	cu[15] = u[3];
+	return quda_mps_gate2(qreg,control,target,cu);
+}
+
+static const complex_t quda_mps_x_matrix[4] = { {0,0},{1,0},{1,0},{0,0} };
+
+/* Toffoli from controlled square roots of X (Barenco et al.) */
+static int quda_mps_toffoli(quantum_reg* qreg, int c1, int c2, int target) {
+	static const complex_t v[4] = { {0.5f,0.5f},{0.5f,-0.5f},{0.5f,-0.5f},{0.5f,0.5f} };
+	static const complex_t vh[4] = { {0.5f,-0.5f},{0.5f,0.5f},{0.5f,0.5f},{0.5f,-0.5f} };
+	if(quda_mps_controlled(qreg,c2,target,v) == -1) return -1;
+	if(quda_mps_controlled(qreg,c1,c2,quda_mps_x_matrix) == -1) return -1;
+	if(quda_mps_controlled(qreg,c2,target,vh) == -1) return -1;
+	if(quda_mps_controlled(qreg,c1,c2,quda_mps_x_matrix) == -1) return -1;
+	return quda_mps_controlled(qreg,c1,target,v);
+}
+
+int quda_mps_apply(quantum_gate_t* gate) {
+	int op,target1,target2;
+	uint64_t controls;
+	quda_gate_decompose(gate,&op,&controls,&target1,&target2);
+	quantum_reg* qreg = gate->reg;
+
+	if(op == QUDA_OP_SWAP) {
+		if(controls == 0) {
+			return (quda_mps_gate2(qreg,target1,target2,quda_mps_swap_matrix) == -1) ? -1 : 1;
+		}
+		// Fredkin from a Toffoli between two controlled-nots
+		int control = __builtin_ctzll(controls);
+		if(quda_mps_controlled(qreg,target2,target1,quda_mps_x_matrix) == -1 ||
+				quda_mps_toffoli(qreg,control,target1,target2) == -1 ||
+				quda_mps_controlled(qreg,target2,target1,quda_mps_x_matrix) == -1) {
+			return -1;
+		}
+		return 1;
+	}
+
+	complex_t u[4] = { QUDA_COMPLEX_ONE, QUDA_COMPLEX_ZERO, QUDA_COMPLEX_ZERO, QUDA_COMPLEX_ONE };
+	double angle;
+	switch(op) {
+		case QUDA_OP_HADAMARD:
+			u[0].real = u[1].real = u[2].real = ONE_OVER_SQRT_2;
+			u[3].real = -ONE_OVER_SQRT_2;
+			break;
+		case QUDA_OP_PAULI_X:
+			u[0] = u[3] = QUDA_COMPLEX_ZERO;
+			u[1] = u[2] = QUDA_COMPLEX_ONE;
+			break;
+		case QUDA_OP_PAULI_Y:
+			// Same convention as the sparse kernel: |0> -> -i|1>, |1> -> i|0>
+			u[0] = u[3] = QUDA_COMPLEX_ZERO;
+			u[1] = QUDA_I;
+			u[2] = quda_complex_neg(QUDA_I);
+			break;
+		case QUDA_OP_PAULI_Z:
+			u[3].real = -1;
+			break;
+		case QUDA_OP_PHASE:
+			u[3] = QUDA_I;
+			break;
+		case QUDA_OP_PI_OVER_8:
+			u[3].real = ONE_OVER_SQRT_2;
+			u[3].imag = ONE_OVER_SQRT_2;
+			break;
+		case QUDA_OP_ROTATE_K:
+			// Large k are common in the fourier transform, so the angle must not use an int shift
+			angle = ldexp(QUDA_PI,1-gate->k);
+			u[3].real = cos(angle);
+			u[3].imag = sin(angle);
+			break;
+	}
+
+	if(controls == 0) {
+		quda_mps_gate1(qreg,target1,u);
+		return 1;
+	}
+	if(controls & (controls-1)) {
+		// Only the Toffoli gate has two controls
+		int c1 = __builtin_ctzll(controls);
+		int c2 = __builtin_ctzll(controls & (controls-1));
+		return (quda_mps_toffoli(qreg,c1,c2,target1) == -1) ? -1 : 1;
+	}
+	return (quda_mps_controlled(qreg,__builtin_ctzll(controls),target1,u) == -1) ? -1 : 1;
+}
+
+/* Multiplies the left environment e (L x L, row-major) through site i, keeping only the
+ * physical value 'only' (or both if it is negative), into out (R x R).
+ */
+static void quda_mps_transfer(quantum_reg* qreg, int i, const complex_t* e, complex_t* out,
+		int only, complex_t* temp) {
+	int L = qreg->mps_bonds[i];
+	int R = qreg->mps_bonds[i+1];
+	int l,lp,s,r,rp;
+
+	// temp[(l*2+s)*R+rp] = sum_lp e[l][lp] A[lp][s][rp]
+	for(l=0;l<L;l++) {
+		for(s=0;s<2;s++) {
+			for(rp=0;rp<R;rp++) {
+				complex_t sum = QUDA_COMPLEX_ZERO;
+				if(only < 0 || only == s) {
+					for(lp=0;lp<L;lp++) {
+						sum = quda_complex_add(sum,quda_complex_mul(e[l*L+lp],
+								QUDA_MPS_SITE(qreg,i,lp,s,rp)));
+					}
+				}
+				temp[(l*2+s)*R+rp] = sum;
+			}
+		}
+	}
+	// out[r][rp] = sum_(l,s) conj(A[l][s][r]) temp[(l*2+s)*R+rp]
+	for(r=0;r<R;r++) {
+		for(rp=0;rp<R;rp++) {
+			complex_t sum = QUDA_COMPLEX_ZERO;
+			for(l=0;l<2*L;l++) {
+				sum = quda_complex_add(sum,quda_complex_mul(
+						quda_complex_conj(qreg->mps_sites[i][l*R+r]),temp[l*R+rp]));
+			}
+			out[r*R+rp] = sum;
+		}
+	}
+}
+
+int quda_mps_measure(quantum_reg* qreg, int bit, int collapse) {
+	int n = quda_mps_bits(qreg);
+	int i,s,largest = 1;
+	for(i=0;i<=n;i++) {
+		if(qreg->mps_bonds[i] > largest) largest = qreg->mps_bonds[i];
+	}
+
+	// Environments for <psi|psi> restricted to each value of the bit
+	size_t env = (size_t)largest*largest;
+	complex_t* buffer = malloc((4*env + 2*env)*sizeof(complex_t));
+	if(buffer == NULL) {
+		return -1;
+	}
+	complex_t* e[2] = { buffer, buffer+env };
+	complex_t* next = buffer+2*env;
+	complex_t* temp = buffer+3*env;
+
+	e[0][0] = QUDA_COMPLEX_ONE;
+	for(i=0;i<bit;i++) {
+		quda_mps_transfer(qreg,i,e[0],next,-1,temp);
+		memcpy(e[0],next,qreg->mps_bonds[i+1]*qreg->mps_bonds[i+1]*sizeof(complex_t));
+	}
+	quda_mps_transfer(qreg,bit,e[0],e[1],1,temp);
+	quda_mps_transfer(qreg,bit,e[0],next,0,temp);
+	memcpy(e[0],next,qreg->mps_bonds[bit+1]*qreg->mps_bonds[bit+1]*sizeof(complex_t));
+	for(i=bit+1;i<n;i++) {
+		for(s=0;s<2;s++) {
+			quda_mps_transfer(qreg,i,e[s],next,-1,temp);
+			memcpy(e[s],next,qreg->mps_bonds[i+1]*qreg->mps_bonds[i+1]*sizeof(complex_t));
+		}
+	}
+	quda_float_t p0 = e[0][0].real;
+	quda_float_t p1 = e[1][0].real;
+	free(buffer);
+
+	int outcome = (quda_rand_float()*(p0+p1) < p1) ? 1 : 0;
+	if(!collapse) return outcome;
+
+	// Projecting the center's site keeps the other sites orthonormal
+	if(quda_mps_move_center(qreg,bit) == -1) return -1;
+
+	quda_float_t k = 1.0/sqrt(outcome ? p1 : p0);
+	int L = qreg->mps_bonds[bit];
+	int R = qreg->mps_bonds[bit+1];
+	int l,r;
+	for(l=0;l<L;l++) {
+		for(r=0;r<R;r++) {
+			QUDA_MPS_SITE(qreg,bit,l,!outcome,r) = QUDA_COMPLEX_ZERO;
+			QUDA_MPS_SITE(qreg,bit,l,outcome,r) =
+					quda_complex_rmul(QUDA_MPS_SITE(qreg,bit,l,outcome,r),k);
+		}
+	}
+	return outcome;
+}
+
+/* Copies the register's sites and bonds into newly allocated arrays */
+static int quda_mps_copy_sites(quantum_reg* qreg, complex_t*** sites_out, int** bonds_out) {
+	int n = quda_mps_bits(qreg);
+	complex_t** sites = calloc(n,sizeof(complex_t*));
+	int* bonds = malloc((n+1)*sizeof(int));
+	if(sites == NULL || bonds == NULL) {
+		quda_mps_free(sites,bonds,0);
+		return -1;
+	}
+	memcpy(bonds,qreg->mps_bonds,(n+1)*sizeof(int));
+	int i;
+	for(i=0;i<n;i++) {
+		size_t size = (size_t)bonds[i]*2*bonds[i+1]*sizeof(complex_t);
+		sites[i] = malloc(size);
+		if(sites[i] == NULL) {
+			quda_mps_free(sites,bonds,n);
+			return -1;
+		}
+		memcpy(sites[i],qreg->mps_sites[i],size);
+	}
+
+	*sites_out = sites;
+	*bonds_out = bonds;
+	return 0;
+}
+
+int quda_mps_sample(quantum_reg* qreg, uint64_t* retval) {
+	int n = quda_mps_bits(qreg);
+	complex_t** sites;
+	int* bonds;
+	if(quda_mps_copy_sites(qreg,&sites,&bonds) == -1) return -1;
+	int i;
+
+	// Collapse the copy one bit at a time
+	complex_t** orig_sites = qreg->mps_sites;
+	int* orig_bonds = qreg->mps_bonds;
+	int orig_center = qreg->mps_center;
+	qreg->mps_sites = sites;
+	qreg->mps_bonds = bonds;
+	uint64_t state = 0;
+	int res = 0;
+	for(i=0;i<n && res >= 0;i++) {
+		res = quda_mps_measure(qreg,i,1);
+		state |= (uint64_t)(res > 0) << i;
+	}
+	qreg->mps_sites = orig_sites;
+	qreg->mps_bonds = orig_bonds;
+	qreg->mps_center = orig_center;
+	quda_mps_free(sites,bonds,n);
+
+	if(res < 0) return -1;
+	*retval = state;
+	return 0;
+}
+
+int quda_mps_add_bits(quantum_reg* qreg, int n) {
+	int old = quda_mps_bits(qreg);
+	complex_t** sites = realloc(qreg->mps_sites,(old+n)*sizeof(complex_t*));
+	if(sites == NULL) {
+		return -1;
+	}
+	qreg->mps_sites = sites;
+	int* bonds = realloc(qreg->mps_bonds,(old+n+1)*sizeof(int));
+	if(bonds == NULL) {
+		return -1;
+	}
+	qreg->mps_bonds = bonds;
+
+	int i;
+	for(i=old;i<old+n;i++) {
+		if(quda_mps_init_site(sites,i,0) == -1) {
+			for(i--;i>=old;i--) {
+				free(sites[i]);
+			}
+			return -1;
+		}
+		bonds[i+1] = 1;
+	}
+	return 0;
+}
+
+int quda_mps_copy(quantum_reg* dest, quantum_reg* src) {
+	dest->mps_center = src->mps_center;
+	return quda_mps_copy_sites(src,&dest->mps_sites,&dest->mps_bonds);
+}
@@ -0,0 +1,71 @@
+/* quantum_mps.h: header for the matrix product state representation
+*/
+
+#ifndef __QUDA_QUANTUM_MPS_H
+#define __QUDA_QUANTUM_MPS_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* A matrix product state register (QUDA_REPR_MPS) of n bits holds one tensor per bit in
+ * 'mps_sites'. Site i has shape bonds[i] x 2 x bonds[i+1] (with bonds[0] = bonds[n] = 1) and
+ * stores entry (l,s,r) at index (l*2+s)*bonds[i+1]+r. Memory grows with the entanglement
+ * between neighbouring bits rather than with 2^n.
+ * Two-bit gates contract both sites, apply the gate and split them again with an SVD that
+ * keeps at most 'max_bond' singular values. Gates on distant bits are moved next to each
+ * other with swaps first, and Toffoli and Fredkin gates are decomposed into two-bit gates.
+ * Singular values dropped by the cap or the register's truncation threshold are recorded in
+ * 'discarded' and 'fidelity' like pruned states.
+ * The sites are kept in canonical form around 'mps_center': those to its left are left-
+ * and those to its right right-orthonormal, so the singular values of a split are those of
+ * the whole state and truncation keeps the norm. The center is moved (by exact splits) to
+ * the sites each two-bit gate contracts.
+ */
+
+/* Sets the register to the product state 'state', allocating its sites.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_mps_init(quantum_reg* qreg, uint64_t state);
+
+/* Converts a register holding a single basis state to the MPS representation.
+ * Returns 0 on success or -1 if the register is in a superposition or allocation fails.
+ */
+int quda_mps_enter(quantum_reg* qreg);
+
+/* Contracts an MPS register into the sparse representation. Registers over 30 bits cannot
+ * be contracted.
+ * Returns 0 on success (or if the register is not an MPS register) or -1 on failure, in
+ * which case the register is unchanged.
+ */
+int quda_mps_leave(quantum_reg* qreg);
+
+/* Applies any gate to an MPS register.
+ * Returns 1 on success or -1 if allocation fails.
+ */
+int quda_mps_apply(quantum_gate_t* gate);
+
+/* Measures one bit of an MPS register. If 'collapse' is set the register collapses to the
+ * outcome, otherwise it is left unchanged.
+ * Returns the outcome or -1 if allocation fails.
+ */
+int quda_mps_measure(quantum_reg* qreg, int bit, int collapse);
+
+/* Measures every bit of an MPS register without collapsing it and stores the physical
+ * state in 'retval'. Returns 0 on success or -1 if allocation fails.
+ */
+int quda_mps_sample(quantum_reg* qreg, uint64_t* retval);
+
+/* Adds n bits in state |0> above the register's current bits.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_mps_add_bits(quantum_reg* qreg, int n);
+
+/* Frees the register's sites */
+void quda_mps_delete(quantum_reg* qreg);
+
+/* Gives 'dest' a copy of the tensors of 'src', which must have the same number of bits.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_mps_copy(quantum_reg* dest, quantum_reg* src);
+
+#endif // __QUDA_QUANTUM_MPS_H
@@ -2,15 +2,84 @@
 */
 
 #include "quantum_reg.h"
+#include "quantum_frame.h"
+#include "quantum_diag.h"
+#include "quantum_factor.h"
+#include "quantum_stabilizer.h"
+#include "quantum_mps.h"
+#include "quantum_dense.h"
+#include "quantum_shard.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
-//#include <stdio.h> // DEBUG
+#include <stdio.h>
+
+#define QUDA_REDUCE_BLOCK 1024 // states summed in order before sums are added pairwise
+#define QUDA_REDUCE_TASK 64    // blocks in a half of a reduction that becomes its own task
+
+/* Sets the qubit map to the identity */
+static void quda_quantum_reg_reset_map(quantum_reg* qreg) {
+	int i;
+	for(i=0;i<QUDA_MAX_BITS;i++) {
+		qreg->qubit_map[i] = i;
+	}
+}
+
+/* Returns 1 if the register's state is held in a tableau or tensors instead of 'states' */
+static int quda_quantum_reg_implicit(quantum_reg* qreg) {
+	return qreg->repr == QUDA_REPR_STABILIZER || qreg->repr == QUDA_REPR_MPS;
+}
+
+/* Expands a stabilizer or MPS register into the sparse representation */
+static int quda_quantum_reg_expand(quantum_reg* qreg) {
+	if(quda_quantum_reg_implicit(qreg) && quda_quantum_reg_unshare(qreg) == -1) return -1;
+	if(quda_stabilizer_leave(qreg) == -1) return -1;
+	return quda_mps_leave(qreg);
+}
+
+/* Measures one physical bit of a stabilizer or MPS register */
+static int quda_quantum_reg_implicit_measure(quantum_reg* qreg, int bit, int collapse) {
+	if(qreg->repr == QUDA_REPR_STABILIZER) {
+		return quda_stabilizer_measure(qreg,bit,collapse);
+	}
+	return quda_mps_measure(qreg,bit,collapse);
+}
 
 int quda_quantum_reg_init(quantum_reg* qreg, int qubits) {
 	qreg->qubits = qubits;
 	qreg->size = (int)(DEFAULT_QTS_RATIO*qubits);
 	qreg->scratch = 0;
 	qreg->num_states = 0;
+	qreg->repr = QUDA_REPR_SPARSE;
+	qreg->truncation = 0.0f;
+	qreg->discarded = 0.0;
+	qreg->fidelity = 1.0;
+	qreg->dirty = 0;
+	qreg->coalesce_ratio = DEFAULT_COALESCE_RATIO;
+	qreg->coalesced_states = 0;
+	qreg->flags = 0;
+	qreg->frame_x = 0;
+	qreg->frame_z = 0;
+	qreg->frame_phase = 0;
+	qreg->diag_terms = NULL;
+	qreg->diag_count = 0;
+	qreg->diag_size = 0;
+	quda_quantum_reg_reset_map(qreg);
+	qreg->factors = NULL;
+	qreg->num_factors = 0;
+	qreg->factor_size = 0;
+	qreg->tableau = NULL;
+	qreg->mps_sites = NULL;
+	qreg->mps_bonds = NULL;
+	qreg->mps_center = 0;
+	qreg->max_bond = DEFAULT_MAX_BOND;
+	qreg->shared = NULL;
+	qreg->budget = 0;
+	qreg->budget_epsilon = 0.0f;
+	qreg->pressure = NULL;
+	qreg->pressure_data = NULL;
+	qreg->shards = 0;
+	qreg->shard = NULL;
 	qreg->states = (quantum_state_t*)malloc(qreg->size*sizeof(quantum_state_t));
 	if(qreg->states == NULL) {
 		return -1;
@@ -19,50 +88,329 @@ int quda_quantum_reg_init(quantum_reg* qreg, int qubits) {
 	return 0;
 }
 
+/* Gives the register its own states buffer if it shares one with clones. Only the states
+ * whose 'mask' bits equal 'value' are copied (every state for a zero mask), so that a
+ * collapse copies just the states it keeps. A register that is the last holder of a shared
+ * buffer takes it over without copying.
+ */
+static int quda_quantum_reg_own(quantum_reg* qreg, uint64_t mask, uint64_t value) {
+	if(qreg->shared == NULL) return 0;
+	if(*qreg->shared == 1) {
+		free(qreg->shared);
+		qreg->shared = NULL;
+		return 0;
+	}
+
+	int i,j;
+	int size = qreg->size;
+	if(mask) {
+		for(i=0,size=0;i<qreg->num_states;i++) {
+			if((qreg->states[i].state & mask) == value) size++;
+		}
+	}
+	quantum_state_t* temp_states = malloc((size > 0 ? size : 1)*sizeof(quantum_state_t));
+	if(temp_states == NULL) {
+		return -1;
+	}
+	for(i=0,j=0;i<qreg->num_states;i++) {
+		if((qreg->states[i].state & mask) == value) {
+			temp_states[j++] = qreg->states[i];
+		}
+	}
+
+	(*qreg->shared)--;
+	qreg->shared = NULL;
+	qreg->states = temp_states;
+	qreg->num_states = j;
+	qreg->size = (size > 0) ? size : 1;
+	return 0;
+}
+
+int quda_quantum_reg_unshare(quantum_reg* qreg) {
+	return quda_quantum_reg_own(qreg,0,0);
+}
+
+int quda_quantum_reg_clone(quantum_reg* dest, quantum_reg* src) {
+	if(src->repr == QUDA_REPR_SHARDED) return -1;
+	if(src->shared == NULL) {
+		src->shared = malloc(sizeof(int));
+		if(src->shared == NULL) {
+			return -1;
+		}
+		*src->shared = 1;
+	}
+
+	*dest = *src;
+	dest->diag_terms = NULL;
+	dest->diag_size = 0;
+	dest->tableau = NULL;
+	dest->mps_sites = NULL;
+	dest->mps_bonds = NULL;
+	dest->factors = NULL;
+	if(src->diag_count > 0) {
+		dest->diag_terms = malloc(src->diag_count*sizeof(quantum_phase_t));
+		if(dest->diag_terms == NULL) {
+			return -1;
+		}
+		memcpy(dest->diag_terms,src->diag_terms,src->diag_count*sizeof(quantum_phase_t));
+		dest->diag_size = src->diag_count;
+	}
+	if((src->tableau != NULL && quda_stabilizer_copy(dest,src) == -1)
+			|| (src->mps_sites != NULL && quda_mps_copy(dest,src) == -1)
+			|| quda_factor_copy(dest,src) == -1) {
+		free(dest->diag_terms);
+		free(dest->tableau);
+		quda_mps_delete(dest);
+		return -1;
+	}
+
+	(*src->shared)++;
+	return 0;
+}
+
+int quda_quantum_reg_set_repr(quantum_reg* qreg, int repr) {
+	if(repr == qreg->repr) return 0;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+	if(quda_factor_join(qreg) == -1) return -1;
+	if(quda_quantum_reg_implicit(qreg) && quda_quantum_reg_expand(qreg) == -1) return -1;
+	if(repr == QUDA_REPR_STABILIZER) return quda_stabilizer_enter(qreg);
+	if(repr == QUDA_REPR_MPS) return quda_mps_enter(qreg);
+	if(repr == qreg->repr) return 0;
+
+	if(repr == QUDA_REPR_DENSE) {
+		int bits = qreg->qubits + qreg->scratch;
+		if(bits > 30) return -1;
+
+		int count = 1 << bits;
+		if(!quda_quantum_reg_budget_fits(qreg,count)) return -1;
+		quantum_state_t* temp_states = malloc(count*sizeof(quantum_state_t));
+		if(temp_states == NULL) {
+			return -1;
+		}
+
+		quda_dense_init_states(qreg,temp_states,bits);
+
+		// Duplicate states merge exactly as they would in quda_quantum_reg_coalesce()
+		int renorm = qreg->dirty & QUDA_DIRTY_RENORM;
+		int i;
+		for(i=0;i<qreg->num_states;i++) {
+			renorm |= quda_amplitude_coalesce(&temp_states[qreg->states[i].state].amplitude,
+					&qreg->states[i].amplitude);
+		}
+
+		free(qreg->states);
+		qreg->states = temp_states;
+		qreg->size = count;
+		qreg->num_states = count;
+		qreg->repr = QUDA_REPR_DENSE;
+		qreg->dirty = 0;
+
+		if(renorm) {
+			quda_quantum_reg_renormalize(qreg);
+		}
+	} else {
+		// Every dense state is already distinct, so dropping the zeros is enough
+		qreg->repr = QUDA_REPR_SPARSE;
+		quda_quantum_reg_prune(qreg);
+	}
+
+	return 0;
+}
+
 void quda_quantum_reg_set(quantum_reg* qreg, uint64_t state) {
+	qreg->discarded = 0.0;
+	qreg->fidelity = 1.0;
+	qreg->dirty = 0;
+	qreg->coalesced_states = 1;
+	qreg->frame_x = 0;
+	qreg->frame_z = 0;
+	qreg->frame_phase = 0;
+	qreg->diag_count = 0;
+	quda_quantum_reg_reset_map(qreg);
+	if(qreg->repr == QUDA_REPR_STABILIZER) {
+		if(quda_stabilizer_init(qreg,state) == 0) return;
+		free(qreg->tableau);
+		qreg->tableau = NULL;
+		qreg->repr = QUDA_REPR_SPARSE;
+	}
+	if(qreg->repr == QUDA_REPR_MPS) {
+		if(quda_mps_init(qreg,state) == 0) return;
+		quda_mps_delete(qreg);
+		qreg->repr = QUDA_REPR_SPARSE;
+	}
+	if(qreg->flags & QUDA_REG_FACTORED) {
+		if(quda_factor_split(qreg,state) == 0) return;
+	}
+	quda_factor_delete(qreg);
+	// Only a sparse register's matching state (if any) is copied, and it is overwritten anyway
+	uint64_t mask = (qreg->repr == QUDA_REPR_DENSE) ? 0 : ~(uint64_t)0;
+	if(quda_quantum_reg_own(qreg,mask,state & mask) == -1) return;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		int i;
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].amplitude = QUDA_COMPLEX_ZERO;
+		}
+		qreg->states[state].amplitude = QUDA_COMPLEX_ONE;
+		return;
+	}
+
 	qreg->num_states = 1;
 	qreg->states[0].state = state;
 	qreg->states[0].amplitude = QUDA_COMPLEX_ONE;
 }
 
+/* Applies deferred gates (but does not coalesce) before the stored states are used directly.
+ * Queued diagonal gates sit between the frame and the stored states, so they go first.
+ */
+static void quda_quantum_reg_apply_pending(quantum_reg* qreg) {
+	quda_diag_flush(qreg);
+	quda_frame_flush(qreg);
+}
+
 void quda_quantum_reg_delete(quantum_reg* qreg) {
-	free(qreg->states);
+	// The last register holding a shared buffer frees it
+	if(qreg->shared == NULL || --*qreg->shared == 0) {
+		free(qreg->shared);
+		free(qreg->states);
+	}
+	free(qreg->diag_terms);
+	free(qreg->tableau);
+	quda_mps_delete(qreg);
+	quda_factor_delete(qreg);
+	quda_shard_delete(qreg);
+}
+
+/* Moves every amplitude of a dense register onto the state with the 'mask' bits set to
+ * 'value', merging amplitudes the same way coalescing would, and renormalizes the result.
+ */
+static void quda_dense_force_bits(uint64_t mask, uint64_t value, quantum_reg* qreg) {
+	int i;
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t dest = (i & ~mask) | value;
+		if(dest != (uint64_t)i) {
+			quda_amplitude_coalesce(&qreg->states[dest].amplitude,&qreg->states[i].amplitude);
+		}
+	}
+
+	quda_quantum_reg_renormalize(qreg);
 }
 
 void quda_quantum_bit_set(int target, quantum_reg* qreg) {
+	if(qreg->factors != NULL) {
+		int bit = quda_quantum_physical_bit(target,qreg);
+		int local = bit;
+		quda_quantum_bit_set(local,quda_factor_of(qreg,&local));
+		quda_factor_release(qreg,bit);
+		return;
+	}
+	if(quda_quantum_reg_expand(qreg) == -1) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
+	quda_quantum_reg_apply_pending(qreg);
 	int i;
-	uint64_t mask = 1 << target;
+	uint64_t mask = 1 << quda_quantum_physical_bit(target,qreg);
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		quda_dense_force_bits(mask,mask,qreg);
+		return;
+	}
+
 	for(i=0;i<qreg->num_states;i++) {
 		qreg->states[i].state = qreg->states[i].state | mask;
 	}
 
-	quda_quantum_reg_coalesce(qreg);
+	qreg->dirty |= QUDA_DIRTY_RENORM;
+	quda_quantum_reg_defer_coalesce(qreg);
 }
 
 void quda_quantum_bit_reset(int target, quantum_reg* qreg) {
+	if(qreg->factors != NULL) {
+		int bit = quda_quantum_physical_bit(target,qreg);
+		int local = bit;
+		quda_quantum_bit_reset(local,quda_factor_of(qreg,&local));
+		quda_factor_release(qreg,bit);
+		return;
+	}
+	if(quda_quantum_reg_expand(qreg) == -1) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
+	quda_quantum_reg_apply_pending(qreg);
 	int i;
-	uint64_t mask = ~(1 << target);
+	uint64_t mask = ~(1 << quda_quantum_physical_bit(target,qreg));
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		quda_dense_force_bits(~mask,0,qreg);
+		return;
+	}
+
 	for(i=0;i<qreg->num_states;i++) {
 		qreg->states[i].state = qreg->states[i].state & mask;
 	}
 
-	quda_quantum_reg_coalesce(qreg);
+	qreg->dirty |= QUDA_DIRTY_RENORM;
+	quda_quantum_reg_defer_coalesce(qreg);
 }
 
 // TODO: Registers are currently hard-limited to 64 total real/scratch qubits
 void quda_quantum_add_scratch(int n, quantum_reg* qreg) {
+	if(qreg->factors != NULL) {
+		// New bits start out unentangled
+		if(quda_factor_append(qreg,n) == 0) {
+			qreg->scratch += n;
+			return;
+		}
+		quda_factor_join(qreg);
+	}
+	if(qreg->repr == QUDA_REPR_STABILIZER && quda_stabilizer_add_bits(qreg,n) == -1) {
+		if(quda_quantum_reg_expand(qreg) == -1) return;
+	}
+	if(qreg->repr == QUDA_REPR_MPS && quda_mps_add_bits(qreg,n) == -1) {
+		if(quda_quantum_reg_expand(qreg) == -1) return;
+	}
+	if(qreg->repr == QUDA_REPR_DENSE && quda_quantum_reg_unshare(qreg) == -1) return;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// New high bits are zero, so existing amplitudes keep their indices
+		int bits = qreg->qubits + qreg->scratch + n;
+		int count = 0;
+		quantum_state_t* temp_states = NULL;
+		if(bits <= 30) {
+			count = 1 << bits;
+			temp_states = malloc(count*sizeof(quantum_state_t));
+		}
+		if(temp_states == NULL) {
+			// Sparse registers can always grow their index space
+			quda_quantum_reg_set_repr(qreg,QUDA_REPR_SPARSE);
+		} else {
+			// A fresh buffer lets each shard's worker touch its own pages first
+			quda_dense_init_states(qreg,temp_states,bits);
+			memcpy(temp_states,qreg->states,qreg->num_states*sizeof(quantum_state_t));
+			free(qreg->states);
+			qreg->states = temp_states;
+			qreg->size = count;
+			qreg->num_states = count;
+		}
+	}
+
 	qreg->scratch += n;
 }
 
 void quda_quantum_clear_scratch(quantum_reg* qreg) {
+	// Scratch must be stored in the high bits before they can be dropped
+	if(quda_quantum_reg_materialize(qreg) == -1) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
 	uint64_t mask = (1 << qreg->qubits)-1;
 	int i;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// Fold every scratch configuration onto scratch = 0 and drop the scratch index space
+		quda_dense_force_bits(~mask,0,qreg);
+		qreg->num_states = 1 << qreg->qubits;
+		qreg->scratch = 0;
+		return;
+	}
+
 	for(i=0;i<qreg->num_states;i++) {
 		qreg->states[i].state &= mask;
 	}
 
 	qreg->scratch = 0;
-	quda_quantum_reg_coalesce(qreg);
+	qreg->dirty |= QUDA_DIRTY_RENORM;
+	quda_quantum_reg_defer_coalesce(qreg);
 }
 
 inline void quda_quantum_collapse_scratch(quantum_reg* qreg) {
@@ -73,26 +421,46 @@ inline int quda_quantum_scratch_bit(int index, quantum_reg* qreg) {
 	return qreg->qubits + index;
 }
 
-int quda_quantum_reg_measure(quantum_reg* qreg, uint64_t* retval,int scratch) {
-	if(retval == NULL) return -2;
-	float f = quda_rand_float();
+int quda_quantum_physical_bit(int index, quantum_reg* qreg) {
+	if(qreg->flags & QUDA_REG_VIRTUAL_QUBITS) {
+		return qreg->qubit_map[index];
+	}
+	return index;
+}
+
+uint64_t quda_quantum_logical_state(uint64_t state, quantum_reg* qreg) {
+	if(!(qreg->flags & QUDA_REG_VIRTUAL_QUBITS)) return state;
+
+	uint64_t logical = 0;
 	int i;
-	for(i=0;i<qreg->num_states;i++) {
-		if(!quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
-			f -= quda_complex_abs_square(qreg->states[i].amplitude);
-			if(f < 0) {
-				if(!scratch && qreg->scratch > 0) {
-					uint64_t mask = (1 << qreg->qubits)-1;
-					*retval = qreg->states[i].state & mask;
-				} else {
-					*retval = qreg->states[i].state;
-				}
-				return 0;
-			}
-		}
+	for(i=0;i<qreg->qubits+qreg->scratch;i++) {
+		logical |= ((state >> qreg->qubit_map[i]) & 1) << i;
 	}
+	return logical;
+}
 
-	return -1;
+int quda_quantum_reg_measure(quantum_reg* qreg, uint64_t* retval,int scratch) {
+	if(retval == NULL) return -2;
+	uint64_t physical;
+	int sampled = -1;
+	if(qreg->repr == QUDA_REPR_STABILIZER) sampled = quda_stabilizer_sample(qreg,&physical);
+	if(qreg->repr == QUDA_REPR_MPS) sampled = quda_mps_sample(qreg,&physical);
+	if(sampled == 0) {
+		uint64_t state = quda_quantum_logical_state(physical,qreg);
+		*retval = (!scratch && qreg->scratch > 0) ? state & (((uint64_t)1 << qreg->qubits)-1) : state;
+		return 0;
+	}
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	int i = quda_states_select(qreg->states,qreg->num_states,quda_rand_float());
+	if(i < 0) return -1;
+	uint64_t state = quda_quantum_logical_state(qreg->states[i].state,qreg);
+	if(!scratch && qreg->scratch > 0) {
+		uint64_t mask = (1 << qreg->qubits)-1;
+		*retval = state & mask;
+	} else {
+		*retval = state;
+	}
+	return 0;
 }
 
 int quda_quantum_reg_measure_and_collapse(quantum_reg* qreg, uint64_t* retval) {
@@ -104,23 +472,119 @@ int quda_quantum_reg_measure_and_collapse(quantum_reg* qreg, uint64_t* retval) {
 		 */
 		quda_quantum_clear_scratch(qreg);
 	}
-	float f = quda_rand_float();
+	if(quda_quantum_reg_implicit(qreg)) {
+		// Collapsing every bit in turn leaves the register in the measured basis state
+		uint64_t state = 0;
+		int bit;
+		for(bit=0;bit<qreg->qubits;bit++) {
+			int res = quda_quantum_reg_implicit_measure(qreg,bit,1);
+			if(res < 0) return -1;
+			state |= (uint64_t)res << bit;
+		}
+		*retval = quda_quantum_logical_state(state,qreg);
+		return 0;
+	}
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	int i = quda_states_select(qreg->states,qreg->num_states,quda_rand_float());
+	if(i < 0) return -1;
+	uint64_t mask = (1 << qreg->qubits)-1;
+	uint64_t physical = qreg->states[i].state;
+	uint64_t state = quda_quantum_logical_state(physical,qreg);
+	*retval = state & mask;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// Setting a logical state also resets the qubit map
+		quda_quantum_reg_set(qreg,state);
+		return 0;
+	}
+	// A shared register only copies the measured state
+	if(quda_quantum_reg_own(qreg,~(uint64_t)0,physical) == -1) return -1;
+	qreg->states[0].state = physical;
+	qreg->states[0].amplitude = QUDA_COMPLEX_ONE;
+	qreg->num_states = 1;
+	return 0;
+}
+
+int quda_quantum_sampler_init(quantum_sampler* qs, quantum_reg* qreg, int scratch) {
+	qs->num_states = 0;
+	qs->states = NULL;
+	qs->cdf = NULL;
+	qs->reg = NULL;
+	qs->scratch = scratch;
+	if(quda_quantum_reg_flush(qreg) == -1) {
+		if(!quda_quantum_reg_implicit(qreg)) return -1;
+		// The register measures without expanding, so draws measure a clone of it
+		qs->reg = malloc(sizeof(quantum_reg));
+		if(qs->reg == NULL) {
+			return -1;
+		}
+		if(quda_quantum_reg_clone(qs->reg,qreg) == -1) {
+			free(qs->reg);
+			qs->reg = NULL;
+			return -1;
+		}
+		return 0;
+	}
+	qs->states = malloc(qreg->num_states*sizeof(uint64_t));
+	qs->cdf = malloc(qreg->num_states*sizeof(double));
+	if(qreg->num_states > 0 && (qs->states == NULL || qs->cdf == NULL)) {
+		quda_quantum_sampler_delete(qs);
+		return -1;
+	}
+
+	uint64_t mask = ~(uint64_t)0;
+	if(!scratch && qreg->scratch > 0) {
+		mask = ((uint64_t)1 << qreg->qubits)-1;
+	}
+
+	double p = 0.0;
 	int i;
 	for(i=0;i<qreg->num_states;i++) {
-		if(!quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
-			f -= quda_complex_abs_square(qreg->states[i].amplitude);
-			if(f < 0) {
-				uint64_t mask = (1 << qreg->qubits)-1;
-				*retval = qreg->states[i].state & mask;
-				qreg->states[0].state = qreg->states[i].state;
-				qreg->states[0].amplitude = QUDA_COMPLEX_ONE;
-				qreg->num_states = 1;
-				return 0;
-			}
+		quda_float_t a = quda_complex_abs_square(qreg->states[i].amplitude);
+		if(a > 0.0f) {
+			p += a;
+			qs->states[qs->num_states] = quda_quantum_logical_state(qreg->states[i].state,qreg) & mask;
+			qs->cdf[qs->num_states++] = p;
 		}
 	}
 
-	return -1;
+	return 0;
+}
+
+int quda_quantum_sampler_draw(quantum_sampler* qs, uint64_t* retval) {
+	if(retval == NULL) return -2;
+	if(qs->reg != NULL) {
+		return quda_quantum_reg_measure(qs->reg,retval,qs->scratch);
+	}
+	if(qs->num_states == 0) return -1;
+
+	// Scale by the total so minor normalization errors do not bias the tail state
+	double f = quda_rand_float()*qs->cdf[qs->num_states-1];
+	int lo = 0;
+	int hi = qs->num_states-1;
+	while(lo < hi) {
+		int mid = lo + (hi-lo)/2;
+		if(qs->cdf[mid] > f) {
+			hi = mid;
+		} else {
+			lo = mid+1;
+		}
+	}
+
+	*retval = qs->states[lo];
+	return 0;
+}
+
+void quda_quantum_sampler_delete(quantum_sampler* qs) {
+	if(qs->reg != NULL) {
+		quda_quantum_reg_delete(qs->reg);
+		free(qs->reg);
+		qs->reg = NULL;
+	}
+	free(qs->states);
+	free(qs->cdf);
+	qs->states = NULL;
+	qs->cdf = NULL;
+	qs->num_states = 0;
 }
 
 // TODO: Write optimized version that avoids unnecessary duplicate operations
@@ -193,61 +657,243 @@ int quda_quantum_range_measure_and_collapse(int start, int end, quantum_reg* qre
 
 /* Measure 1 bit of a quantum register */
 int quda_quantum_bit_measure(int target, quantum_reg* qreg) {
-	float p = 0;
-	float f = quda_rand_float();
-	uint64_t mask = 1 << target;
-	int i;
-	// Accumulate probability that the bit is in state |1>
-	for(i = 0;i<qreg->num_states;i++) {
-		if(qreg->states[i].state & mask) {
-			p += quda_complex_abs_square(qreg->states[i].amplitude);
-			if(p > f) return 1; // short-circuits iteration if already past threshold
-		}
+	if(qreg->factors != NULL) {
+		int local = quda_quantum_physical_bit(target,qreg);
+		return quda_quantum_bit_measure(local,quda_factor_of(qreg,&local));
 	}
-
-	return 0;
+	if(quda_quantum_reg_implicit(qreg)) {
+		return quda_quantum_reg_implicit_measure(qreg,quda_quantum_physical_bit(target,qreg),0);
+	}
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	float f = quda_rand_float();
+	uint64_t mask = 1 << quda_quantum_physical_bit(target,qreg);
+	// Probability that the bit is in state |1>
+	quda_accum_t p = quda_states_prob(qreg->states,qreg->num_states,mask,mask);
+	return p > f;
 }
 
 int quda_quantum_bit_measure_and_collapse(int target, quantum_reg* qreg) {
+	if(qreg->factors != NULL) {
+		// The measured bit leaves its factor
+		int bit = quda_quantum_physical_bit(target,qreg);
+		int local = bit;
+		int retval = quda_quantum_bit_measure_and_collapse(local,quda_factor_of(qreg,&local));
+		quda_factor_release(qreg,bit);
+		return retval;
+	}
+	if(quda_quantum_reg_implicit(qreg)) {
+		return quda_quantum_reg_implicit_measure(qreg,quda_quantum_physical_bit(target,qreg),1);
+	}
+
 	// Measure bit conventionally
 	// TODO: Can allow probability measurement from conventional to complete and remove it below
 	int retval = quda_quantum_bit_measure(target,qreg);
 
 	// Collapse states to those possible
-	uint64_t mask = 1 << target;
-	float p = 0;
+	uint64_t mask = 1 << quda_quantum_physical_bit(target,qreg);
+	// A shared sparse register only copies the states that survive the collapse
+	uint64_t keep = (qreg->repr == QUDA_REPR_DENSE) ? 0 : mask;
+	if(quda_quantum_reg_own(qreg,keep,retval ? keep : 0) == -1) return -1;
+	quda_accum_t p = quda_states_prob(qreg->states,qreg->num_states,mask,retval ? mask : 0);
+	// Nullify the states with the other value of the bit
+	quda_states_mask_mul(qreg->states,qreg->num_states,mask,retval ? 0 : mask,QUDA_COMPLEX_ZERO);
+
+	quda_quantum_reg_prune(qreg);
+
+	// Renormalize
+	quda_states_scale(qreg->states,qreg->num_states,sqrt(1.0/p));
+
+	return retval;
+}
+
+void quda_quantum_reg_set_truncation(quantum_reg* qreg, float threshold) {
+	qreg->truncation = threshold;
+}
+
+void quda_quantum_reg_set_max_bond(quantum_reg* qreg, int max_bond) {
+	qreg->max_bond = (max_bond < 1) ? 1 : max_bond;
+}
+
+void quda_quantum_reg_set_budget(quantum_reg* qreg, size_t bytes, float epsilon,
+		quda_pressure_fn callback, void* data) {
+	qreg->budget = bytes;
+	qreg->budget_epsilon = epsilon;
+	qreg->pressure = callback;
+	qreg->pressure_data = data;
+}
+
+void quda_quantum_reg_set_shards(quantum_reg* qreg, int shards) {
+	qreg->shards = (shards > 0) ? shards : 0;
+}
+
+/* Reports a pressure step to the register's callback */
+static void quda_quantum_reg_pressure(quantum_reg* qreg, int step) {
+	if(qreg->pressure != NULL) {
+		qreg->pressure(qreg,step,qreg->pressure_data);
+	}
+}
+
+/* Resizes the states buffer to 'count' states through a temporary file, so that the old
+ * and new buffers are never allocated at the same time. If the new buffer cannot be
+ * allocated, the states are read back into one of the old size.
+ */
+static int quda_quantum_reg_spill_resize(quantum_reg* qreg, int count) {
+	FILE* file = tmpfile();
+	if(file == NULL) {
+		return -1;
+	}
+	size_t n = qreg->num_states;
+	if(fwrite(qreg->states,sizeof(quantum_state_t),n,file) != n || fflush(file) != 0) {
+		fclose(file);
+		return -1;
+	}
+
+	// Check that the file reads back before the only other copy of the states is freed
+	quantum_state_t chunk[256];
+	size_t i,read;
+	rewind(file);
+	for(i=0;i<n;i+=read) {
+		size_t want = (n - i < 256) ? n - i : 256;
+		read = fread(chunk,sizeof(quantum_state_t),want,file);
+		if(read != want || memcmp(chunk,qreg->states+i,want*sizeof(quantum_state_t)) != 0) {
+			fclose(file);
+			return -1;
+		}
+	}
+
+	free(qreg->states);
+	int size = count;
+	qreg->states = malloc(count*sizeof(quantum_state_t));
+	if(qreg->states == NULL) {
+		size = qreg->size;
+		qreg->states = malloc(qreg->size*sizeof(quantum_state_t));
+	}
+	rewind(file);
+	if(qreg->states == NULL || fread(qreg->states,sizeof(quantum_state_t),n,file) != n) {
+		// Only reached if memory just freed cannot be allocated again; the states are lost,
+		// so leave an empty register rather than a dangling buffer
+		free(qreg->states);
+		qreg->states = NULL;
+		qreg->num_states = 0;
+		qreg->size = 0;
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	qreg->size = size;
+	return (size == count) ? 0 : -1;
+}
+
+int quda_quantum_reg_budget_fits(quantum_reg* qreg, int64_t count) {
+	size_t old = (size_t)qreg->size*sizeof(quantum_state_t);
+	if(qreg->budget == 0 || (uint64_t)count*sizeof(quantum_state_t) + old <= qreg->budget) {
+		return 1;
+	}
+	quda_quantum_reg_pressure(qreg,QUDA_PRESSURE_FAIL);
+	return 0;
+}
+
+/* Resizes the states buffer of a sparse register to 'count' states within its budget.
+ * If that is not possible, takes the next pressure step after '*step' that shrinks the
+ * register and returns 1, so that the caller can recount the states it needs and try again.
+ * 'truncated' is the number of states needed once those below the budget's epsilon are
+ * dropped; the truncation is only taken if that many would fit.
+ * Returns 0 once the buffer is resized, or -1 after reporting QUDA_PRESSURE_FAIL.
+ */
+static int quda_quantum_reg_grow(quantum_reg* qreg, int count, int truncated, int* step) {
+	size_t bytes = (size_t)count*sizeof(quantum_state_t);
+	size_t old = (size_t)qreg->size*sizeof(quantum_state_t);
+	if(qreg->budget == 0 || bytes + old <= qreg->budget) {
+		quantum_state_t* temp_states = realloc(qreg->states,bytes);
+		if(temp_states != NULL) {
+			qreg->states = temp_states;
+			qreg->size = count;
+			return 0;
+		}
+	}
+
+	if(*step < QUDA_PRESSURE_COALESCE && qreg->dirty) {
+		*step = QUDA_PRESSURE_COALESCE;
+		quda_quantum_reg_pressure(qreg,*step);
+		quda_quantum_reg_coalesce(qreg);
+		return 1;
+	}
+	// A spill can always make room for a buffer within the budget
+	if(*step < QUDA_PRESSURE_TRUNCATE && qreg->budget_epsilon > qreg->truncation
+			&& truncated < count
+			&& (qreg->budget == 0 || (size_t)truncated*sizeof(quantum_state_t) <= qreg->budget)) {
+		*step = QUDA_PRESSURE_TRUNCATE;
+		quda_quantum_reg_pressure(qreg,*step);
+		float truncation = qreg->truncation;
+		qreg->truncation = qreg->budget_epsilon;
+		quda_quantum_reg_prune(qreg);
+		qreg->truncation = truncation;
+		return 1;
+	}
+	if(*step < QUDA_PRESSURE_SPILL && (qreg->budget == 0 || bytes <= qreg->budget)) {
+		*step = QUDA_PRESSURE_SPILL;
+		quda_quantum_reg_pressure(qreg,*step);
+		if(quda_quantum_reg_spill_resize(qreg,count) == 0) return 0;
+	}
+
+	*step = QUDA_PRESSURE_FAIL;
+	quda_quantum_reg_pressure(qreg,*step);
+	return -1;
+}
+
+/* Zeroes every state whose probability is below the register's truncation threshold and
+ * rescales the survivors so the register's total probability is unchanged. This keeps the
+ * callers of prune (which may hold a partially collapsed, unnormalized register) correct.
+ * If every state is below the threshold, the most probable one is kept.
+ */
+static void quda_quantum_reg_truncate(quantum_reg* qreg) {
+	double total = 0.0;
+	double dropped = 0.0;
+	int largest = -1;
+	quda_float_t max = 0.0f;
 	int i;
 	for(i=0;i<qreg->num_states;i++) {
-		// TODO: Ideally, remove nested conditions
-		// TODO: Actually prune in this loop instead of just invalidating
-		if(qreg->states[i].state & mask) {
-			if(retval) { // this is a valid state, accumulate probability to renormalize
-				p += quda_complex_abs_square(qreg->states[i].amplitude);
-			} else { // this is an invalid state -- nullify
-				qreg->states[i].amplitude = QUDA_COMPLEX_ZERO;
-			}
-		} else {
-			if(!retval) { // valid state, accumulate probability
-				p += quda_complex_abs_square(qreg->states[i].amplitude);
-			} else { // invalid state -- nullify
-				qreg->states[i].amplitude = QUDA_COMPLEX_ZERO;
-			}
+		quda_float_t p = quda_complex_abs_square(qreg->states[i].amplitude);
+		total += p;
+		if(p > 0.0f && p < qreg->truncation) {
+			dropped += p;
+		}
+		if(p > max) {
+			max = p;
+			largest = i;
 		}
 	}
 
-	// TODO: Remove this call for optimization within the above loop
-	quda_quantum_reg_prune(qreg);
+	if(dropped == 0.0) return;
+	int keep = -1;
+	if(dropped >= total) {
+		keep = largest;
+		dropped -= max;
+		if(dropped <= 0.0) return;
+	}
 
-	// Renormalize
-	float k = sqrt(1.0f/p);
 	for(i=0;i<qreg->num_states;i++) {
-		qreg->states[i].amplitude = quda_complex_rmul(qreg->states[i].amplitude,k);
+		quda_float_t p = quda_complex_abs_square(qreg->states[i].amplitude);
+		if(p > 0.0f && p < qreg->truncation && i != keep) {
+			qreg->states[i].amplitude = QUDA_COMPLEX_ZERO;
+		}
 	}
 
-	return retval;
+	double fraction = dropped/total;
+	// The fraction is of what earlier truncations kept, so 'discarded' stays 1 - 'fidelity'
+	qreg->discarded += (1.0 - qreg->discarded)*fraction;
+	qreg->fidelity *= 1.0 - fraction;
+
+	quda_states_scale(qreg->states,qreg->num_states,sqrt(total/(total-dropped)));
 }
 
 void quda_quantum_reg_prune(quantum_reg* qreg) {
+	if(qreg->repr == QUDA_REPR_DENSE || qreg->num_states == 0) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
+	if(qreg->truncation > 0.0f) {
+		quda_quantum_reg_truncate(qreg);
+	}
+
 	int i,end;
 	for(i=0,end=qreg->num_states-1;i < end;i++) {
 		if(quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
@@ -278,6 +924,8 @@ void quda_quantum_reg_prune(quantum_reg* qreg) {
 }
 
 int quda_quantum_reg_enlarge(quantum_reg* qreg,int amount) {
+	if(qreg->repr == QUDA_REPR_DENSE) return 0;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
 	int increase;
 	if(amount < 0) {
 		increase = qreg->size;
@@ -285,32 +933,217 @@ int quda_quantum_reg_enlarge(quantum_reg* qreg,int amount) {
 		increase = amount;
 	}
 
-	quantum_state_t* temp_states = malloc((qreg->size+increase)*sizeof(quantum_state_t));
-	if(temp_states == NULL) {
-		return -1;
-	}
-
+	// Zeros are dropped in place so that realloc can often grow the buffer without a copy
 	int i,j;
 	for(i=0,j=0;i<qreg->num_states;i++) {
 		if(!quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
-			temp_states[j++] = qreg->states[i];
+			qreg->states[j++] = qreg->states[i];
 		}
 	}
-
 	qreg->num_states = j;
-	free(qreg->states);
-	qreg->states = temp_states;
-	qreg->size += increase;
 
+	// The caller sized 'amount' for the current states, so only spilling can help
+	int step = QUDA_PRESSURE_TRUNCATE;
+	int count = qreg->size+increase;
+	return quda_quantum_reg_grow(qreg,count,count,&step) == 0 ? 0 : -1;
+}
+
+/* Exchanges bit 0 and the target bit of a state */
+static uint64_t quda_swap_low_bit(uint64_t state, int target) {
+	uint64_t d = ((state >> target) ^ state) & 1;
+	return state ^ (d | (d << target));
+}
+
+/* Counts the states a split of the (sorted, with the target at bit 0) states needs if those
+ * with a probability below 'epsilon' are dropped first. As in truncation, the most probable
+ * state is kept if no other is. A controlled state needs a slot for its partner unless the
+ * partner is kept too.
+ */
+static int quda_quantum_reg_split_count(quantum_reg* qreg, uint64_t controls,
+		uint64_t anti_controls, float epsilon) {
+	int count = 0, largest = 0;
+	quda_float_t max = 0.0f;
+	int i;
+	for(i=0;i<qreg->num_states;i++) {
+		quda_float_t p = quda_complex_abs_square(qreg->states[i].amplitude);
+		if(p > max) {
+			max = p;
+			largest = i;
+		}
+		if(p < epsilon) continue;
+
+		uint64_t state = qreg->states[i].state;
+		count++;
+		if((state & controls) != controls || (state & anti_controls)) continue;
+		int j = (state & 1) ? i-1 : i+1;
+		if(j < 0 || j >= qreg->num_states || qreg->states[j].state != (state ^ 1)
+				|| quda_complex_abs_square(qreg->states[j].amplitude) < epsilon) {
+			count++;
+		}
+	}
+	if(count == 0) {
+		uint64_t state = qreg->states[largest].state;
+		count = ((state & controls) != controls || (state & anti_controls)) ? 1 : 2;
+	}
+	return count;
+}
+
+int quda_quantum_reg_pair_apply(quantum_reg* qreg, uint64_t controls, uint64_t anti_controls,
+		int target, const complex_t* u) {
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+	if(qreg->dirty) {
+		quda_quantum_reg_coalesce(qreg);
+	}
+	/* With the target moved to bit 0, sorting leaves every state next to its partner. The
+	 * masks never contain the target, so only their bit 0 moves.
+	 */
+	controls = quda_swap_low_bit(controls,target);
+	anti_controls = quda_swap_low_bit(anti_controls,target);
+	int i;
+	int step = 0;
+	for(;;) {
+		if(qreg->num_states == 0) return 0;
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].state = quda_swap_low_bit(qreg->states[i].state,target);
+		}
+		qsort(qreg->states,qreg->num_states,sizeof(quantum_state_t),qstate_compare);
+
+		int unpaired = 0;
+		for(i=0;i<qreg->num_states;i++) {
+			uint64_t state = qreg->states[i].state;
+			if((state & controls) != controls || (state & anti_controls)) continue;
+			if(i+1 < qreg->num_states && qreg->states[i+1].state == (state ^ 1) && !(state & 1)) {
+				i++;
+			} else {
+				unpaired++;
+			}
+		}
+
+		int res = 0;
+		if(qreg->num_states + unpaired > qreg->size) {
+			int truncated = quda_quantum_reg_split_count(qreg,controls,anti_controls,
+					qreg->budget_epsilon);
+			res = quda_quantum_reg_grow(qreg,qreg->num_states+unpaired,truncated,&step);
+		}
+		if(res == 0) break;
+
+		// The register shrank under pressure (and must be recounted) or the split failed
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].state = quda_swap_low_bit(qreg->states[i].state,target);
+		}
+		if(res == -1) return -1;
+	}
+
+	int states = qreg->num_states;
+	for(i=0;i<states;i++) {
+		uint64_t state = qreg->states[i].state;
+		if((state & controls) != controls || (state & anti_controls)) continue;
+
+		complex_t a = qreg->states[i].amplitude;
+		if(i+1 < states && qreg->states[i+1].state == (state ^ 1) && !(state & 1)) {
+			complex_t b = qreg->states[i+1].amplitude;
+			qreg->states[i].amplitude = quda_complex_add(quda_complex_mul(u[0],a),
+					quda_complex_mul(u[1],b));
+			qreg->states[i+1].amplitude = quda_complex_add(quda_complex_mul(u[2],a),
+					quda_complex_mul(u[3],b));
+			i++;
+			continue;
+		}
+
+		int bit = state & 1;
+		qreg->states[i].amplitude = quda_complex_mul(u[bit*2+bit],a);
+		qreg->states[qreg->num_states].state = state ^ 1;
+		qreg->states[qreg->num_states++].amplitude = quda_complex_mul(u[(1-bit)*2+bit],a);
+	}
+
+	for(i=0;i<qreg->num_states;i++) {
+		qreg->states[i].state = quda_swap_low_bit(qreg->states[i].state,target);
+	}
+
+	// Pairs that interfered completely leave zeros, but never duplicates
+	quda_quantum_reg_prune(qreg);
+	qreg->coalesced_states = qreg->num_states;
+	return 0;
+}
+
+void quda_quantum_reg_set_coalesce_ratio(quantum_reg* qreg, float ratio) {
+	qreg->coalesce_ratio = ratio;
+}
+
+void quda_quantum_reg_defer_coalesce(quantum_reg* qreg) {
+	qreg->dirty |= QUDA_DIRTY_DUPLICATES;
+	if(qreg->coalesce_ratio <= 1.0f || qreg->num_states > qreg->coalesce_ratio*qreg->coalesced_states) {
+		quda_quantum_reg_coalesce(qreg);
+	}
+}
+
+void quda_quantum_reg_set_flags(quantum_reg* qreg, int flags) {
+	if(quda_quantum_reg_materialize(qreg) == -1) return;
+	qreg->flags = flags;
+}
+
+int quda_quantum_reg_materialize(quantum_reg* qreg) {
+	if(quda_factor_join(qreg) == -1) return -1;
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	if(!(qreg->flags & QUDA_REG_VIRTUAL_QUBITS)) return 0;
+
+	int i;
+	int bits = qreg->qubits+qreg->scratch;
+	for(i=0;i<bits && qreg->qubit_map[i] == i;i++);
+	if(i == bits) return 0;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// Every index moves, so the amplitudes are permuted through a copy
+		complex_t* temp = malloc(qreg->num_states*sizeof(complex_t));
+		if(temp == NULL) {
+			return -1;
+		}
+		for(i=0;i<qreg->num_states;i++) {
+			temp[quda_quantum_logical_state(i,qreg)] = qreg->states[i].amplitude;
+		}
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].amplitude = temp[i];
+		}
+		free(temp);
+	} else {
+		// Relabeling is a bijection, so no duplicates are created
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].state = quda_quantum_logical_state(qreg->states[i].state,qreg);
+		}
+	}
+
+	quda_quantum_reg_reset_map(qreg);
+	return 0;
+}
+
+int quda_quantum_reg_flush(quantum_reg* qreg) {
+	// A clone with no deferred work keeps sharing its states
+	if(qreg->factors != NULL || quda_quantum_reg_implicit(qreg) || qreg->dirty
+			|| qreg->diag_count > 0 || qreg->frame_x || qreg->frame_z || qreg->frame_phase) {
+		if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+	}
+	if(quda_factor_join(qreg) == -1) return -1;
+	if(quda_quantum_reg_expand(qreg) == -1) return -1;
+	// Queued diagonal gates and the frame are applied in place and cannot fail
+	quda_quantum_reg_apply_pending(qreg);
+	if(qreg->dirty) {
+		quda_quantum_reg_coalesce(qreg);
+	}
 	return 0;
 }
 
 void quda_quantum_reg_coalesce(quantum_reg* qreg) {
-	if(qreg->num_states < 2) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
+	int renorm = qreg->dirty & QUDA_DIRTY_RENORM;
+	qreg->dirty = 0;
+	if(qreg->num_states < 2 || qreg->repr == QUDA_REPR_DENSE) {
+		qreg->coalesced_states = qreg->num_states;
+		return;
+	}
 	qsort(qreg->states,qreg->num_states,sizeof(quantum_state_t),qstate_compare);
 
 	int i,j;
-	int renorm = 0;
 	for(i=1,j=0;i<qreg->num_states;i++) {
 		if(qreg->states[j].state == qreg->states[i].state) {
 			renorm |= quda_amplitude_coalesce(&qreg->states[j].amplitude,
@@ -326,12 +1159,18 @@ void quda_quantum_reg_coalesce(quantum_reg* qreg) {
 
 	// TODO: Optimize pruning into the above pass or make it optional/conditional
 	quda_quantum_reg_prune(qreg);
+	qreg->coalesced_states = qreg->num_states;
 }
 
 int quda_quantum_reg_trim(quantum_reg* qreg) {
-	int old_states = qreg->num_states;
-	quda_quantum_reg_prune(qreg);
-	if(qreg->num_states < old_states) {
+	if(qreg->repr == QUDA_REPR_DENSE) return 0;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+	if(qreg->dirty) {
+		quda_quantum_reg_coalesce(qreg);
+	} else {
+		quda_quantum_reg_prune(qreg);
+	}
+	if(qreg->num_states < qreg->size) {
 		quantum_state_t* temp_states = malloc(qreg->num_states*sizeof(quantum_state_t));
 		if(temp_states == NULL) {
 			return -1;
@@ -344,87 +1183,145 @@ int quda_quantum_reg_trim(quantum_reg* qreg) {
 
 		free(qreg->states);
 		qreg->states = temp_states;
+		qreg->size = qreg->num_states;
 	}
 
 	return 0;
 }
 
 void quda_quantum_reg_renormalize(quantum_reg* qreg) {
+	// Duplicate states must interfere before their probabilities mean anything
+	if(quda_quantum_reg_flush(qreg) == -1) return;
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
+	quda_accum_t p = quda_states_norm(qreg->states,qreg->num_states);
+	if(p <= 0) return; // every amplitude cancelled
+
+	// Apply renormalization
+	quda_states_scale(qreg->states,qreg->num_states,sqrt(1.0/p));
+}
+
+/* Identical states superpose linearly. Merging them in any order or at any later time then
+ * gives the same amplitude, which is what allows coalescing to be deferred.
+ */
+int quda_amplitude_coalesce(complex_t* dest, complex_t* toadd) {
+	*dest = quda_complex_add(*dest,*toadd);
+	*toadd = QUDA_COMPLEX_ZERO;
+	return 0;
+}
+
+void quda_states_scale(quantum_state_t* s, int count, quda_float_t f) {
 	int i;
-	float p = 0.0f;
-	for(i=0;i<qreg->num_states;i++) {
-		p += quda_complex_abs_square(qreg->states[i].amplitude);
+	for(i=0;i<count;i++) {
+		s[i].amplitude = quda_complex_rmul(s[i].amplitude,f);
 	}
+}
 
-	// Apply renormalization
-	float k = sqrt(1.0f/p);
-	for(i=0;i<qreg->num_states;i++) {
-		qreg->states[i].amplitude = quda_complex_rmul(qreg->states[i].amplitude,k);
+void quda_states_mul(quantum_state_t* s, int count, complex_t c) {
+	int i;
+	for(i=0;i<count;i++) {
+		s[i].amplitude = quda_complex_mul(s[i].amplitude,c);
 	}
 }
 
-// TODO: Optimize logic in this function
-int quda_amplitude_coalesce(complex_t* dest, complex_t* toadd) {
-	int renorm = 0;
-	if(toadd->real != 0.0f) {
-		if(dest->real == 0.0f) {
-			dest->real = toadd->real;
-		} else {
-			if(dest->real > 0 && toadd->real < 0) {
-				float temp = dest->real*dest->real - toadd->real*toadd->real;
-				if(temp < 0) {
-					dest->real = -sqrt(-temp);
-				} else {
-					dest->real = sqrt(temp);
-				}
-				renorm = 1;
-			} else if(dest->real < 0 && toadd->real > 0) {
-				float temp = toadd->real*toadd->real - dest->real*dest->real;
-				if(temp < 0) {
-					dest->real = -sqrt(-temp);
-				} else {
-					dest->real = sqrt(temp);
-				}
-				renorm = 1;
-			} else if(dest->real > 0 && toadd->real > 0) {
-				dest->real = sqrt(dest->real * dest->real + toadd->real * toadd->real);
-			} else {
-				dest->real = -sqrt(dest->real * dest->real + toadd->real * toadd->real);
-			}
+void quda_states_mask_mul(quantum_state_t* s, int count, uint64_t mask, uint64_t value,
+		complex_t c) {
+	int i;
+	for(i=0;i<count;i++) {
+		// Selecting instead of branching keeps the loop free of control flow
+		complex_t f = ((s[i].state & mask) == value) ? c : QUDA_COMPLEX_ONE;
+		s[i].amplitude = quda_complex_mul(s[i].amplitude,f);
+	}
+}
+
+/* Sums the probabilities of the matching states in blocks [b0,b1) of QUDA_REDUCE_BLOCK
+ * states. A state matches if its 'mask' bits (or with 'parity' set, their parity) equal
+ * 'value'. Each block is summed in order and the halves of the range are added pairwise, so
+ * the tree (and the result) only depends on 'count'. Large halves become tasks.
+ */
+static quda_accum_t quda_states_reduce(const quantum_state_t* s, int count, uint64_t mask,
+		uint64_t value, int parity, int b0, int b1) {
+	if(b1 - b0 == 1) {
+		int end = (b1*QUDA_REDUCE_BLOCK < count) ? b1*QUDA_REDUCE_BLOCK : count;
+		quda_accum_t p = 0.0;
+		int i;
+		for(i=b0*QUDA_REDUCE_BLOCK;i<end;i++) {
+			quda_float_t a = quda_complex_abs_square(s[i].amplitude);
+			uint64_t key = s[i].state & mask;
+			if(parity) key = __builtin_popcountll(key) & 1;
+			p += (key == value) ? a : 0;
 		}
-		toadd->real = 0.0f;
+		return p;
 	}
 
-	if(toadd->imag != 0.0f) {
-		if(dest->imag == 0.0f) {
-			dest->imag = toadd->imag;
+	int mid = b0 + (b1-b0)/2;
+	quda_accum_t left,right;
+	#ifdef _OPENMP
+	#pragma omp task shared(left) if(mid - b0 >= QUDA_REDUCE_TASK)
+	#endif
+	left = quda_states_reduce(s,count,mask,value,parity,b0,mid);
+	right = quda_states_reduce(s,count,mask,value,parity,mid,b1);
+	#ifdef _OPENMP
+	#pragma omp taskwait
+	#endif
+	return left + right;
+}
+
+/* Runs quda_states_reduce() over blocks [b0,b1), in a team of threads if it is large */
+static quda_accum_t quda_states_reduce_blocks(const quantum_state_t* s, int count,
+		uint64_t mask, uint64_t value, int parity, int b0, int b1) {
+	quda_accum_t p = 0.0;
+	#ifdef _OPENMP
+	#pragma omp parallel if(b1 - b0 >= 2*QUDA_REDUCE_TASK)
+	#pragma omp single
+	#endif
+	p = quda_states_reduce(s,count,mask,value,parity,b0,b1);
+	return p;
+}
+
+quda_accum_t quda_states_prob(const quantum_state_t* s, int count, uint64_t mask,
+		uint64_t value) {
+	if(count <= 0) return 0.0;
+	return quda_states_reduce_blocks(s,count,mask,value,0,0,(count-1)/QUDA_REDUCE_BLOCK+1);
+}
+
+quda_accum_t quda_states_parity(const quantum_state_t* s, int count, uint64_t mask,
+		int value) {
+	if(count <= 0) return 0.0;
+	return quda_states_reduce_blocks(s,count,mask,value,1,0,(count-1)/QUDA_REDUCE_BLOCK+1);
+}
+
+quda_accum_t quda_states_norm(const quantum_state_t* s, int count) {
+	return quda_states_prob(s,count,0,0);
+}
+
+int quda_states_select(const quantum_state_t* s, int count, quda_accum_t f) {
+	if(count <= 0) return -1;
+	// Descend the tree of quda_states_prob(), skipping each left half whose sum f exceeds
+	int b0 = 0, b1 = (count-1)/QUDA_REDUCE_BLOCK+1;
+	int bounded = 0;
+	while(b1 - b0 > 1) {
+		int mid = b0 + (b1-b0)/2;
+		quda_accum_t left = quda_states_reduce_blocks(s,count,0,0,0,b0,mid);
+		if(f < left) {
+			b1 = mid;
+			bounded = 1;
 		} else {
-			if(dest->imag > 0 && toadd->imag < 0) {
-				float temp = dest->imag*dest->imag - toadd->imag*toadd->imag;
-				if(temp < 0) {
-					dest->imag = -sqrt(-temp);
-				} else {
-					dest->imag = sqrt(temp);
-				}
-				renorm = 1;
-			} else if(dest->imag < 0 && toadd->imag > 0) {
-				float temp = toadd->imag*toadd->imag - dest->imag*dest->imag;
-				if(temp < 0) {
-					dest->imag = -sqrt(-temp);
-				} else {
-					dest->imag = sqrt(temp);
-				}
-				renorm = 1;
-			} else if(dest->imag > 0 && toadd->imag > 0) {
-				dest->imag = sqrt(dest->imag * dest->imag + toadd->imag * toadd->imag);
-			} else {
-				dest->imag = -sqrt(dest->imag * dest->imag + toadd->imag * toadd->imag);
-			}
+			f -= left;
+			b0 = mid;
 		}
-		toadd->imag = 0.0f;
 	}
 
-	return renorm;
+	int end = (b1*QUDA_REDUCE_BLOCK < count) ? b1*QUDA_REDUCE_BLOCK : count;
+	int last = -1;
+	int i;
+	for(i=b0*QUDA_REDUCE_BLOCK;i<end;i++) {
+		quda_float_t a = quda_complex_abs_square(s[i].amplitude);
+		if(a > 0) last = i;
+		f -= a;
+		if(f < 0) return i;
+	}
+	// Rounding can leave f just short of a block its sum said it falls in
+	return bounded ? last : -1;
 }
 
 /* Old (wrong) implementation - did not account for cancellation (but MUCH smaller)
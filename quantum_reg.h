@@ -9,12 +9,74 @@
 #include "complex.h"
 
 #define DEFAULT_QTS_RATIO 1.0 // default qubits-to-states ratio
+#define DEFAULT_COALESCE_RATIO 1.0 // default growth allowed before deferred coalescing (eager)
+#define DEFAULT_MAX_BOND 64 // default bond dimension cap of MPS registers
+
+// Register representations
+#define QUDA_REPR_SPARSE 0 // arraylist of nonzero states in no particular order
+#define QUDA_REPR_DENSE  1 // every basis state present, states[i].state == i
+#define QUDA_REPR_STABILIZER 2 // Clifford tableau in 'tableau', states unused (see quantum_stabilizer.h)
+#define QUDA_REPR_MPS 3 // matrix product state in 'mps_sites', states unused (see quantum_mps.h)
+#define QUDA_REPR_SHARDED 4 // this process's dense shard of a register split over processes (see quantum_shard.h)
+
+// Register flags enabling deferred gate application
+#define QUDA_REG_PAULI_FRAME 0x1 // track Pauli gates in a frame instead of applying them
+#define QUDA_REG_DIAGONAL_QUEUE 0x2 // queue diagonal gates and apply them in one fused pass
+#define QUDA_REG_VIRTUAL_QUBITS 0x4 // relabel qubits through 'qubit_map' so swaps cost O(1)
+#define QUDA_REG_FACTORED 0x8 // keep unentangled groups of qubits in separate factors
+
+#define QUDA_MAX_BITS 64 // registers are limited to 64 total real/scratch qubits
+
+// Bits of a register's 'dirty' field
+#define QUDA_DIRTY_DUPLICATES 0x1 // the state list may hold duplicate states
+#define QUDA_DIRTY_RENORM     0x2 // merging the duplicates must renormalize (forced bits)
+
+// Steps a register takes, in order, when a state split would exceed its memory budget
+#define QUDA_PRESSURE_COALESCE 1 // merge duplicate states
+#define QUDA_PRESSURE_TRUNCATE 2 // drop states below the budget's probability epsilon
+#define QUDA_PRESSURE_SPILL    3 // move the states to a temporary file while the buffer is resized
+#define QUDA_PRESSURE_FAIL     4 // nothing helped; the operation fails (undoing no earlier step)
+
+struct quantum_reg;
+
+/* Called with the QUDA_PRESSURE_* step a register is about to take and the data given to
+ * quda_quantum_reg_set_budget().
+ */
+typedef void (*quda_pressure_fn)(struct quantum_reg* qreg, int step, void* data);
 
 typedef struct quantum_state_t {
 	uint64_t state;
 	complex_t amplitude;
 } quantum_state_t;
 
+/* One queued diagonal gate: multiplies the amplitude of every state with all 'mask' bits
+ * set by 'factor'.
+ */
+typedef struct quantum_phase_t {
+	uint64_t mask;
+	complex_t factor;
+} quantum_phase_t;
+
+/* A Pauli operator i^r P(x_0,z_0) (x) P(x_1,z_1) (x) ..., where P(1,0) = X, P(0,1) = Z and
+ * P(1,1) = iXZ. Rows of a stabilizer tableau.
+ */
+typedef struct quantum_pauli_t {
+	uint64_t x;
+	uint64_t z;
+	int r;
+} quantum_pauli_t;
+
+/* Cumulative probability table used to draw many non-destructive samples from one register.
+ * 'cdf' accumulates in double so that large registers do not lose their tail probabilities.
+ */
+typedef struct quantum_sampler {
+	int num_states;
+	uint64_t* states;
+	double* cdf;
+	struct quantum_reg* reg; // snapshot measured instead when the register cannot be expanded
+	int scratch;
+} quantum_sampler;
+
 // TODO: This is a fairly naive implementation using an arraylist. Some redesign is necessary.
 // TODO: Never allow size to exceed 2^n and enforce low->high ordering of states in this case.
 typedef struct quantum_reg {
@@ -23,8 +85,47 @@ typedef struct quantum_reg {
 	int scratch;
 	int num_states;
 	quantum_state_t* states;
+	int repr;
+	float truncation; // probability below which prune drops a state (0 for exact zeros only)
+	double discarded; // share of the exact state dropped by truncation since the register was set
+	double fidelity;  // lower bound on the fidelity of the truncated state to the exact one
+	int dirty;              // set if the state list may hold duplicate states (QUDA_DIRTY_*)
+	float coalesce_ratio;   // growth over 'coalesced_states' that forces a deferred coalesce
+	int coalesced_states;   // number of states after the last coalesce
+	int flags;              // QUDA_REG_* flags
+	uint64_t frame_x;       // Pauli frame i^frame_phase X^frame_x Z^frame_z (see quantum_frame.h)
+	uint64_t frame_z;
+	int frame_phase;
+	quantum_phase_t* diag_terms; // queued diagonal gates (see quantum_diag.h)
+	int diag_count;
+	int diag_size;
+	unsigned char qubit_map[QUDA_MAX_BITS]; // logical-to-physical bit map (QUDA_REG_VIRTUAL_QUBITS)
+	struct quantum_factor_t* factors; // if non-NULL, the state is the product of these factors
+	int num_factors;
+	int factor_size;
+	unsigned char factor_of[QUDA_MAX_BITS]; // factor holding each physical bit
+	quantum_pauli_t* tableau; // stabilizer tableau (QUDA_REPR_STABILIZER)
+	complex_t** mps_sites;    // one tensor per bit (QUDA_REPR_MPS)
+	int* mps_bonds;           // bond dimensions between the sites
+	int mps_center;           // site the MPS is in canonical form around (see quantum_mps.h)
+	int max_bond;             // bond dimension cap of MPS registers
+	int* shared;              // clones sharing 'states' (NULL if the buffer is not shared)
+	size_t budget;            // bytes the states buffer may use (0 for no limit)
+	float budget_epsilon;     // probability below which states are dropped under pressure
+	quda_pressure_fn pressure; // reports each step taken under pressure (may be NULL)
+	void* pressure_data;
+	int shards;               // dense partitions by high state bits (0 to match the thread count)
+	struct quantum_shard_t* shard; // link to the other processes (QUDA_REPR_SHARDED)
 } quantum_reg;
 
+/* One factor of a factored register (see quantum_factor.h). Qubit i of 'reg' holds bit
+ * bits[i] of the register.
+ */
+typedef struct quantum_factor_t {
+	quantum_reg reg;
+	unsigned char bits[QUDA_MAX_BITS];
+} quantum_factor_t;
+
 /* Initializes a quantum register with the specified number of qubits.
  * Returns 0 on success or -1 if allocation fails.
  */
@@ -35,7 +136,101 @@ int quda_quantum_reg_init(quantum_reg* qreg, int qubits);
  */
 void quda_quantum_reg_delete(quantum_reg* qreg);
 
-/* Sets the register to a single physical state with probability 1. */
+/* Initializes 'dest' as a copy of 'src' in O(1) for the stored states: both registers share
+ * one states buffer, and the first operation that writes states on either side copies it for
+ * that register. Collapsing measurements and set() copy only the states they keep. Queued
+ * gates, the qubit map and factors are cloned too; a stabilizer tableau and MPS tensors are
+ * copied outright. The clone must be deleted separately.
+ * Returns 0 on success or -1 if allocation fails (in which case 'dest' is not initialized).
+ */
+int quda_quantum_reg_clone(quantum_reg* dest, quantum_reg* src);
+
+/* Gives the register its own copy of a states buffer it shares with clones. Code that writes
+ * 'states' directly must call this (after flushing) first.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_quantum_reg_unshare(quantum_reg* qreg);
+
+/* Switches the register to the given representation (QUDA_REPR_*), preserving its state.
+ * The dense representation holds all 2^(qubits+scratch) states in index order, so gates
+ * update amplitudes in place and never allocate. Dense registers are limited to 30 bits.
+ * The stabilizer representation can only be entered from a single basis state. Clifford
+ * gates then cost O(qubits) and measurements O(qubits^2); the first other gate, sampler or
+ * flush expands the register back into the sparse representation, up to a global phase.
+ * The MPS representation can also only be entered from a single basis state. It runs every
+ * gate and measurement without amplitudes, in memory bounded by the register's bond cap, and
+ * is expanded on a sampler or flush if it has at most 30 bits.
+ * Returns 0 on success or -1 if allocation fails (in which case the register is unchanged).
+ */
+int quda_quantum_reg_set_repr(quantum_reg* qreg, int repr);
+
+/* Enables approximate simulation of a sparse register.
+ * Prune (and therefore coalesce) additionally drops every state whose probability is below
+ * 'threshold' and renormalizes the rest. Each drop scales 'fidelity' by the fraction of the
+ * register's probability kept, and 'discarded' stays 1 - 'fidelity'. If every state is
+ * below 'threshold', the most probable one is kept.
+ * A threshold of 0 (the default) only drops states with zero amplitude.
+ */
+void quda_quantum_reg_set_truncation(quantum_reg* qreg, float threshold);
+
+/* Sets the largest bond dimension an MPS register keeps after each two-bit gate (at least 1).
+ * The truncation threshold also applies to each singular value's share of the weight.
+ */
+void quda_quantum_reg_set_max_bond(quantum_reg* qreg, int max_bond);
+
+/* Limits the states buffer of a register to 'bytes' (0, the default, for no limit).
+ * When growing it for a state split (enlarge, hadamard and multi-controlled unitaries) would
+ * exceed the budget, counting the old buffer while it is copied, the register takes these
+ * steps in order until the split fits: coalesce duplicate states, drop states with a
+ * probability below 'epsilon' (skipped if 'epsilon' is 0 or if the split would not fit even
+ * then, recorded like truncation), and write the states to a temporary file so the old
+ * buffer can be freed before the new one is allocated. If the split still does not fit, the
+ * operation fails and the register keeps its previous state, except that states dropped
+ * before an allocation or the spill itself failed stay dropped (the callback was told of the
+ * truncation). If after a spill not even a buffer of the old size can be allocated again,
+ * the states are lost and the register is left empty.
+ * Other operations that replace the buffer (the dense representation and the sparse Grover
+ * diffusion) fail at once if the new buffer does not fit next to the old one.
+ * 'callback' (if not NULL) is told of each step as it is taken.
+ */
+void quda_quantum_reg_set_budget(quantum_reg* qreg, size_t bytes, float epsilon,
+		quda_pressure_fn callback, void* data);
+
+/* Checks that a buffer of 'count' states fits the register's budget next to its current one.
+ * Returns 1 if it does, or 0 after reporting QUDA_PRESSURE_FAIL.
+ */
+int quda_quantum_reg_budget_fits(quantum_reg* qreg, int64_t count);
+
+/* Sets how many partitions the register's dense amplitudes are split into by their high
+ * state bits (rounded down to a power of two no larger than the state count). Each partition
+ * is written first, and updated by gates on lower bits, by one thread of its own, so that with
+ * threads bound to nodes (OMP_PROC_BIND) every partition's pages stay local to the node that
+ * works on them. Gates on partition bits exchange partner amplitudes between partitions in
+ * blocks. With 0 (the default) the register uses one partition per OpenMP thread, provided
+ * each holds at least 2^14 states.
+ */
+void quda_quantum_reg_set_shards(quantum_reg* qreg, int shards);
+
+/* Sets the register's QUDA_REG_* flags. Any deferred work is flushed first.
+ * With QUDA_REG_PAULI_FRAME, the Pauli X, Y and Z gates only update a frame held by the
+ * register in O(1), and the other gates are rewritten to act through it.
+ * With QUDA_REG_DIAGONAL_QUEUE, diagonal gates (Z, phase, pi/8, rotate_k and their controlled
+ * forms) are queued and applied together in a single pass over the states when the next
+ * non-diagonal gate or measurement arrives.
+ * With QUDA_REG_VIRTUAL_QUBITS, gates, measurements and dumps address qubits through a
+ * logical-to-physical map, and swap gates only exchange two entries of it. The stored states
+ * are then indexed by physical bit until quda_quantum_reg_materialize() is called.
+ * With QUDA_REG_FACTORED, quda_quantum_reg_set() stores every qubit as a separate factor.
+ * Gates on one factor only touch that factor's states, and factors are multiplied together
+ * only when a gate spans several of them. Measuring a qubit (or setting it) splits it back
+ * off its factor. While a register is factored its own 'states' are stale until it is
+ * flushed, which multiplies every factor back into it.
+ */
+void quda_quantum_reg_set_flags(quantum_reg* qreg, int flags);
+
+/* Sets the register to a single physical state with probability 1.
+ * Also resets the register's truncation record ('discarded' and 'fidelity').
+ */
 void quda_quantum_reg_set(quantum_reg* qreg, uint64_t state);
 
 /* Sets a single bit of a quantum register to 1 with probability 1.
@@ -70,6 +265,12 @@ void quda_quantum_collapse_scratch(quantum_reg* qreg);
  */
 int quda_quantum_scratch_bit(int index, quantum_reg* qreg);
 
+/* Returns the bit of the stored states that holds the given logical qubit. */
+int quda_quantum_physical_bit(int index, quantum_reg* qreg);
+
+/* Converts a stored (physical) state into the logical state it represents. */
+uint64_t quda_quantum_logical_state(uint64_t state, quantum_reg* qreg);
+
 /* Performs a measurement on the quantum register and stores the state
  * in 'retval' if non-NULL.
  * Masks any scratch-space off from 'retval' UNLESS 'scratch' is set (non-zero).
@@ -95,6 +296,23 @@ int quda_quantum_reg_measure_and_collapse(quantum_reg* qreg, uint64_t* retval);
  */
 int quda_quantum_range_measure_and_collapse(int start, int end, quantum_reg* reg,uint64_t* retval);
 
+/* Builds a sampler over the current states of the register without collapsing it.
+ * Masks any scratch-space off from sampled values UNLESS 'scratch' is set (non-zero).
+ * The sampler is a snapshot; later gates on the register do not affect it. A stabilizer or
+ * MPS register too wide to expand is cloned instead, and each draw measures the clone.
+ * Returns 0 on success, -1 if allocation fails.
+ */
+int quda_quantum_sampler_init(quantum_sampler* qs, quantum_reg* qreg, int scratch);
+
+/* Draws one measurement outcome from the sampler in O(log n) (or as one measurement of a
+ * cloned register) and stores it in 'retval'.
+ * Returns 0 on success, -2 on retval NULL, -1 if the sampler holds no probability.
+ */
+int quda_quantum_sampler_draw(quantum_sampler* qs, uint64_t* retval);
+
+/* Frees the given sampler's tables. */
+void quda_quantum_sampler_delete(quantum_sampler* qs);
+
 /* Measure 1 bit of a quantum register */
 int quda_quantum_bit_measure(int target, quantum_reg* qreg);
 
@@ -106,21 +324,67 @@ int quda_quantum_bit_measure(int target, quantum_reg* qreg);
  */
 int quda_quantum_bit_measure_and_collapse(int target, quantum_reg* qreg);
 
-/* Removes zero-amplitude states from the register. */
+/* Removes zero-amplitude states (and, if truncation is enabled, negligible states) from the
+ * register.
+ * Dense registers keep every state, so this (like enlarge, coalesce and trim) has no effect.
+ */
 void quda_quantum_reg_prune(quantum_reg* qreg);
 
 /* Attempts to lengthen the quantum register's arraylists by the value at 'amount'.
  * If 'amount' is NULL, attempts to double size.
  * Returns 0 on success or -1 if allocation fails.
- * Simultaneously prunes zero-amplitude states from the arraylist on copy.
+ * Simultaneously prunes zero-amplitude states from the arraylist (before it is resized).
  */
 int quda_quantum_reg_enlarge(quantum_reg* qreg,int amount);
 
+/* Applies the 2x2 unitary u (entry [out*2+in]) to the target bit of every state of a sparse
+ * register whose 'controls' bits are all set and 'anti_controls' bits all clear.
+ * States whose partner (the state with the target bit flipped) is already present are
+ * updated together in place, and only the others gain a new state. The buffer is therefore
+ * grown, in place where the allocator allows, to the final state count instead of twice the
+ * current one, and no duplicates are left to coalesce. A dirty register is coalesced first.
+ * Returns 0 on success or -1 if allocation fails (in which case the amplitudes are unchanged).
+ */
+int quda_quantum_reg_pair_apply(quantum_reg* qreg, uint64_t controls, uint64_t anti_controls,
+		int target, const complex_t* u);
+
 /* Attempts to merge any identical states present in the register.
+ * Renormalizes the register if its duplicates came from forcing bits (QUDA_DIRTY_RENORM).
  * Simultaneously prunes zero-amplitude states from the register.
  */
 void quda_quantum_reg_coalesce(quantum_reg* qreg);
 
+/* Sets how far a sparse register may grow past its size at the last coalesce before deferred
+ * coalescing is forced. Gates that can create duplicate states (hadamard, bit set/reset and
+ * clearing scratch) only mark the register dirty until then.
+ * Ratios of 1.0 or below (the default) coalesce after every such gate.
+ */
+void quda_quantum_reg_set_coalesce_ratio(quantum_reg* qreg, float ratio);
+
+/* Marks the register as possibly holding duplicate states and coalesces it if it has grown
+ * past its coalesce ratio. Called by operations that may create duplicates. Operations that
+ * are not unitary (forcing bits and clearing scratch) first add QUDA_DIRTY_RENORM to 'dirty',
+ * since merging their duplicates changes the norm.
+ */
+void quda_quantum_reg_defer_coalesce(quantum_reg* qreg);
+
+/* Applies any deferred work (factors, a stabilizer tableau or MPS, queued diagonal gates, a pending
+ * Pauli frame and duplicate states) so that the stored states are exactly the register's state and every
+ * state appears at most once.
+ * Measurement, sampling, renormalization and trimming flush automatically; code that reads
+ * 'states' directly should flush first.
+ * Returns 0 on success or -1 if allocation fails or the register cannot be expanded (a
+ * stabilizer register spanning over 2^30 states or an MPS register over 30 bits), in which
+ * case 'states' must not be read.
+ */
+int quda_quantum_reg_flush(quantum_reg* qreg);
+
+/* Flushes the register and rewrites its stored states so that every logical qubit is stored
+ * at its own index again, resetting the qubit map to the identity.
+ * Returns 0 on success or -1 if allocation fails (in which case only the flush happened).
+ */
+int quda_quantum_reg_materialize(quantum_reg* qreg);
+
 /* Resizes the register to free up any unused memory but preserves all current states.
  * Returns 0 on success, -1 on error (in which case no memory is freed).
  * First attempts to coalesce, which will also prune.
@@ -132,12 +396,38 @@ int quda_quantum_reg_trim(quantum_reg* qreg);
  */
 void quda_quantum_reg_renormalize(quantum_reg* qreg);
 
-/* Coaleses two amplitudes into the first, preserving the proper probability of both states.
+/* Coaleses two amplitudes of the same state into the first by adding them.
  * Writes QUDA_COMPLEX_ZERO into the 'toadd' amplitude and the resulting amplitude into 'dest'.
- * Returns 1 if other amplitudes will need to be renormalized due to this operation, 0 otherwise.
+ * Returns 1 if other amplitudes will need to be renormalized due to this operation, 0 otherwise
+ * (linear superposition preserves the norm, so this is currently always 0). Duplicates made by
+ * operations that are not unitary are renormalized by their callers instead.
  */
 int quda_amplitude_coalesce(complex_t* dest, complex_t* toadd);
 
+/* Bulk amplitude kernels over 'count' states, written as plain loops the compiler can
+ * vectorize. mask_mul multiplies only the states whose 'mask' bits equal 'value'.
+ */
+void quda_states_scale(quantum_state_t* s, int count, quda_float_t f);
+void quda_states_mul(quantum_state_t* s, int count, complex_t c);
+void quda_states_mask_mul(quantum_state_t* s, int count, uint64_t mask, uint64_t value,
+		complex_t c);
+
+/* Deterministic reductions over an array of states. prob returns the sum of the
+ * probabilities of the states whose 'mask' bits equal 'value', parity that of the states
+ * whose 'mask' bits have parity 'value' (0 or 1), and norm that of all of them; select
+ * returns the index of the state the cumulative probability 'f' falls in, or -1 if the total
+ * is below 'f'. The states are summed in order within fixed blocks of 1024 and the block
+ * sums are added pairwise, with large halves of the tree run as OpenMP tasks, so the results
+ * are bit-identical for any number of threads. select descends the same tree, so it agrees
+ * with prob about which state 'f' lands in. Sums accumulate in quda_accum_t.
+ */
+quda_accum_t quda_states_prob(const quantum_state_t* s, int count, uint64_t mask,
+		uint64_t value);
+quda_accum_t quda_states_parity(const quantum_state_t* s, int count, uint64_t mask,
+		int value);
+quda_accum_t quda_states_norm(const quantum_state_t* s, int count);
+int quda_states_select(const quantum_state_t* s, int count, quda_accum_t f);
+
 /* Generates a float in the range [0,1) */
 // TODO: Look at performance implications of using 'double' here
 float quda_rand_float();
@@ -0,0 +1,423 @@
+/* quantum_shard.c: registers sharded across processes
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "quantum_shard.h"
+#include "quantum_dense.h"
+#include "complex.h"
+
+#define QUDA_SHARD_CHUNK 1024   // amplitudes exchanged per send/receive pair (2^10)
+#define QUDA_SHARD_RING 2048    // amplitudes a ring buffer holds
+
+/* One-way channel between two processes. Only the sender advances 'head' and only the
+ * receiver advances 'tail'; both count amplitudes since the link was opened and sit on
+ * cache lines of their own.
+ */
+typedef struct quantum_shard_ring {
+	uint64_t head;
+	char pad0[56];
+	uint64_t tail;
+	char pad1[56];
+	complex_t data[QUDA_SHARD_RING];
+} quantum_shard_ring;
+
+// State shared by all processes, followed in the mapping by the rings
+typedef struct quantum_shard_header {
+	int ready;  // processes that hold their shard
+	int failed; // processes that could not allocate it
+	int closed; // set once a process has been lost, after which every transfer fails
+	int finished[1 << QUDA_SHARD_MAX_BITS]; // workers that exit from quda_shard_finish()
+	char pad[128 - (3 + (1 << QUDA_SHARD_MAX_BITS))*sizeof(int)];
+} quantum_shard_header;
+
+typedef struct quantum_shard_link {
+	void* map;
+	size_t map_size;
+	quantum_shard_header* header;
+	quantum_shard_ring* rings; // the ring from process a to process b is rings[a*2^bits+b]
+	pid_t workers[1 << QUDA_SHARD_MAX_BITS]; // workers[0] is rank 0, and reaped workers are -1
+} quantum_shard_link;
+
+static quantum_shard_ring* quda_shard_ring(quantum_shard_t* shard, int from, int to) {
+	quantum_shard_link* link = shard->link;
+	return &link->rings[(from << shard->bits) + to];
+}
+
+/* Checks, while waiting on a ring, whether any process has been lost. Rank 0 reaps workers
+ * that exited outside quda_shard_finish() and workers watch for rank 0 going away; either
+ * closes the link for everyone. Returns 1 if the link is closed.
+ */
+static int quda_shard_closed(quantum_shard_t* shard) {
+	quantum_shard_link* link = shard->link;
+	if(__atomic_load_n(&link->header->closed,__ATOMIC_ACQUIRE)) return 1;
+
+	int lost = 0;
+	if(shard->rank == 0) {
+		int i;
+		for(i=1;i<(1 << shard->bits);i++) {
+			if(link->workers[i] != -1 && waitpid(link->workers[i],NULL,WNOHANG) == link->workers[i]) {
+				link->workers[i] = -1;
+				lost |= !__atomic_load_n(&link->header->finished[i],__ATOMIC_ACQUIRE);
+			}
+		}
+	} else {
+		lost = getppid() != link->workers[0];
+	}
+	if(lost) {
+		__atomic_store_n(&link->header->closed,1,__ATOMIC_RELEASE);
+	}
+	return lost;
+}
+
+static int quda_shard_shm_send(quantum_shard_t* shard, int peer, const complex_t* data,
+		int count) {
+	quantum_shard_ring* ring = quda_shard_ring(shard,shard->rank,peer);
+	uint64_t head = ring->head;
+	while(count > 0) {
+		uint64_t space = QUDA_SHARD_RING - (head - __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE));
+		if(space == 0) {
+			if(quda_shard_closed(shard)) return -1;
+			sched_yield();
+			continue;
+		}
+
+		int i,n = (space < (uint64_t)count) ? (int)space : count;
+		for(i=0;i<n;i++) {
+			ring->data[(head+i) % QUDA_SHARD_RING] = data[i];
+		}
+		head += n;
+		__atomic_store_n(&ring->head,head,__ATOMIC_RELEASE);
+		data += n;
+		count -= n;
+	}
+	return 0;
+}
+
+static int quda_shard_shm_recv(quantum_shard_t* shard, int peer, complex_t* data, int count) {
+	quantum_shard_ring* ring = quda_shard_ring(shard,peer,shard->rank);
+	uint64_t tail = ring->tail;
+	while(count > 0) {
+		uint64_t ready = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE) - tail;
+		if(ready == 0) {
+			// A peer may write its last amplitudes and exit, so the ring is checked again
+			if(quda_shard_closed(shard) && __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE) == tail) {
+				return -1;
+			}
+			sched_yield();
+			continue;
+		}
+
+		int i,n = (ready < (uint64_t)count) ? (int)ready : count;
+		for(i=0;i<n;i++) {
+			data[i] = ring->data[(tail+i) % QUDA_SHARD_RING];
+		}
+		tail += n;
+		__atomic_store_n(&ring->tail,tail,__ATOMIC_RELEASE);
+		data += n;
+		count -= n;
+	}
+	return 0;
+}
+
+static void quda_shard_shm_close(quantum_shard_t* shard) {
+	quantum_shard_link* link = shard->link;
+	munmap(link->map,link->map_size);
+	free(link);
+}
+
+/* Maps a fresh shared-memory object holding the start-up header and every ring. The name
+ * is unlinked at once: the mapping is passed on to the workers by fork().
+ */
+static quantum_shard_link* quda_shard_shm_open(int bits) {
+	static int opened = 0;
+	char name[64];
+	snprintf(name,sizeof(name),"/quda-shard-%ld-%d",(long)getpid(),opened++);
+
+	quantum_shard_link* link = malloc(sizeof(quantum_shard_link));
+	if(link == NULL) {
+		return NULL;
+	}
+	link->map_size = sizeof(quantum_shard_header) + ((size_t)1 << 2*bits)*sizeof(quantum_shard_ring);
+
+	int fd = shm_open(name,O_RDWR | O_CREAT | O_EXCL,0600);
+	if(fd == -1) {
+		free(link);
+		return NULL;
+	}
+	shm_unlink(name);
+	if(ftruncate(fd,link->map_size) == -1) {
+		close(fd);
+		free(link);
+		return NULL;
+	}
+	link->map = mmap(NULL,link->map_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if(link->map == MAP_FAILED) {
+		free(link);
+		return NULL;
+	}
+
+	// A new object reads as zeros, so every ring starts out empty
+	link->header = link->map;
+	link->rings = (quantum_shard_ring*)(link->header + 1);
+	return link;
+}
+
+/* Builds the process's shard from the register's (coalesced) states. Returns the shard's
+ * amplitudes or NULL if allocation fails.
+ */
+static quantum_state_t* quda_shard_slice(quantum_reg* qreg, int rank, int high) {
+	uint64_t count = (uint64_t)1 << high;
+	uint64_t base = (uint64_t)rank << high;
+	quantum_state_t* s = malloc(count*sizeof(quantum_state_t));
+	if(s == NULL) {
+		return NULL;
+	}
+
+	uint64_t j;
+	for(j=0;j<count;j++) {
+		s[j].state = base | j;
+		s[j].amplitude = QUDA_COMPLEX_ZERO;
+	}
+	int i;
+	for(i=0;i<qreg->num_states;i++) {
+		if((qreg->states[i].state >> high) == (uint64_t)rank) {
+			s[qreg->states[i].state - base].amplitude = qreg->states[i].amplitude;
+		}
+	}
+	return s;
+}
+
+/* Waits for the workers that have not been reaped yet to exit */
+static void quda_shard_reap(quantum_shard_t* shard) {
+	quantum_shard_link* link = shard->link;
+	int i;
+	for(i=1;i<(1 << shard->bits);i++) {
+		if(link->workers[i] != -1) {
+			waitpid(link->workers[i],NULL,0);
+		}
+	}
+}
+
+int quda_shard_start(quantum_reg* qreg, int bits) {
+	int n = qreg->qubits + qreg->scratch;
+	if(bits < 1 || bits > QUDA_SHARD_MAX_BITS || bits > n || n - bits > 30) return -1;
+	if(qreg->repr == QUDA_REPR_SHARDED) return -1;
+
+	// Gates on a sharded register bypass flags, so everything deferred is applied first
+	quda_quantum_reg_set_flags(qreg,0);
+	if(qreg->flags != 0) return -1;
+	if(quda_quantum_reg_set_repr(qreg,QUDA_REPR_SPARSE) == -1) return -1;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+	if(qreg->dirty) {
+		quda_quantum_reg_coalesce(qreg);
+	}
+
+	quantum_shard_t* shard = malloc(sizeof(quantum_shard_t));
+	if(shard == NULL) {
+		return -1;
+	}
+	shard->bits = bits;
+	shard->send = quda_shard_shm_send;
+	shard->recv = quda_shard_shm_recv;
+	shard->close = quda_shard_shm_close;
+	shard->link = quda_shard_shm_open(bits);
+	if(shard->link == NULL) {
+		free(shard);
+		return -1;
+	}
+	quantum_shard_link* link = shard->link;
+
+	// Output still buffered would otherwise be written once per process
+	fflush(NULL);
+	int rank,forked;
+	shard->rank = 0;
+	link->workers[0] = getpid();
+	for(forked=1;forked<(1 << bits);forked++) {
+		pid_t pid = fork();
+		if(pid == 0) {
+			shard->rank = forked;
+			#ifdef _OPENMP
+			// The OpenMP thread pool does not survive fork(), so workers run on one thread
+			omp_set_num_threads(1);
+			#endif
+			break;
+		}
+		if(pid == -1) {
+			__atomic_fetch_add(&link->header->failed,(1 << bits) - forked,__ATOMIC_RELEASE);
+			break;
+		}
+		link->workers[forked] = pid;
+	}
+	rank = shard->rank;
+
+	// Every process allocates (and so first touches) its own shard, then waits for the others
+	int high = n - bits;
+	quantum_state_t* s = quda_shard_slice(qreg,rank,high);
+	__atomic_fetch_add((s != NULL) ? &link->header->ready : &link->header->failed,1,
+			__ATOMIC_RELEASE);
+	while(__atomic_load_n(&link->header->ready,__ATOMIC_ACQUIRE)
+			+ __atomic_load_n(&link->header->failed,__ATOMIC_ACQUIRE) < (1 << bits)) {
+		sched_yield();
+	}
+
+	if(__atomic_load_n(&link->header->failed,__ATOMIC_ACQUIRE) > 0) {
+		if(rank != 0) {
+			_exit(0);
+		}
+		free(s);
+		int i;
+		for(i=1;i<forked;i++) {
+			waitpid(link->workers[i],NULL,0);
+		}
+		shard->close(shard);
+		free(shard);
+		return -1;
+	}
+
+	free(qreg->states);
+	qreg->states = s;
+	qreg->size = 1 << high;
+	qreg->num_states = 1 << high;
+	qreg->coalesced_states = qreg->num_states;
+	qreg->repr = QUDA_REPR_SHARDED;
+	qreg->shard = shard;
+	return rank;
+}
+
+int quda_shard_apply(quantum_gate_t* gate) {
+	quantum_reg* qreg = gate->reg;
+	quantum_shard_t* shard = qreg->shard;
+	int high = qreg->qubits + qreg->scratch - shard->bits;
+	uint64_t low = ((uint64_t)1 << high) - 1;
+	uint64_t base = (uint64_t)shard->rank << high;
+
+	complex_t u[4];
+	uint64_t controls,lo,hi;
+	if(!quda_dense_pair_matrix(gate,u,&controls,&lo,&hi) || !((lo | hi) & ~low)) {
+		quda_dense_apply_partition(qreg->states,gate,base,high);
+		return 1;
+	}
+
+	// The shard's bits decide which role its states take, if any, and who holds the partners
+	uint64_t pair = lo | hi;
+	if((base & controls & ~low) != (controls & ~low)) return 1;
+	int r;
+	if((base & pair & ~low) == (lo & ~low)) {
+		r = 0;
+	} else if((base & pair & ~low) == (hi & ~low)) {
+		r = 1;
+	} else {
+		return 1;
+	}
+	int partner = shard->rank ^ (int)((pair & ~low) >> high);
+
+	/* Both shards visit their paired states in increasing order, which matches each state
+	 * with its partner's, and trade them a chunk at a time.
+	 */
+	uint64_t fixed = (controls | pair) & low;
+	uint64_t set = (controls | (r ? hi : lo)) & low;
+	uint64_t count = (uint64_t)1 << (high - __builtin_popcountll(fixed));
+	complex_t out[QUDA_SHARD_CHUNK], in[QUDA_SHARD_CHUNK];
+	uint64_t k;
+	for(k=0;k<count;k+=QUDA_SHARD_CHUNK) {
+		int i,n = (count - k < QUDA_SHARD_CHUNK) ? (int)(count - k) : QUDA_SHARD_CHUNK;
+		for(i=0;i<n;i++) {
+			out[i] = qreg->states[quda_dense_insert_zeros(k+i,fixed) | set].amplitude;
+		}
+		if(shard->send(shard,partner,out,n) == -1 || shard->recv(shard,partner,in,n) == -1) {
+			return -1;
+		}
+		for(i=0;i<n;i++) {
+			qreg->states[quda_dense_insert_zeros(k+i,fixed) | set].amplitude = quda_complex_add(
+					quda_complex_mul(u[r*2+r],out[i]),quda_complex_mul(u[r*2+1-r],in[i]));
+		}
+	}
+	return 1;
+}
+
+int quda_shard_finish(quantum_reg* qreg) {
+	quantum_shard_t* shard = qreg->shard;
+	int n = qreg->qubits + qreg->scratch;
+	int high = n - shard->bits;
+	int chunk = (high < 10) ? 1 << high : QUDA_SHARD_CHUNK;
+	complex_t buffer[QUDA_SHARD_CHUNK];
+	uint64_t j;
+	int i;
+
+	if(shard->rank != 0) {
+		if(n <= 30) {
+			for(j=0;j<((uint64_t)1 << high);j+=chunk) {
+				for(i=0;i<chunk;i++) {
+					buffer[i] = qreg->states[j+i].amplitude;
+				}
+				if(shard->send(shard,0,buffer,chunk) == -1) {
+					_exit(0);
+				}
+			}
+		}
+		quantum_shard_link* link = shard->link;
+		__atomic_store_n(&link->header->finished[shard->rank],1,__ATOMIC_RELEASE);
+		_exit(0);
+	}
+
+	quantum_state_t* temp_states = NULL;
+	if(n <= 30) {
+		temp_states = realloc(qreg->states,((size_t)1 << n)*sizeof(quantum_state_t));
+	}
+	int status = -1;
+	if(temp_states != NULL) {
+		// Rank 0's amplitudes are already in place
+		qreg->states = temp_states;
+		qreg->size = 1 << n;
+		qreg->num_states = 1 << n;
+		status = 0;
+	}
+	if(n <= 30) {
+		// The workers block until their rings are drained, so they are read even on failure
+		int w;
+		for(w=1;w<(1 << shard->bits);w++) {
+			quantum_state_t* s = (status == 0) ? qreg->states + ((uint64_t)w << high) : NULL;
+			for(j=0;j<((uint64_t)1 << high);j+=chunk) {
+				if(shard->recv(shard,w,buffer,chunk) == -1) {
+					// Only rank 0's amplitudes are kept
+					qreg->num_states = 1 << high;
+					status = -1;
+					break;
+				}
+				for(i=0;s != NULL && i<chunk;i++) {
+					s[j+i].state = ((uint64_t)w << high) | (j+i);
+					s[j+i].amplitude = buffer[i];
+				}
+			}
+		}
+	}
+
+	quda_shard_reap(shard);
+	quda_shard_delete(qreg);
+	qreg->repr = (status == 0) ? QUDA_REPR_DENSE : QUDA_REPR_SPARSE;
+	qreg->coalesced_states = qreg->num_states;
+	if(status == -1) {
+		quda_quantum_reg_prune(qreg);
+	}
+	return status;
+}
+
+void quda_shard_delete(quantum_reg* qreg) {
+	if(qreg->shard == NULL) return;
+	qreg->shard->close(qreg->shard);
+	free(qreg->shard);
+	qreg->shard = NULL;
+}
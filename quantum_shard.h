@@ -0,0 +1,60 @@
+/* quantum_shard.h: header for registers sharded across processes
+*/
+
+#ifndef __QUDA_QUANTUM_SHARD_H
+#define __QUDA_QUANTUM_SHARD_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+#define QUDA_SHARD_MAX_BITS 4 // a register is split over at most 2^4 processes
+
+/* A sharded register (QUDA_REPR_SHARDED) of n bits is split by its top 'bits' bits over
+ * 2^bits processes that all run the same program and apply the same gates. The process with
+ * rank r holds, in order, the 2^(n-bits) amplitudes whose top bits equal r, so that
+ * states[j].state == (r << (n-bits)) | j. Gates on the lower bits run on every shard
+ * independently; gates on the top bits pair each shard with one partner, and the two stream
+ * each other the amplitudes they need through the link's send and receive calls.
+ * The link set up by quda_shard_start() connects processes forked on one host through ring
+ * buffers in POSIX shared memory. Another transport only needs to provide the same calls.
+ */
+typedef struct quantum_shard_t {
+	int rank;
+	int bits;
+	/* Block until 'count' amplitudes have been handed to or taken from process 'peer'.
+	 * Return 0 on success or -1 once any process of the register has been lost.
+	 */
+	int (*send)(struct quantum_shard_t* shard, int peer, const complex_t* data, int count);
+	int (*recv)(struct quantum_shard_t* shard, int peer, complex_t* data, int count);
+	void (*close)(struct quantum_shard_t* shard); // releases 'link'
+	void* link;
+} quantum_shard_t;
+
+/* Splits the register over 2^bits processes by forking 2^bits - 1 workers, which return
+ * from this call like the caller and must apply the same gates. Pending work, flags and
+ * factors are applied or joined first, and each process keeps only its own amplitudes.
+ * Only the gates of quantum_gates.h (and quda_shard_finish()) may be used on the register
+ * until it is finished. Workers run OpenMP regions on one thread, since the runtime's
+ * thread pool is not inherited across fork().
+ * Returns the process's rank (0 in the caller) or -1 on failure, in which case no workers
+ * remain and the register holds its previous state.
+ */
+int quda_shard_start(quantum_reg* qreg, int bits);
+
+/* Applies a gate to the process's shard, exchanging amplitudes with its partner if needed.
+ * Returns 1 on success or -1 if the link fails, for instance because a process exited or was
+ * killed, after which every exchange on the register fails.
+ */
+int quda_shard_apply(quantum_gate_t* gate);
+
+/* Gathers a sharded register into the process of rank 0 as a dense register and ends the
+ * workers: this call does not return in them. Registers over 30 bits cannot be gathered.
+ * Returns 0 on success or -1 on failure, in which case the register keeps only rank 0's
+ * amplitudes and is no longer sharded.
+ */
+int quda_shard_finish(quantum_reg* qreg);
+
+/* Closes the register's link (without ending any processes) */
+void quda_shard_delete(quantum_reg* qreg);
+
+#endif // __QUDA_QUANTUM_SHARD_H
@@ -0,0 +1,361 @@
+/* quantum_stabilizer.c: stabilizer tableau representation
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "quantum_stabilizer.h"
+#include "complex.h"
+
+/* Pauli rows store their phase as a power of i, so negation is r ^= 2 */
+
+/* Returns the power of i picked up when multiplying the single-qubit Paulis of p by those
+ * of q bit by bit (p on the left), using P(1,1) = Y.
+ */
+static int quda_pauli_product_phase(const quantum_pauli_t* p, const quantum_pauli_t* q) {
+	uint64_t x1 = p->x, z1 = p->z, x2 = q->x, z2 = q->z;
+	uint64_t plus = (x1 & z1 & z2 & ~x2) | (x1 & ~z1 & z2 & x2) | (~x1 & z1 & x2 & ~z2);
+	uint64_t minus = (x1 & z1 & x2 & ~z2) | (x1 & ~z1 & z2 & ~x2) | (~x1 & z1 & x2 & z2);
+	return __builtin_popcountll(plus) - __builtin_popcountll(minus);
+}
+
+/* Left-multiplies row h by row i */
+static void quda_pauli_mul(quantum_pauli_t* h, const quantum_pauli_t* i) {
+	h->r = (h->r + i->r + quda_pauli_product_phase(i,h)) & 3;
+	h->x ^= i->x;
+	h->z ^= i->z;
+}
+
+static int quda_stabilizer_bits(quantum_reg* qreg) {
+	return qreg->qubits + qreg->scratch;
+}
+
+int quda_stabilizer_init(quantum_reg* qreg, uint64_t state) {
+	int n = quda_stabilizer_bits(qreg);
+	quantum_pauli_t* tableau = realloc(qreg->tableau,(2*n+1)*sizeof(quantum_pauli_t));
+	if(tableau == NULL) {
+		return -1;
+	}
+	qreg->tableau = tableau;
+
+	int i;
+	memset(tableau,0,(2*n+1)*sizeof(quantum_pauli_t));
+	for(i=0;i<n;i++) {
+		tableau[i].x = (uint64_t)1 << i;
+		tableau[n+i].z = (uint64_t)1 << i;
+		tableau[n+i].r = ((state >> i) & 1) ? 2 : 0;
+	}
+	return 0;
+}
+
+int quda_stabilizer_enter(quantum_reg* qreg) {
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+
+	int i,found = -1;
+	for(i=0;i<qreg->num_states;i++) {
+		if(!quda_complex_eq(qreg->states[i].amplitude,QUDA_COMPLEX_ZERO)) {
+			if(found >= 0) return -1;
+			found = i;
+		}
+	}
+	if(found < 0) return -1;
+
+	if(quda_stabilizer_init(qreg,qreg->states[found].state) == -1) return -1;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// The dense index space is no longer needed
+		quda_quantum_reg_set_repr(qreg,QUDA_REPR_SPARSE);
+	}
+	qreg->repr = QUDA_REPR_STABILIZER;
+	return 0;
+}
+
+int quda_stabilizer_leave(quantum_reg* qreg) {
+	if(qreg->repr != QUDA_REPR_STABILIZER) return 0;
+
+	int n = quda_stabilizer_bits(qreg);
+	quantum_pauli_t* s = malloc((n+1)*sizeof(quantum_pauli_t));
+	if(s == NULL) {
+		return -1;
+	}
+	memcpy(s,qreg->tableau+n,n*sizeof(quantum_pauli_t));
+
+	/* Gaussian elimination: generators with an X part first, in echelon form over X, then
+	 * the Z-only generators in reduced echelon form over Z.
+	 */
+	int row = 0;
+	int i,j,k;
+	for(j=0;j<n;j++) {
+		uint64_t bit = (uint64_t)1 << j;
+		for(k=row;k<n && !(s[k].x & bit);k++);
+		if(k == n) continue;
+		quantum_pauli_t temp = s[row];
+		s[row] = s[k];
+		s[k] = temp;
+		for(i=0;i<n;i++) {
+			if(i != row && (s[i].x & bit)) quda_pauli_mul(&s[i],&s[row]);
+		}
+		row++;
+	}
+	int g = row;
+	for(j=0;j<n;j++) {
+		uint64_t bit = (uint64_t)1 << j;
+		for(k=row;k<n && !(s[k].z & bit);k++);
+		if(k == n) continue;
+		quantum_pauli_t temp = s[row];
+		s[row] = s[k];
+		s[k] = temp;
+		for(i=g;i<n;i++) {
+			if(i != row && (s[i].z & bit)) quda_pauli_mul(&s[i],&s[row]);
+		}
+		row++;
+	}
+
+	if(g > 30) {
+		free(s);
+		return -1;
+	}
+	int count = 1 << g;
+	if(count > qreg->size) {
+		quantum_state_t* temp_states = realloc(qreg->states,count*sizeof(quantum_state_t));
+		if(temp_states == NULL) {
+			free(s);
+			return -1;
+		}
+		qreg->states = temp_states;
+		qreg->size = count;
+	}
+
+	/* Seed: a basis state |b> satisfying every Z-only generator, found by fixing each one's
+	 * lowest bit from the last generator up.
+	 */
+	uint64_t b = 0;
+	for(i=n-1;i>=g;i--) {
+		if(((s[i].r >> 1) + __builtin_popcountll(s[i].z & b)) & 1) {
+			b ^= s[i].z & -s[i].z;
+		}
+	}
+
+	/* The state is the sum of every product of the X generators applied to |b>. Walking the
+	 * products in Gray code order changes one generator per step.
+	 */
+	quantum_pauli_t* p = &s[n];
+	p->x = b;
+	p->z = 0;
+	p->r = 0;
+	quda_float_t k0 = 1.0/sqrt(count);
+	int t;
+	for(t=0;t<count;t++) {
+		if(t > 0) {
+			int changed = __builtin_ctz(t);
+			quda_pauli_mul(p,&s[changed]);
+		}
+		// P|0> picks up i for every Y
+		int phase = (p->r + __builtin_popcountll(p->x & p->z)) & 3;
+		complex_t a = { .real = 0, .imag = 0 };
+		switch(phase) {
+			case 0: a.real = k0; break;
+			case 1: a.imag = k0; break;
+			case 2: a.real = -k0; break;
+			case 3: a.imag = -k0; break;
+		}
+		qreg->states[t].state = p->x;
+		qreg->states[t].amplitude = a;
+	}
+	free(s);
+
+	free(qreg->tableau);
+	qreg->tableau = NULL;
+	qreg->num_states = count;
+	qreg->repr = QUDA_REPR_SPARSE;
+	qreg->dirty = 0;
+	qreg->coalesced_states = count;
+	return 0;
+}
+
+/* Tableau updates for the generating gates, applied to every row */
+static void quda_stabilizer_hadamard(quantum_reg* qreg, uint64_t a) {
+	int i;
+	for(i=0;i<2*quda_stabilizer_bits(qreg);i++) {
+		quantum_pauli_t* p = &qreg->tableau[i];
+		if((p->x & a) && (p->z & a)) p->r ^= 2;
+		if(((p->x & a) != 0) != ((p->z & a) != 0)) {
+			p->x ^= a;
+			p->z ^= a;
+		}
+	}
+}
+
+static void quda_stabilizer_phase(quantum_reg* qreg, uint64_t a) {
+	int i;
+	for(i=0;i<2*quda_stabilizer_bits(qreg);i++) {
+		quantum_pauli_t* p = &qreg->tableau[i];
+		if((p->x & a) && (p->z & a)) p->r ^= 2;
+		if(p->x & a) p->z ^= a;
+	}
+}
+
+static void quda_stabilizer_cnot(quantum_reg* qreg, uint64_t a, uint64_t b) {
+	int i;
+	for(i=0;i<2*quda_stabilizer_bits(qreg);i++) {
+		quantum_pauli_t* p = &qreg->tableau[i];
+		int xa = (p->x & a) != 0, za = (p->z & a) != 0;
+		int xb = (p->x & b) != 0, zb = (p->z & b) != 0;
+		if(xa && zb && (xb == za)) p->r ^= 2;
+		if(xa) p->x ^= b;
+		if(zb) p->z ^= a;
+	}
+}
+
+/* Conjugates every row by the Pauli X^x Z^z */
+static void quda_stabilizer_pauli(quantum_reg* qreg, uint64_t x, uint64_t z) {
+	int i;
+	for(i=0;i<2*quda_stabilizer_bits(qreg);i++) {
+		quantum_pauli_t* p = &qreg->tableau[i];
+		if((__builtin_popcountll(p->z & x) + __builtin_popcountll(p->x & z)) & 1) p->r ^= 2;
+	}
+}
+
+static void quda_stabilizer_swap(quantum_reg* qreg, uint64_t a, uint64_t b) {
+	int i;
+	for(i=0;i<2*quda_stabilizer_bits(qreg);i++) {
+		quantum_pauli_t* p = &qreg->tableau[i];
+		if(((p->x & a) != 0) != ((p->x & b) != 0)) p->x ^= a | b;
+		if(((p->z & a) != 0) != ((p->z & b) != 0)) p->z ^= a | b;
+	}
+}
+
+int quda_stabilizer_apply(quantum_gate_t* gate) {
+	int op,target1,target2;
+	uint64_t controls;
+	quda_gate_decompose(gate,&op,&controls,&target1,&target2);
+
+	if(op == QUDA_OP_ROTATE_K && gate->k == 1) op = QUDA_OP_PAULI_Z;
+	if(op == QUDA_OP_ROTATE_K && gate->k == 2) op = QUDA_OP_PHASE;
+
+	quantum_reg* qreg = gate->reg;
+	uint64_t t = (uint64_t)1 << target1;
+	if(controls == 0) {
+		switch(op) {
+			case QUDA_OP_HADAMARD: quda_stabilizer_hadamard(qreg,t); return 1;
+			case QUDA_OP_PHASE: quda_stabilizer_phase(qreg,t); return 1;
+			case QUDA_OP_PAULI_X: quda_stabilizer_pauli(qreg,t,0); return 1;
+			case QUDA_OP_PAULI_Y: quda_stabilizer_pauli(qreg,t,t); return 1;
+			case QUDA_OP_PAULI_Z: quda_stabilizer_pauli(qreg,0,t); return 1;
+			case QUDA_OP_SWAP:
+				quda_stabilizer_swap(qreg,t,(uint64_t)1 << target2);
+				return 1;
+		}
+		return 0;
+	}
+	if(controls & (controls-1)) return 0;
+
+	switch(op) {
+		case QUDA_OP_PAULI_X:
+			quda_stabilizer_cnot(qreg,controls,t);
+			return 1;
+		case QUDA_OP_PAULI_Z:
+			quda_stabilizer_hadamard(qreg,t);
+			quda_stabilizer_cnot(qreg,controls,t);
+			quda_stabilizer_hadamard(qreg,t);
+			return 1;
+		case QUDA_OP_PAULI_Y:
+			// The repository's Y is -Y, so controlled-Y is Z on the control times S CNOT S^-1
+			quda_stabilizer_phase(qreg,t);
+			quda_stabilizer_pauli(qreg,0,t);
+			quda_stabilizer_cnot(qreg,controls,t);
+			quda_stabilizer_phase(qreg,t);
+			quda_stabilizer_pauli(qreg,0,controls);
+			return 1;
+	}
+	return 0;
+}
+
+int quda_stabilizer_measure(quantum_reg* qreg, int bit, int collapse) {
+	int n = quda_stabilizer_bits(qreg);
+	quantum_pauli_t* tableau = qreg->tableau;
+	uint64_t a = (uint64_t)1 << bit;
+	int i,p;
+
+	// A stabilizer generator anticommuting with Z on the bit makes the outcome random
+	for(p=n;p<2*n && !(tableau[p].x & a);p++);
+	if(p < 2*n) {
+		int outcome = (quda_rand_float() < 0.5f) ? 0 : 1;
+		if(!collapse) return outcome;
+
+		for(i=0;i<2*n;i++) {
+			if(i != p && (tableau[i].x & a)) quda_pauli_mul(&tableau[i],&tableau[p]);
+		}
+		tableau[p-n] = tableau[p];
+		tableau[p].x = 0;
+		tableau[p].z = a;
+		tableau[p].r = outcome ? 2 : 0;
+		return outcome;
+	}
+
+	// Otherwise Z on the bit is (up to sign) a product of the generators
+	quantum_pauli_t* scratch = &tableau[2*n];
+	scratch->x = 0;
+	scratch->z = 0;
+	scratch->r = 0;
+	for(i=0;i<n;i++) {
+		if(tableau[i].x & a) quda_pauli_mul(scratch,&tableau[n+i]);
+	}
+	return (scratch->r & 2) ? 1 : 0;
+}
+
+int quda_stabilizer_sample(quantum_reg* qreg, uint64_t* retval) {
+	int n = quda_stabilizer_bits(qreg);
+	quantum_pauli_t* copy = malloc((2*n+1)*sizeof(quantum_pauli_t));
+	if(copy == NULL) {
+		return -1;
+	}
+	memcpy(copy,qreg->tableau,(2*n+1)*sizeof(quantum_pauli_t));
+
+	quantum_pauli_t* tableau = qreg->tableau;
+	qreg->tableau = copy;
+	uint64_t state = 0;
+	int i;
+	for(i=0;i<n;i++) {
+		state |= (uint64_t)quda_stabilizer_measure(qreg,i,1) << i;
+	}
+	qreg->tableau = tableau;
+	free(copy);
+
+	*retval = state;
+	return 0;
+}
+
+int quda_stabilizer_add_bits(quantum_reg* qreg, int n) {
+	int old = quda_stabilizer_bits(qreg);
+	int bits = old+n;
+	quantum_pauli_t* tableau = calloc(2*bits+1,sizeof(quantum_pauli_t));
+	if(tableau == NULL) {
+		return -1;
+	}
+
+	// Existing rows keep acting as the identity on the new bits, which start out as |0>
+	int i;
+	for(i=0;i<old;i++) {
+		tableau[i] = qreg->tableau[i];
+		tableau[bits+i] = qreg->tableau[old+i];
+	}
+	for(i=old;i<bits;i++) {
+		tableau[i].x = (uint64_t)1 << i;
+		tableau[bits+i].z = (uint64_t)1 << i;
+	}
+
+	free(qreg->tableau);
+	qreg->tableau = tableau;
+	return 0;
+}
+
+int quda_stabilizer_copy(quantum_reg* dest, quantum_reg* src) {
+	int n = quda_stabilizer_bits(src);
+	quantum_pauli_t* tableau = malloc((2*n+1)*sizeof(quantum_pauli_t));
+	if(tableau == NULL) {
+		return -1;
+	}
+	memcpy(tableau,src->tableau,(2*n+1)*sizeof(quantum_pauli_t));
+	dest->tableau = tableau;
+	return 0;
+}
@@ -0,0 +1,59 @@
+/* quantum_stabilizer.h: header for the stabilizer tableau representation
+*/
+
+#ifndef __QUDA_QUANTUM_STABILIZER_H
+#define __QUDA_QUANTUM_STABILIZER_H
+
+#include "quantum_reg.h"
+#include "quantum_dispatch.h"
+
+/* A stabilizer register (QUDA_REPR_STABILIZER) of n bits holds an Aaronson-Gottesman (CHP)
+ * tableau of 2n+1 Paulis in 'tableau': n destabilizers, n stabilizer generators and one
+ * scratch row. Clifford gates update it in O(n) and measurements in O(n^2).
+ * Stabilizer states are only tracked up to a global phase.
+ */
+
+/* Sets the tableau to the basis state 'state', allocating it if needed.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_stabilizer_init(quantum_reg* qreg, uint64_t state);
+
+/* Converts a register holding a single basis state to the stabilizer representation.
+ * Returns 0 on success or -1 if the register is in a superposition or allocation fails.
+ */
+int quda_stabilizer_enter(quantum_reg* qreg);
+
+/* Converts a stabilizer register to the sparse representation. The state is expanded from
+ * the tableau with its first amplitude real and positive.
+ * Returns 0 on success (or if the register is not a stabilizer register) or -1 if
+ * allocation fails, in which case the register is unchanged.
+ */
+int quda_stabilizer_leave(quantum_reg* qreg);
+
+/* Applies a Clifford gate (hadamard, phase, the Paulis, swap, controlled-not, controlled-y,
+ * controlled-z and rotate_k for k <= 2) to the tableau and returns 1. Returns 0 for any
+ * other gate without changing the register.
+ */
+int quda_stabilizer_apply(quantum_gate_t* gate);
+
+/* Measures one bit of a stabilizer register. If 'collapse' is set the register collapses
+ * to the outcome, otherwise it is left unchanged. Returns the outcome.
+ */
+int quda_stabilizer_measure(quantum_reg* qreg, int bit, int collapse);
+
+/* Measures every bit of a stabilizer register without collapsing it and stores the
+ * physical state in 'retval'. Returns 0 on success or -1 if allocation fails.
+ */
+int quda_stabilizer_sample(quantum_reg* qreg, uint64_t* retval);
+
+/* Adds n bits in state |0> above the register's current bits.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_stabilizer_add_bits(quantum_reg* qreg, int n);
+
+/* Gives 'dest' a copy of the tableau of 'src', which must have the same number of bits.
+ * Returns 0 on success or -1 if allocation fails.
+ */
+int quda_stabilizer_copy(quantum_reg* dest, quantum_reg* src);
+
+#endif // __QUDA_QUANTUM_STABILIZER_H
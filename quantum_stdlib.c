@@ -2,43 +2,55 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 #include "quantum_stdlib.h"
 #include "quantum_gates.h"
 #include "complex.h"
 
 //#define QUDA_STDLIB_DEBUG
-#define QUDA_CFE_STEP 0.000005
-#define QUDA_FLOAT_ERR 1e-7
+#define QUDA_MAX_CONVERGENTS 96 // enough for any pair of 64-bit integers
+#define QUDA_SUM_PARTS 64             // most parts a sum or histogram is split into
+#define QUDA_SUM_PART_MIN 4096        // fewest terms a part is given
+#define QUDA_HISTOGRAM_CELLS (1 << 22) // entries the partial histograms may hold together
+// Drift of the total probability that rounding the amplitudes explains (about 8 ULPs)
+#if QUDA_PRECISION == QUDA_PRECISION_HALF
+#define QUDA_FLOAT_ERR 1e-2
+#elif QUDA_PRECISION == QUDA_PRECISION_DOUBLE
+#define QUDA_FLOAT_ERR 2e-15
+#else
+#define QUDA_FLOAT_ERR 1e-6
+#endif
 
 // Testing functions
 int quda_check_normalization(quantum_reg* qreg) {
-	int i;
-	float p = 0.0;
-	for(i=0;i<qreg->num_states;i++) {
-		p += quda_complex_abs_square(qreg->states[i].amplitude);
-	}
+	// A tableau always describes a normalized state, even one too wide to expand
+	if(qreg->repr == QUDA_REPR_STABILIZER && qreg->factors == NULL) return 0;
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	quda_accum_t p = quda_states_norm(qreg->states,qreg->num_states);
 
-	
-	if(qreg->num_states > 0 && (p < 1.0 - QUDA_FLOAT_ERR || p > 1.0)) {
+	if(qreg->num_states > 0 && (p < 1.0 - QUDA_FLOAT_ERR || p > 1.0 + QUDA_FLOAT_ERR)) {
 		#ifdef QUDA_STDLIB_DEBUG
-		printf("Normalization error. P = %f\n",p);
+		printf("Normalization error. P = %f\n",(double)p);
 		#endif
 		return -1;
 	} else {
-		printf("NORM OK, P = %f\n",p); // DEBUG
+		printf("NORM OK, P = %f\n",(double)p); // DEBUG
 	}
 	return 0;
 }
 
 int quda_weak_check_amplitudes(quantum_reg* qreg) {
+	if(qreg->repr == QUDA_REPR_STABILIZER && qreg->factors == NULL) return 0;
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
 	int i;
 	int err = 0;
 	for(i=0;i<qreg->num_states;i++) {
 		if(quda_complex_abs_square(qreg->states[i].amplitude) > 1.0) {
 			#ifdef QUDA_STDLIB_DEBUG
-			printf("Amplitude error. state[%d] --> (%f,%f)\n",i,qreg->states[i].amplitude.real,
-					qreg->states[i].amplitude.imag);
+			printf("Amplitude error. state[%d] --> (%f,%f)\n",i,(double)qreg->states[i].amplitude.real,
+					(double)qreg->states[i].amplitude.imag);
 			#endif
 			err = 1;
 		}
@@ -48,17 +60,22 @@ int quda_weak_check_amplitudes(quantum_reg* qreg) {
 }
 
 void quda_quantum_reg_dump(quantum_reg* qreg, char* tag) {
+	if(quda_quantum_reg_flush(qreg) == -1) {
+		printf("QREG_DUMP: register cannot be expanded\n");
+		return;
+	}
 	int i;
 	uint64_t mask = (1 << qreg->qubits)-1;
 	uint64_t smask = ((1 << qreg->scratch)-1) << qreg->qubits;
 	printf("QREG_DUMP: %d states\n",qreg->num_states);
 	for(i=0;i<qreg->num_states;i++) {
 		if(tag) printf("%s: ",tag);
-		printf("qreg->states[%d].state = %lu (bits,scratch)=(%lu,%lu)\n",i,qreg->states[i].state,
-				qreg->states[i].state & mask,(qreg->states[i].state & smask) >> qreg->qubits);
+		uint64_t state = quda_quantum_logical_state(qreg->states[i].state,qreg);
+		printf("qreg->states[%d].state = %lu (bits,scratch)=(%lu,%lu)\n",i,state,
+				state & mask,(state & smask) >> qreg->qubits);
 		if(tag) printf("%s: ",tag);
-		printf("qreg->states[%d].amplitude = (%f,%f)\n",i,qreg->states[i].amplitude.real,
-				qreg->states[i].amplitude.imag);
+		printf("qreg->states[%d].amplitude = (%f,%f)\n",i,(double)qreg->states[i].amplitude.real,
+				(double)qreg->states[i].amplitude.imag);
 	}
 }
 
@@ -82,6 +99,290 @@ int quda_quantum_hadamard_all(quantum_reg* qreg) {
 	return quda_quantum_hadamard_range(0,qreg->qubits,qreg);
 }
 
+/* Flushes the register for a query and checks that its states are stored explicitly and
+ * that the mask lies within the register
+ */
+static int quda_quantum_query_prepare(uint64_t mask, quantum_reg* qreg) {
+	int width = qreg->qubits + qreg->scratch;
+	if(width < 64 && (mask >> width)) return -1;
+	if(quda_quantum_reg_flush(qreg) == -1) return -1;
+	if(qreg->repr != QUDA_REPR_SPARSE && qreg->repr != QUDA_REPR_DENSE) return -1;
+	return 0;
+}
+
+/* Number of parts to split a sum of 'count' terms into. It depends only on 'count' (and a
+ * cap on the parts), never on the number of threads, so sums taken part by part in order
+ * and then added in part order come out the same on any number of threads.
+ */
+static int64_t quda_sum_parts(int64_t count, int64_t cap) {
+	int64_t parts = count / QUDA_SUM_PART_MIN;
+	if(parts > QUDA_SUM_PARTS) parts = QUDA_SUM_PARTS;
+	if(parts > cap) parts = cap;
+	return (parts > 1) ? parts : 1;
+}
+
+int quda_quantum_bit_probability(int target, quantum_reg* qreg, double* retval) {
+	uint64_t mask = (uint64_t)1 << target;
+	if(quda_quantum_query_prepare(mask,qreg) == -1) return -1;
+	uint64_t bit = (uint64_t)1 << quda_quantum_physical_bit(target,qreg);
+	*retval = quda_states_prob(qreg->states,qreg->num_states,bit,bit);
+	return 0;
+}
+
+int quda_quantum_mask_histogram(uint64_t mask, quantum_reg* qreg, double* hist) {
+	if(quda_quantum_query_prepare(mask,qreg) == -1) return -1;
+
+	// Physical position of each histogram bit
+	int bits = 0;
+	int phys[64];
+	int i;
+	for(i=0;i<64;i++) {
+		if((mask >> i) & 1) phys[bits++] = quda_quantum_physical_bit(i,qreg);
+	}
+
+	/* Each part of the states fills a histogram of its own (the first one 'hist') and the
+	 * others are added to it in order. Wide masks get fewer parts so that the partial
+	 * histograms stay within QUDA_HISTOGRAM_CELLS, down to a single pass.
+	 */
+	int64_t size = (int64_t)1 << bits;
+	int64_t parts = quda_sum_parts(qreg->num_states,QUDA_HISTOGRAM_CELLS / size);
+	double* partial = NULL;
+	if(parts > 1) {
+		partial = malloc((parts-1)*size*sizeof(double));
+		if(partial == NULL) {
+			return -1;
+		}
+	}
+
+	int64_t part;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static) if(parts > 1)
+	#endif
+	for(part=0;part<parts;part++) {
+		double* out = (part == 0) ? hist : partial + (part-1)*size;
+		int64_t h;
+		for(h=0;h<size;h++) {
+			out[h] = 0;
+		}
+		int j;
+		int end = (part+1)*qreg->num_states/parts;
+		for(j=part*qreg->num_states/parts;j<end;j++) {
+			uint64_t state = qreg->states[j].state;
+			uint64_t index = 0;
+			int k;
+			for(k=0;k<bits;k++) {
+				index |= ((state >> phys[k]) & 1) << k;
+			}
+			out[index] += quda_complex_abs_square(qreg->states[j].amplitude);
+		}
+	}
+
+	if(parts > 1) {
+		int64_t h;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+		#endif
+		for(h=0;h<size;h++) {
+			int64_t p;
+			for(p=1;p<parts;p++) {
+				hist[h] += partial[(p-1)*size + h];
+			}
+		}
+		free(partial);
+	}
+	return 0;
+}
+
+int quda_quantum_range_histogram(int start, int end, quantum_reg* qreg, double* hist) {
+	uint64_t mask = (end - start >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << (end - start)) - 1);
+	return quda_quantum_mask_histogram(mask << start,qreg,hist);
+}
+
+int quda_quantum_z_expectation(uint64_t mask, quantum_reg* qreg, double* retval) {
+	if(quda_quantum_query_prepare(mask,qreg) == -1) return -1;
+
+	uint64_t pmask = 0;
+	int i;
+	for(i=0;i<64;i++) {
+		if((mask >> i) & 1) pmask |= (uint64_t)1 << quda_quantum_physical_bit(i,qreg);
+	}
+
+	quda_accum_t even = quda_states_parity(qreg->states,qreg->num_states,pmask,0);
+	quda_accum_t odd = quda_states_parity(qreg->states,qreg->num_states,pmask,1);
+	*retval = even - odd;
+	return 0;
+}
+
+/* Reflects the amplitudes of one group of a dense register about their mean. Index x of
+ * the range in group g is g's low bits, then x, then g's high bits. The passes are split
+ * among threads only when 'inner' is set (i.e. when the groups themselves are not); the
+ * mean is summed part by part either way, so it does not depend on the number of threads.
+ */
+static void quda_grover_dense_group(uint64_t g, int start, int bits, int inner,
+		quantum_reg* qreg) {
+	uint64_t low = g & (((uint64_t)1 << start) - 1);
+	uint64_t base = low | ((g >> start) << (start + bits));
+	int64_t count = (int64_t)1 << bits;
+	int64_t parts = quda_sum_parts(count,QUDA_SUM_PARTS);
+	double real[QUDA_SUM_PARTS], imag[QUDA_SUM_PARTS];
+	int64_t x,part;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static) if(inner && parts > 1)
+	#endif
+	for(part=0;part<parts;part++) {
+		double r = 0, i = 0;
+		int64_t y;
+		for(y=part*count/parts;y<(part+1)*count/parts;y++) {
+			complex_t a = qreg->states[base | ((uint64_t)y << start)].amplitude;
+			r += a.real;
+			i += a.imag;
+		}
+		real[part] = r;
+		imag[part] = i;
+	}
+	for(part=1;part<parts;part++) {
+		real[0] += real[part];
+		imag[0] += imag[part];
+	}
+
+	complex_t twice_mean = { .real = 2 * real[0] / count, .imag = 2 * imag[0] / count };
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static) if(inner)
+	#endif
+	for(x=0;x<count;x++) {
+		complex_t* a = &qreg->states[base | ((uint64_t)x << start)].amplitude;
+		*a = quda_complex_sub(twice_mean,*a);
+	}
+}
+
+/* Sparse states are stored as keys with the range moved to the low bits while they are
+ * grouped, so that sorting brings each group together in range order.
+ */
+static uint64_t quda_grover_key(uint64_t state, int start, int bits) {
+	uint64_t low = state & (((uint64_t)1 << start) - 1);
+	uint64_t x = (state >> start) & (((uint64_t)1 << bits) - 1);
+	return ((((state >> (start + bits)) << start) | low) << bits) | x;
+}
+
+static uint64_t quda_grover_state(uint64_t key, int start, int bits) {
+	uint64_t x = key & (((uint64_t)1 << bits) - 1);
+	uint64_t g = key >> bits;
+	uint64_t low = g & (((uint64_t)1 << start) - 1);
+	return low | (x << start) | ((g >> start) << (start + bits));
+}
+
+int quda_quantum_grover_diffusion(int start, int end, quantum_reg* qreg) {
+	int bits = end - start;
+	int width = qreg->qubits + qreg->scratch;
+	if(start < 0 || bits <= 0 || end > width || width > 63) return -1;
+	if(quda_quantum_reg_materialize(qreg) == -1) return -1;
+	if(qreg->repr != QUDA_REPR_SPARSE && qreg->repr != QUDA_REPR_DENSE) return -1;
+	if(quda_quantum_reg_unshare(qreg) == -1) return -1;
+
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		int64_t groups = (int64_t)1 << (width - bits);
+		int64_t g;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(static) if(groups > 1)
+		#endif
+		for(g=0;g<groups;g++) {
+			quda_grover_dense_group(g,start,bits,groups == 1,qreg);
+		}
+		return 0;
+	}
+	if(qreg->num_states == 0) return 0;
+
+	int i;
+	for(i=0;i<qreg->num_states;i++) {
+		qreg->states[i].state = quda_grover_key(qreg->states[i].state,start,bits);
+	}
+	qsort(qreg->states,qreg->num_states,sizeof(quantum_state_t),qstate_compare);
+
+	// Group boundaries, each group's mean and its offset in the new state list
+	int groups = 0;
+	for(i=0;i<qreg->num_states;i++) {
+		if(i == 0 || (qreg->states[i].state >> bits) != (qreg->states[i-1].state >> bits)) groups++;
+	}
+	int* first = malloc((groups+1)*sizeof(int));
+	int64_t* offset = malloc((groups+1)*sizeof(int64_t));
+	complex_t* twice_mean = malloc(groups*sizeof(complex_t));
+	quantum_state_t* states = NULL;
+	int g = 0;
+	if(first && offset && twice_mean) {
+		for(i=0;i<qreg->num_states;i++) {
+			if(i == 0 || (qreg->states[i].state >> bits) != (qreg->states[i-1].state >> bits)) {
+				first[g++] = i;
+			}
+		}
+		first[groups] = qreg->num_states;
+
+		offset[0] = 0;
+		for(g=0;g<groups;g++) {
+			double real = 0, imag = 0;
+			for(i=first[g];i<first[g+1];i++) {
+				real += qreg->states[i].amplitude.real;
+				imag += qreg->states[i].amplitude.imag;
+			}
+			twice_mean[g].real = ldexp(real,1-bits);
+			twice_mean[g].imag = ldexp(imag,1-bits);
+			// A zero mean only negates the group's own states
+			int filled = !quda_complex_eq(twice_mean[g],QUDA_COMPLEX_ZERO);
+			offset[g+1] = offset[g] + (filled ? (int64_t)1 << bits : first[g+1] - first[g]);
+		}
+		if(offset[groups] <= INT_MAX && quda_quantum_reg_budget_fits(qreg,offset[groups])) {
+			states = malloc(offset[groups]*sizeof(quantum_state_t));
+		}
+	}
+
+	if(states == NULL) {
+		for(i=0;i<qreg->num_states;i++) {
+			qreg->states[i].state = quda_grover_state(qreg->states[i].state,start,bits);
+		}
+		free(first);
+		free(offset);
+		free(twice_mean);
+		return -1;
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for(g=0;g<groups;g++) {
+		quantum_state_t* out = states + offset[g];
+		int64_t filled = offset[g+1] - offset[g];
+		int j = first[g];
+		int64_t k;
+		if(filled == first[g+1] - first[g]) {
+			// Every range state is present already, or the mean is zero
+			for(k=0;k<filled;k++,j++) {
+				out[k].state = quda_grover_state(qreg->states[j].state,start,bits);
+				out[k].amplitude = quda_complex_sub(twice_mean[g],qreg->states[j].amplitude);
+			}
+			continue;
+		}
+
+		uint64_t key = (qreg->states[j].state >> bits) << bits;
+		for(k=0;k<filled;k++) {
+			out[k].state = quda_grover_state(key | k,start,bits);
+			out[k].amplitude = twice_mean[g];
+			if(j < first[g+1] && qreg->states[j].state == (key | k)) {
+				out[k].amplitude = quda_complex_sub(twice_mean[g],qreg->states[j++].amplitude);
+			}
+		}
+	}
+
+	free(qreg->states);
+	qreg->states = states;
+	qreg->num_states = offset[groups];
+	qreg->size = offset[groups];
+	free(first);
+	free(offset);
+	free(twice_mean);
+	quda_quantum_reg_prune(qreg);
+	qreg->coalesced_states = qreg->num_states;
+	return 0;
+}
+
 // Original implementation
 void quda_quantum_fourier_transform(quantum_reg* qreg) {
 	int q = qreg->qubits-1;
@@ -101,18 +402,40 @@ void quda_quantum_fourier_transform(quantum_reg* qreg) {
   printf("Number of states after hadamard %d: %d\n", i, qreg->num_states);
 	}
 
-	// TODO: Consider using SWAP gate here instead
+	// Bit reversal (only relabels qubits under QUDA_REG_VIRTUAL_QUBITS)
 	for(i=0;i<qreg->qubits/2;i++) {
-		quda_quantum_controlled_not_gate(i,q-i,qreg);
-		quda_quantum_controlled_not_gate(q-i,i,qreg);
-		quda_quantum_controlled_not_gate(i,q-i,qreg);
+		quda_quantum_swap_gate(i,q-i,qreg);
 	}
 }
 
 // Classical functions
 
 void quda_classical_exp_mod_n(int x, int n, quantum_reg* qreg) {
+	quda_quantum_reg_materialize(qreg);
+	if(quda_quantum_reg_unshare(qreg) == -1) return;
 	int i;
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		/* |a>|y> -> |a>|y XOR x^a % n> is an involution on the index space, so each pair of
+		 * indices is swapped in place once.
+		 */
+		uint64_t inputs = (uint64_t)1 << qreg->qubits;
+		uint64_t outputs = (uint64_t)1 << qreg->scratch;
+		uint64_t a,y;
+		for(a=0;a<inputs;a++) {
+			uint64_t value = quda_mod_pow_bin(x,a,n);
+			for(y=0;y<outputs;y++) {
+				if((y ^ value) > y && (y ^ value) < outputs) {
+					uint64_t i0 = (y << qreg->qubits) | a;
+					uint64_t i1 = ((y ^ value) << qreg->qubits) | a;
+					complex_t temp = qreg->states[i0].amplitude;
+					qreg->states[i0].amplitude = qreg->states[i1].amplitude;
+					qreg->states[i1].amplitude = temp;
+				}
+			}
+		}
+		return;
+	}
+
 	for(i=0;i<qreg->num_states;i++) {
 		uint64_t value = quda_mod_pow_simple(x,qreg->states[i].state,n);
 		value <<= qreg->qubits; // move to 'output' register (scratch space)
@@ -121,38 +444,186 @@ void quda_classical_exp_mod_n(int x, int n, quantum_reg* qreg) {
 
 	
 }
+/* Checks the oracle's bit ranges and brings the register's stored states up to date.
+ * Returns 0 if the oracle can be applied, -1 otherwise.
+ */
+static int quda_classical_oracle_prepare(int in_start, int in_bits, int out_start,
+		int out_bits, quantum_reg* qreg) {
+	int width = qreg->qubits + qreg->scratch;
+	if(in_start < 0 || in_bits < 0 || out_start < 0 || out_bits < 0) return -1;
+	if(in_start + in_bits > width || out_start + out_bits > width || width > 64) return -1;
+	if(in_start < out_start + out_bits && out_start < in_start + in_bits) return -1;
+	if(quda_quantum_reg_materialize(qreg) == -1) return -1;
+	if(qreg->repr != QUDA_REPR_SPARSE && qreg->repr != QUDA_REPR_DENSE) return -1;
+	return quda_quantum_reg_unshare(qreg);
+}
+
+/* Dense oracle kernel: |x>|y> <-> |x>|y XOR table[x]> is an involution on the index space,
+ * so each pair is swapped once, by its lower index. Pairs are disjoint, so indices can be
+ * split among threads freely.
+ */
+static void quda_classical_oracle_dense(int in_start, uint64_t in_mask, int out_start,
+		uint64_t out_mask, const uint64_t* table, quantum_reg* qreg) {
+	int64_t size = (int64_t)1 << (qreg->qubits + qreg->scratch);
+	int64_t i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for(i=0;i<size;i++) {
+		uint64_t partner = (uint64_t)i ^ ((table[((uint64_t)i >> in_start) & in_mask] & out_mask)
+				<< out_start);
+		if(partner > (uint64_t)i) {
+			complex_t temp = qreg->states[i].amplitude;
+			qreg->states[i].amplitude = qreg->states[partner].amplitude;
+			qreg->states[partner].amplitude = temp;
+		}
+	}
+}
+
+// Low 'bits' bits set, including the full 64-bit mask
+#define QUDA_ORACLE_MASK(bits) ((bits) >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (bits)) - 1)
+
+int quda_classical_oracle(int in_start, int in_bits, int out_start, int out_bits,
+		quda_oracle_fn f, void* data, quantum_reg* qreg) {
+	if(quda_classical_oracle_prepare(in_start,in_bits,out_start,out_bits,qreg) == -1) return -1;
+	uint64_t in_mask = QUDA_ORACLE_MASK(in_bits);
+	uint64_t out_mask = QUDA_ORACLE_MASK(out_bits);
+
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		// The input bits lie within the register, so the table is no larger than its states
+		int64_t inputs = (int64_t)1 << in_bits;
+		uint64_t* table = malloc(inputs * sizeof(uint64_t));
+		if(!table) return -1;
+		int64_t x;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+		#endif
+		for(x=0;x<inputs;x++) {
+			table[x] = f((uint64_t)x,data);
+		}
+		quda_classical_oracle_dense(in_start,in_mask,out_start,out_mask,table,qreg);
+		free(table);
+		return 0;
+	}
+
+	// XORing a function of untouched bits into other bits is a bijection, so no duplicates
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t state = qreg->states[i].state;
+		qreg->states[i].state = state ^ ((f((state >> in_start) & in_mask,data) & out_mask)
+				<< out_start);
+	}
+	return 0;
+}
+
+int quda_classical_oracle_table(int in_start, int in_bits, int out_start, int out_bits,
+		const uint64_t* table, quantum_reg* qreg) {
+	if(quda_classical_oracle_prepare(in_start,in_bits,out_start,out_bits,qreg) == -1) return -1;
+	uint64_t in_mask = QUDA_ORACLE_MASK(in_bits);
+	uint64_t out_mask = QUDA_ORACLE_MASK(out_bits);
+
+	if(qreg->repr == QUDA_REPR_DENSE) {
+		quda_classical_oracle_dense(in_start,in_mask,out_start,out_mask,table,qreg);
+		return 0;
+	}
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for(i=0;i<qreg->num_states;i++) {
+		uint64_t state = qreg->states[i].state;
+		qreg->states[i].state = state ^ ((table[(state >> in_start) & in_mask] & out_mask)
+				<< out_start);
+	}
+	return 0;
+}
+
 void quda_classical_continued_fraction_expansion(uint64_t* num, uint64_t* denom) {
+	uint64_t nums[QUDA_MAX_CONVERGENTS];
+	uint64_t denoms[QUDA_MAX_CONVERGENTS];
+	uint64_t orig_num = *num;
 	uint64_t orig_denom = *denom;
-	float f = *num/(float)orig_denom;
 
 	#ifdef QUDA_STDLIB_DEBUG
-	printf("Measured %lu (%f)\n",*num,f);
+	printf("Measured %lu (%f)\n",*num,*num/(double)orig_denom);
 	#endif
 
-	float g = f;
+	int count = quda_classical_convergents(orig_num,orig_denom,orig_denom,nums,denoms,
+			QUDA_MAX_CONVERGENTS);
+	int i;
+	for(i=0;i<count;i++) {
+		*num = nums[i];
+		*denom = denoms[i];
+		// |p/q - num/denom| <= 1/(2*denom), cross-multiplied to stay in integers
+		uint64_t diff = (nums[i]*orig_denom > orig_num*denoms[i]) ?
+				nums[i]*orig_denom - orig_num*denoms[i] : orig_num*denoms[i] - nums[i]*orig_denom;
+		if(2*diff <= denoms[i]) {
+			break;
+		}
+	}
+}
+
+int quda_classical_convergents(uint64_t num, uint64_t denom, uint64_t limit,
+		uint64_t* nums, uint64_t* denoms, int max) {
 	uint64_t num1 = 1;
 	uint64_t num2 = 0;
 	uint64_t denom1 = 0;
 	uint64_t denom2 = 1;
-	int i;
+	int count = 0;
 
-	do {
-		i = (int)(g+QUDA_CFE_STEP);
-		g -= i-QUDA_CFE_STEP;
-		g = 1.0/g;
+	while(denom != 0 && count < max) {
+		uint64_t a = num / denom;
+		uint64_t rem = num % denom;
+		num = denom;
+		denom = rem;
 
-		if(i * denom1 + denom2 > orig_denom) {
+		uint64_t p = a * num1 + num2;
+		uint64_t q = a * denom1 + denom2;
+		if(limit && q > limit) {
 			break;
 		}
 
-		*num = i * num1 + num2;
-		*denom = i * denom1 | denom2;
+		nums[count] = p;
+		denoms[count++] = q;
 		num2 = num1;
 		denom2 = denom1;
-		num1 = *num;
-		denom1 = *denom;
-		
-	} while(fabsf((*num/(float)*denom) - f) > 1.0 / (2 * orig_denom));
+		num1 = p;
+		denom1 = q;
+	}
+
+	return count;
+}
+
+int quda_classical_is_period(int x, uint64_t r, int n) {
+	return r > 0 && quda_mod_pow_bin(x,r,n) == 1 % n;
+}
+
+uint64_t quda_classical_find_period(int x, int n, uint64_t num, uint64_t denom, int max_multiple) {
+	uint64_t nums[QUDA_MAX_CONVERGENTS];
+	uint64_t denoms[QUDA_MAX_CONVERGENTS];
+	int count = quda_classical_convergents(num,denom,n,nums,denoms,QUDA_MAX_CONVERGENTS);
+
+	uint64_t best = 0;
+	int i,k;
+	for(i=0;i<count;i++) {
+		for(k=1;k<=max_multiple;k++) {
+			uint64_t r = k*denoms[i];
+			// Candidates at or above the best verified period cannot improve on it
+			if(r >= (uint64_t)n || (best && r >= best)) {
+				break;
+			}
+			if(quda_classical_is_period(x,r,n)) {
+				best = r;
+				break;
+			}
+		}
+	}
+
+	return best;
 }
 
 // Helper functions
@@ -195,13 +666,15 @@ uint64_t quda_mod_pow_simple(int b, uint64_t e, int n) {
 }
 
 uint64_t quda_mod_pow_bin(int b, uint64_t e, int n) {
-	uint64_t res = 1;
+	// Products of two residues below a 31-bit n always fit in 64 bits
+	uint64_t base = b % n;
+	uint64_t res = 1 % n;
 	while(e > 0) {
 		if((e & 1) == 1) {
-			res = (res*b) % n;
+			res = (res*base) % n;
 		}
 		e >>= 1;
-		b = (b*b) % n;
+		base = (base*base) % n;
 	}
 
 	return res;
@@ -3,7 +3,7 @@
 
 #include "quantum_reg.h"
 
-// Testing functions
+// Testing functions (a register that cannot be expanded fails them, unless it is a tableau)
 int quda_check_normalization(quantum_reg* qreg);
 
 int quda_weak_check_amplitudes(quantum_reg* qreg);
@@ -13,7 +13,9 @@ void quda_quantum_reg_dump(quantum_reg* qreg, char* tag);
 // Utility functions
 
 /* Applies the Hadamard gate to a range of bits [start,end) in a quantum register.
- * Returns -1 if any of the gate applications fail, 0 otherwise.
+ * Returns -1 if any of the gate applications fail, 0 otherwise. A failing gate (e.g. one
+ * that does not fit the register's memory budget) leaves the register as the gates before
+ * it left it.
  */
 int quda_quantum_hadamard_range(int start,int end,quantum_reg* qreg);
 
@@ -29,6 +31,37 @@ int quda_quantum_hadamard_after(int start,quantum_reg* qreg);
  */
 int quda_quantum_hadamard_all(quantum_reg* qreg);
 
+/* Applies the Grover diffusion operator 2|s><s| - I to the bits [start,end), where |s> is the
+ * uniform superposition over the range. For every setting of the bits outside the range, the
+ * amplitudes within the range are reflected about their mean, which takes one reduction and
+ * one update pass instead of two hadamard_range() calls around a multi-controlled phase.
+ * Sparse registers gain every range state of each group whose mean is not zero.
+ * Deferred work is flushed, and the register is materialized, first.
+ * Returns 0 on success or -1 if the range is invalid or allocation fails.
+ */
+int quda_quantum_grover_diffusion(int start, int end, quantum_reg* qreg);
+
+/* Non-destructive queries: the register is flushed (expanding stabilizer and MPS registers)
+ * but never collapsed, and each query is a single pass over the states.
+ * Return 0 on success or -1 if the register cannot be expanded or allocation fails.
+ */
+
+/* Stores in *retval the probability that the target bit measures 1 */
+int quda_quantum_bit_probability(int target, quantum_reg* qreg, double* retval);
+
+/* Stores in 'hist' the joint distribution of the bits in 'mask', which must hold
+ * 2^popcount(mask) entries. The lowest bit of the mask is the lowest bit of the index.
+ */
+int quda_quantum_mask_histogram(uint64_t mask, quantum_reg* qreg, double* hist);
+
+/* Stores in 'hist' the distribution of the bits [start,end), which must hold 2^(end-start)
+ * entries indexed by the value of the range.
+ */
+int quda_quantum_range_histogram(int start, int end, quantum_reg* qreg, double* hist);
+
+/* Stores in *retval the expectation value of the product of Pauli Z on the bits in 'mask' */
+int quda_quantum_z_expectation(uint64_t mask, quantum_reg* qreg, double* retval);
+
 /* Applies a Quantum Fourier Transform to the non-scratch qubits of a given register. */
 void quda_quantum_fourier_transform(quantum_reg* qreg);
 
@@ -39,18 +72,58 @@ void quda_quantum_fourier_transform(quantum_reg* qreg);
  * Requires n, the number to mod by, and x, a number relatively prime to n.
  * This helps to reduce a known (usu. Toffoli-gate) bottleneck since modular exponentiation
  * is the bottleneck of Shor's algorithm.
+ * Dense registers XOR the result into the scratch bits in place instead.
  */
 void quda_classical_exp_mod_n(int x, int n, quantum_reg* qr);
 
+/* Classical function of an oracle gate: maps the input bits (as an integer) to the value
+ * XORed into the output bits. 'data' is passed through unchanged. The function may be
+ * called from several threads at once and must not depend on the order of calls.
+ */
+typedef uint64_t (*quda_oracle_fn)(uint64_t input, void* data);
+
+/* Applies U_f|x>|y> = |x>|y XOR f(x)> in a single pass over the register, where x is read
+ * from the 'in_bits' bits starting at 'in_start' and y occupies the 'out_bits' bits starting
+ * at 'out_start'. Bits of f(x) beyond 'out_bits' are ignored. The two ranges must not
+ * overlap and must lie within the register (qubits and scratch bits).
+ * Deferred work is flushed, and the register is materialized, before the oracle is applied.
+ * Dense registers tabulate f once per input and swap amplitude pairs in place.
+ * Returns 0 on success or -1 if the ranges are invalid or the register cannot be expanded.
+ */
+int quda_classical_oracle(int in_start, int in_bits, int out_start, int out_bits,
+		quda_oracle_fn f, void* data, quantum_reg* qreg);
+
+/* As quda_classical_oracle(), with f given by a lookup table of 2^in_bits entries */
+int quda_classical_oracle_table(int in_start, int in_bits, int out_start, int out_bits,
+		const uint64_t* table, quantum_reg* qreg);
+
 /* Performs the continued fraction expansion to approximate the given result (*num)
  * with respect to the original denominator (*denom = 1 << reg_width, usually).
- * Outputs results in 'num' and 'denom'.
+ * Outputs results in 'num' and 'denom': the first convergent within 1/(2*denom) of the input.
  * NOTE: This function does not collapse the quantum register. It does, however, modify the 'num'
  * value passed into it, so a copy of num should be created before calling this function if
  * 'num' needs to be saved.
  */
 void quda_classical_continued_fraction_expansion(uint64_t* num, uint64_t* denom);
 
+/* Generates the continued fraction convergents p_i/q_i of num/denom using exact integer
+ * arithmetic. Stores at most 'max' convergents in 'nums'/'denoms' in order of increasing
+ * denominator, stopping before the first denominator larger than 'limit' (0 for no limit).
+ * Returns the number of convergents stored.
+ */
+int quda_classical_convergents(uint64_t num, uint64_t denom, uint64_t limit,
+		uint64_t* nums, uint64_t* denoms, int max);
+
+/* Returns 1 if r is a period of x mod n (x^r % n == 1), 0 otherwise. */
+int quda_classical_is_period(int x, uint64_t r, int n);
+
+/* Finds the period of x mod n suggested by a measured sample num/denom.
+ * Every convergent denominator below n and its multiples up to 'max_multiple' are
+ * verified with modular exponentiation, and the smallest verified period is returned.
+ * Returns 0 if no candidate verifies.
+ */
+uint64_t quda_classical_find_period(int x, int n, uint64_t num, uint64_t denom, int max_multiple);
+
 // Helper functions for other stdlib functions (generally simple subroutines)
 
 /* Calculates gcd of x and y via the division-based Euclidean algorithm */
@@ -9,6 +9,9 @@
 #include "cuda_stdlib.h"
 #include "shor.h"
 
+// Multiples of each convergent denominator tried as candidate periods
+#define SHOR_PERIOD_MULTIPLES 4
+
 int use_cuda = 0;
 
 /* TODO: Change input parsing and/or accepted parameters
@@ -17,14 +20,20 @@ int use_cuda = 0;
  */
 int main(int argc, char** argv) {
 	if(argc == 1) {
-		printf("Usage: sim [number] [rand] [use_cuda]\n\n");
+		printf("Usage: sim [number] [rand] [use_cuda] [samples]\n\n");
 		return 3;
 	}
 
   if (argc > 3) {
-    use_cuda = atoi(argv[2]);
+    use_cuda = atoi(argv[3]);
   }
 
+	// Number of samples drawn from the final register before giving up (1 collapses it)
+	int samples = 1;
+	if(argc > 4) {
+		samples = atoi(argv[4]);
+	}
+
 	int N = atoi(argv[1]);
 
 	if(N < 15) {
@@ -75,46 +84,37 @@ int main(int argc, char** argv) {
   else
     quda_quantum_fourier_transform(&qr1);
 
+	int factor = 0;
 	uint64_t result;
-	int res = quda_quantum_reg_measure_and_collapse(&qr1,&result);
-	if(res == -1) {
-		printf("Invalid result (normalization error).\n");
-		return -1;
-	} else if(result == 0) {
-		// NOTE: This can (kind of) be a valid result for 15 with (x=7,width=11) ~.25 prob
-		// Creates fraction 0/1, expands to 0/2, 2 is a valid period
-		// Obviously doesn't hold for other numbers and thus may create erroneous results.
-		printf("Measured zero.\n");
-		return 0;
-	}
-
-	uint64_t denom = 1 << width;
-	quda_classical_continued_fraction_expansion(&result,&denom);
-
-	printf("fractional approximation is %lu/%lu.\n", result, denom);
-
-	if((denom % 2 == 1) && (2*denom < (1<<width))) {
-		printf("Odd denominator, trying to expand by 2.\n");
-		denom *= 2;
-    }
-
-	if(denom % 2 == 1) {
-		printf("Odd period, try again.\n");
-		return 0;
-	}
-
-	printf("Possible period is %lu.\n", denom);
-
-	int factor = pow(x,denom/2);
-	int factor1 = quda_gcd_div(N,factor + 1);
-	int factor2 = quda_gcd_div(N,factor - 1);
-	if(factor1 > factor2) {
-		factor = factor1;
+	if(samples <= 1) {
+		int res = quda_quantum_reg_measure_and_collapse(&qr1,&result);
+		if(res == -1) {
+			printf("Invalid result (normalization error).\n");
+			return -1;
+		}
+		factor = factor_from_sample(N,x,width,result);
 	} else {
-		factor = factor2;
+		/* The QFT output register is left intact and sampled repeatedly; every sample is a
+		 * cheap classical attempt at the period instead of a full re-simulation.
+		 */
+		quantum_sampler qs;
+		if(quda_quantum_sampler_init(&qs,&qr1,0) == -1) {
+			printf("Could not allocate sampler.\n");
+			return -1;
+		}
+		int attempt;
+		for(attempt=0;attempt<samples && factor == 0;attempt++) {
+			if(quda_quantum_sampler_draw(&qs,&result) == -1) {
+				printf("Invalid result (normalization error).\n");
+				break;
+			}
+			printf("Attempt %d: measured %lu.\n",attempt+1,result);
+			factor = factor_from_sample(N,x,width,result);
+		}
+		quda_quantum_sampler_delete(&qs);
 	}
 
-	if(factor < N && factor > 1) {
+	if(factor) {
 		printf("%d = %d * %d\n",N,factor,N/factor);
 	} else {
 		printf("Could not determine factors.\n");
@@ -151,6 +151,42 @@ void dump_mod_exp_results(quantum_reg* qreg, int* num_outputs) {
 
 // Classical functions
 
+int factor_from_sample(int N, int x, int width, uint64_t result) {
+	if(result == 0) {
+		// NOTE: This can (kind of) be a valid result for 15 with (x=7,width=11) ~.25 prob
+		// Creates fraction 0/1, expands to 0/2, 2 is a valid period
+		// Obviously doesn't hold for other numbers and thus may create erroneous results.
+		printf("Measured zero.\n");
+		return 0;
+	}
+
+	uint64_t denom = (uint64_t)1 << width;
+	uint64_t period = quda_classical_find_period(x,N,result,denom,SHOR_PERIOD_MULTIPLES);
+	if(period == 0) {
+		printf("No period candidate verified, try again.\n");
+		return 0;
+	}
+
+	printf("Verified period is %lu.\n", period);
+
+	if(period % 2 == 1) {
+		printf("Odd period, try again.\n");
+		return 0;
+	}
+
+	// x^(r/2) is computed mod N; the gcds only need its residue
+	uint64_t half = quda_mod_pow_bin(x,period/2,N);
+	int factor = quda_gcd_div(N,(half + 1) % N);
+	if(factor == 1 || factor == N) {
+		factor = quda_gcd_div(N,(half + N - 1) % N);
+	}
+
+	if(factor < N && factor > 1) {
+		return factor;
+	}
+	return 0;
+}
+
 int qubits_required(int num) {
 	int i;
 	num >>= 1;
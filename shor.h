@@ -12,5 +12,11 @@ void dump_mod_exp_results(quantum_reg* qreg, int* num_outputs);
 
 // Classical functions (perform purely non-quantum computation)
 
+/* Runs the continued fraction expansion and gcd checks on one measured sample of the
+ * 'width'-qubit QFT output for base x. Returns a nontrivial factor of N, or 0 if this
+ * sample did not yield one.
+ */
+int factor_from_sample(int N, int x, int width, uint64_t result);
+
 /* Determines number of qubits required to store the given number */
 int qubits_required(int num);
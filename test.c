@@ -3,9 +3,17 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "complex.h"
 #include "quantum_reg.h"
 #include "quantum_gates.h"
+#include "quantum_stdlib.h"
+#include "quantum_batch.h"
+#include "quantum_mcgates.h"
+#include "quantum_shard.h"
 
 #define CHECK_COMPLEX_RESULT(val, compreal, compimag, explain) \
   do { \
@@ -17,6 +25,22 @@
     printf("PASS TEST " explain "\n"); \
   } while(0)
 
+/* Tolerances are written for single-precision amplitudes. Half precision rounds 2^13 times
+ * more coarsely (apply twice to tolerances on squared differences). */
+#if QUDA_PRECISION == QUDA_PRECISION_HALF
+#define TOLERANCE(x) ((x)*8192)
+#else
+#define TOLERANCE(x) (x)
+#endif
+
+#define CHECK_RESULT(cond, explain) \
+  do { \
+  if (!(cond)) \
+    printf("FAIL TEST " explain "\n"); \
+  else \
+    printf("PASS TEST " explain "\n"); \
+  } while(0)
+
 #define VERIFY_REGISTER(qureg, nbits, check, func) \
   do { \
     unsigned verified = (1U << (1U << nbits)) - 1; \
@@ -32,7 +56,7 @@
       printf("Checking projection onto state |%d>\n", state); \
       CHECK_COMPLEX_RESULT(*amplitude, entry->real, entry->imag, \
         "Verifying gate " #func); \
-      printf("Value: %.3f + %.3fi\n", amplitude->real, amplitude->imag); \
+      printf("Value: %.3f + %.3fi\n", (double)amplitude->real, (double)amplitude->imag); \
       total_probability += quda_complex_abs_square(*amplitude); \
     } \
     if (fabs(total_probability - 1) > 1e-3) { \
@@ -49,13 +73,41 @@
 #define TEST_GATE(nbits, func, ...) \
 do { \
   static complex_t matrix[1 << nbits][1 << nbits] = __VA_ARGS__; \
+  for (int mode = 0; mode < 32; mode++) { \
+  int repr = (mode & 1) ? QUDA_REPR_DENSE : QUDA_REPR_SPARSE; \
+  int framed = (mode & 2) != 0; \
+  int relabeled = (mode & 8) != 0; \
+  int flags = (framed ? QUDA_REG_PAULI_FRAME : 0) | ((mode & 4) ? QUDA_REG_DIAGONAL_QUEUE : 0) \
+    | (relabeled ? QUDA_REG_VIRTUAL_QUBITS : 0) | ((mode & 16) ? QUDA_REG_FACTORED : 0); \
+  char reprname[64]; \
+  snprintf(reprname, sizeof(reprname), "%s%s%s%s%s", (mode & 1) ? "dense" : "sparse", \
+    framed ? ", framed" : "", (mode & 4) ? ", queued" : "", relabeled ? ", relabeled" : "", \
+    (mode & 16) ? ", factored" : ""); \
+  int all = (1 << nbits) - 1; \
+  int top = nbits - 1; \
   quantum_reg qureg; \
-  quda_quantum_reg_init(&qureg, 1); \
+  quda_quantum_reg_init(&qureg, nbits); \
+  quda_quantum_reg_set(&qureg, 0); \
+  quda_quantum_reg_set_repr(&qureg, repr); \
+  quda_quantum_reg_set_flags(&qureg, flags); \
   /* How does it map basis elements? */ \
   for (int i = 0; i < (1 << nbits); i++) { \
-    quda_quantum_reg_set(&qureg, i); \
+    /* Reach |i> through a swap of the outer qubits, then a frame of X on every bit and Z \
+     * on the stored zeros */ \
+    int s = i; \
+    if (relabeled && ((s & 1) != ((s >> top) & 1))) s ^= 1 | (1 << top); \
+    if (framed) s ^= all; \
+    quda_quantum_reg_set(&qureg, s); \
+    if (relabeled) quda_quantum_swap_gate(0, top, &qureg); \
+    if (framed) { \
+      for (int b = 0; b < nbits; b++) { \
+        if (i & (1 << b)) quda_quantum_pauli_z_gate(b, &qureg); \
+      } \
+      for (int b = 0; b < nbits; b++) quda_quantum_pauli_x_gate(b, &qureg); \
+    } \
     func(INVOKE##nbits, &qureg); \
-    printf("Testing " #func " with basis |%d>\n", i); \
+    quda_quantum_reg_materialize(&qureg); \
+    printf("Testing " #func " (%s) with basis |%d>\n", reprname, i); \
     VERIFY_REGISTER(qureg, nbits, matrix[i], func); \
   } \
   /* How does it map the uniform state? */ \
@@ -77,12 +129,57 @@ do { \
   sum = sqrt(sum); \
   for (int i = 0; i < (1 << nbits); i++) \
     uniform[i] = quda_complex_rdiv(uniform[i], sum); \
+  if (relabeled) quda_quantum_swap_gate(0, top, &qureg); \
+  if (framed) { \
+    for (int b = 0; b < nbits; b++) quda_quantum_pauli_x_gate(b, &qureg); \
+  } \
   func(INVOKE##nbits, &qureg); \
-  printf("Testing " #func " with uniform distribution\n"); \
+  quda_quantum_reg_materialize(&qureg); \
+  printf("Testing " #func " (%s) with uniform distribution\n", reprname); \
   VERIFY_REGISTER(qureg, nbits, uniform, func); \
   quda_quantum_reg_delete(&qureg); \
+  } \
 } while (0)
 
+/* Applies one of the Clifford gates the stabilizer representation handles */
+static void apply_clifford(int op, int a, int b, quantum_reg* qreg) {
+	switch(op) {
+		case 0: quda_quantum_hadamard_gate(a,qreg); break;
+		case 1: quda_quantum_phase_gate(a,qreg); break;
+		case 2: quda_quantum_pauli_x_gate(a,qreg); break;
+		case 3: quda_quantum_pauli_y_gate(a,qreg); break;
+		case 4: quda_quantum_pauli_z_gate(a,qreg); break;
+		case 5: quda_quantum_swap_gate(a,b,qreg); break;
+		case 6: quda_quantum_controlled_not_gate(a,b,qreg); break;
+		case 7: quda_quantum_controlled_y_gate(a,b,qreg); break;
+		case 8: quda_quantum_controlled_z_gate(a,b,qreg); break;
+	}
+}
+
+/* Applies any public gate to the distinct bits a, b and c */
+static void apply_gate(int op, int a, int b, int c, quantum_reg* qreg) {
+	switch(op) {
+		case 9: quda_quantum_pi_over_8_gate(a,qreg); break;
+		case 10: quda_quantum_rotate_k_gate(a,qreg,3); break;
+		case 11: quda_quantum_controlled_phase_gate(a,b,qreg); break;
+		case 12: quda_quantum_controlled_rotate_k_gate(a,b,qreg,4); break;
+		case 13: quda_quantum_toffoli_gate(a,b,c,qreg); break;
+		case 14: quda_quantum_fredkin_gate(a,b,c,qreg); break;
+		default: apply_clifford(op,a,b,qreg); break;
+	}
+}
+
+// Classical function for the oracle tests
+static uint64_t square_plus_one(uint64_t x, void* data) {
+	return (x * x + *(uint64_t*)data) % 8;
+}
+
+// Records the pressure steps a register takes
+static void record_pressure(quantum_reg* qreg, int step, void* data) {
+	int* steps = data;
+	steps[steps[0]++ + 1] = step;
+}
+
 int main(int argc, char** argv) {
 	// Complex
 	complex_t op1,op2;
@@ -93,6 +190,57 @@ int main(int argc, char** argv) {
 	complex_t res = quda_complex_add(op1,op2);
   CHECK_COMPLEX_RESULT(res, 3, 0.5, "Simple complex addition");
 
+	// Complex arrays, against double precision within a few ULPs of the result's size
+	{
+		quda_float_t theta[256];
+		complex_t in[256],cis[256],ex[256],lg[256],pw[256],sn[256],cs[256],th[256];
+		const complex_t p = { .real = 1.5f, .imag = -0.25f };
+		double cerr = 0, eerr = 0, lerr = 0, perr = 0, serr = 0, oerr = 0, terr = 0;
+		for(int i=0;i<256;i++) {
+			// Index 128 is zero
+			theta[i] = (i - 128)*0.83f;
+			in[i].real = (i - 128)*0.071f;
+			in[i].imag = (i*37 % 256 - 128)*0.05f;
+		}
+		quda_complex_cis_array(theta,cis,256);
+		quda_complex_exp_array(in,ex,256);
+		quda_complex_log_array(in,lg,256);
+		for(int i=0;i<256;i++) pw[i] = in[i];
+		quda_complex_pow_array(pw,p,pw,256);
+		quda_complex_sin_array(in,sn,256);
+		quda_complex_cos_array(in,cs,256);
+		quda_complex_tanh_array(in,th,256);
+		for(int i=0;i<256;i++) {
+			double x = in[i].real, y = in[i].imag;
+			double m = exp(x), r = hypot(x,y);
+			double sr = sin(x)*cosh(y), si = cos(x)*sinh(y);
+			double cr = cos(x)*cosh(y), ci = -sin(x)*sinh(y);
+			double d = sinh(x)*sinh(x) + cos(y)*cos(y);
+			double tr = sinh(x)*cosh(x)/d, ti = sin(y)*cos(y)/d;
+			serr = fmax(serr,hypot(sn[i].real - sr,sn[i].imag - si)/hypot(sr,si));
+			oerr = fmax(oerr,hypot(cs[i].real - cr,cs[i].imag - ci)/hypot(cr,ci));
+			terr = fmax(terr,hypot(th[i].real - tr,th[i].imag - ti)/fmax(hypot(tr,ti),1e-30));
+			cerr = fmax(cerr,hypot(cis[i].real - cos(theta[i]),cis[i].imag - sin(theta[i])));
+			eerr = fmax(eerr,hypot(ex[i].real - m*cos(y),ex[i].imag - m*sin(y))/m);
+			if(r == 0) {
+				CHECK_RESULT(lg[i].real == -INFINITY && pw[i].real == 0 && pw[i].imag == 0,
+					"Complex array logarithm and power of zero");
+				continue;
+			}
+			double lr = log(r), a = atan2(y,x);
+			lerr = fmax(lerr,fmax(fabs(lg[i].real - lr)/fmax(fabs(lr),1),fabs(lg[i].imag - a)/fabs(a)));
+			double pr = exp(p.real*lr - p.imag*a), pa = p.imag*lr + p.real*a;
+			perr = fmax(perr,hypot(pw[i].real - pr*cos(pa),pw[i].imag - pr*sin(pa))/pr);
+		}
+		CHECK_RESULT(cerr < TOLERANCE(3e-7), "Complex array cis matches cos and sin");
+		CHECK_RESULT(eerr < TOLERANCE(4e-7), "Complex array exponential matches exp");
+		CHECK_RESULT(lerr < TOLERANCE(5e-7), "Complex array logarithm matches log and atan2");
+		CHECK_RESULT(perr < TOLERANCE(2e-6), "Complex array power matches exp(p log c) in place");
+		CHECK_RESULT(serr < TOLERANCE(4e-7), "Complex array sine matches sin and cosh");
+		CHECK_RESULT(oerr < TOLERANCE(4e-7), "Complex array cosine matches cos and cosh");
+		CHECK_RESULT(terr < TOLERANCE(4e-7), "Complex array tanh matches sinh and cos");
+	}
+
   // Courtesy of jsmath.cpp
 #define M_SQRT1_2 0.70710678118654752440f
   // 1-qubit gates
@@ -156,7 +304,857 @@ int main(int argc, char** argv) {
 	if(quda_quantum_reg_enlarge(&qreg, -1) == -1) return -1;
 
 	quda_quantum_reg_trim(&qreg);
+
+	// Non-destructive sampling
+	quda_quantum_hadamard_gate(0,&qreg);
+	quantum_sampler qs;
+	if(quda_quantum_sampler_init(&qs,&qreg,0) == -1) return -1;
+	int seen = 0;
+	for (int i = 0; i < 100; i++) {
+		uint64_t sample;
+		quda_quantum_sampler_draw(&qs,&sample);
+		seen |= (sample == 42) ? 1 : (sample == 43) ? 2 : 4;
+	}
+	CHECK_RESULT(seen == 3, "Sampler draws every register state and nothing else");
+	CHECK_RESULT(qreg.num_states == 2, "Sampler leaves register uncollapsed");
+	quda_quantum_sampler_delete(&qs);
+
 	quda_quantum_reg_delete(&qreg);
 
+	// Dense register operations
+	quantum_reg dreg;
+	if(quda_quantum_reg_init(&dreg,4) == -1) return -1;
+	quda_quantum_reg_set(&dreg,0);
+	if(quda_quantum_reg_set_repr(&dreg,QUDA_REPR_DENSE) == -1) return -1;
+	CHECK_RESULT(dreg.num_states == 16 && dreg.states[0].amplitude.real == 1.0f,
+		"Dense conversion keeps the basis state");
+	quda_quantum_hadamard_gate(0,&dreg);
+	quda_quantum_hadamard_gate(1,&dreg);
+	quda_quantum_add_scratch(4,&dreg);
+	quda_classical_exp_mod_n(7,15,&dreg);
+	CHECK_COMPLEX_RESULT(dreg.states[(13 << 4) | 3].amplitude, 0.5, 0,
+		"Dense exp_mod_n writes 7^3 mod 15 into scratch");
+	quda_quantum_collapse_scratch(&dreg);
+	CHECK_RESULT(quda_check_normalization(&dreg) == 0, "Dense scratch collapse renormalizes");
+	uint64_t measured;
+	quda_quantum_reg_measure_and_collapse(&dreg,&measured);
+	CHECK_RESULT(dreg.num_states == 16 && quda_complex_abs_square(dreg.states[measured].amplitude) == 1.0f,
+		"Dense measurement collapses to the measured state");
+	quda_quantum_reg_set_repr(&dreg,QUDA_REPR_SPARSE);
+	CHECK_RESULT(dreg.num_states == 1 && dreg.states[0].state == measured,
+		"Sparse conversion drops zero states");
+	quda_quantum_reg_delete(&dreg);
+
+	// Approximate simulation
+	quantum_reg treg;
+	if(quda_quantum_reg_init(&treg,2) == -1) return -1;
+	quda_quantum_reg_set(&treg,0);
+	if(quda_quantum_reg_enlarge(&treg,-1) == -1) return -1;
+	treg.num_states = 3;
+	treg.states[0].amplitude.real = sqrt(0.90);
+	treg.states[1].state = 1;
+	treg.states[1].amplitude = QUDA_COMPLEX_ZERO;
+	treg.states[1].amplitude.imag = sqrt(0.06);
+	treg.states[2].state = 2;
+	treg.states[2].amplitude = QUDA_COMPLEX_ZERO;
+	treg.states[2].amplitude.real = -sqrt(0.04);
+	quda_quantum_reg_prune(&treg);
+	CHECK_RESULT(treg.num_states == 3 && treg.fidelity == 1.0, "Exact prune keeps small states");
+	quda_quantum_reg_set_truncation(&treg,0.05f);
+	quda_quantum_reg_coalesce(&treg);
+	CHECK_RESULT(treg.num_states == 2, "Truncation drops states below the threshold");
+	CHECK_RESULT(fabs(treg.discarded - 0.04) < TOLERANCE(1e-5) && fabs(treg.fidelity - 0.96) < TOLERANCE(1e-5),
+		"Truncation records the discarded probability");
+	CHECK_RESULT(quda_check_normalization(&treg) == 0, "Truncation renormalizes the register");
+	// The 0.06 state now holds 0.0625 of the renormalized register
+	quda_quantum_reg_set_truncation(&treg,0.07f);
+	quda_quantum_reg_coalesce(&treg);
+	CHECK_RESULT(treg.num_states == 1 && fabs(treg.discarded - 0.10) < TOLERANCE(1e-5)
+		&& fabs(treg.fidelity - 0.90) < TOLERANCE(1e-5),
+		"Repeated truncations record the share of the original state dropped");
+	quda_quantum_reg_delete(&treg);
+	if(quda_quantum_reg_init(&treg,6) == -1) return -1;
+	quda_quantum_reg_set(&treg,0);
+	quda_quantum_hadamard_all(&treg);
+	quda_quantum_reg_set_truncation(&treg,0.02f);
+	quda_quantum_reg_coalesce(&treg);
+	CHECK_RESULT(treg.num_states == 1 && fabs(treg.discarded - 63/64.0) < TOLERANCE(1e-5)
+		&& fabs(treg.fidelity - 1/64.0) < TOLERANCE(1e-5) && quda_check_normalization(&treg) == 0,
+		"Truncation below every state keeps the most probable one");
+	quda_quantum_reg_delete(&treg);
+
+	// Deferred coalescing
+	quantum_reg lreg;
+	if(quda_quantum_reg_init(&lreg,3) == -1) return -1;
+	quda_quantum_reg_set(&lreg,0);
+	quda_quantum_reg_set_coalesce_ratio(&lreg,16.0f);
+	if(quda_quantum_reg_enlarge(&lreg,32) == -1) return -1; // no capacity pressure
+	quda_quantum_hadamard_gate(0,&lreg);
+	quda_quantum_hadamard_gate(0,&lreg);
+	quda_quantum_hadamard_gate(1,&lreg);
+	quda_quantum_hadamard_gate(1,&lreg);
+	CHECK_RESULT(lreg.dirty && lreg.num_states == 16, "Hadamard defers coalescing");
+	CHECK_RESULT(quda_quantum_bit_measure(0,&lreg) == 0, "Measurement coalesces first");
+	CHECK_RESULT(!lreg.dirty && lreg.num_states == 1, "Deferred duplicates cancel exactly");
+	CHECK_COMPLEX_RESULT(lreg.states[0].amplitude, 1, 0, "Deferred coalescing keeps the amplitude");
+	quda_quantum_reg_set_coalesce_ratio(&lreg,2.0f);
+	quda_quantum_hadamard_gate(2,&lreg);
+	quda_quantum_hadamard_gate(2,&lreg);
+	CHECK_RESULT(!lreg.dirty && lreg.num_states == 1, "Growth past the ratio forces a coalesce");
+	// Forcing a bit merges both halves of a superposition, which must be renormalized
+	quda_quantum_hadamard_gate(0,&lreg);
+	quda_quantum_bit_set(0,&lreg);
+	CHECK_RESULT(quda_check_normalization(&lreg) == 0 && lreg.num_states == 1,
+		"Setting a bit of a superposition renormalizes");
+	quda_quantum_add_scratch(1,&lreg);
+	quda_quantum_hadamard_gate(quda_quantum_scratch_bit(0,&lreg),&lreg);
+	quda_quantum_clear_scratch(&lreg);
+	CHECK_RESULT(quda_check_normalization(&lreg) == 0 && lreg.num_states == 1,
+		"Clearing scratch in superposition renormalizes");
+	if(quda_quantum_reg_set_repr(&lreg,QUDA_REPR_DENSE) == -1) return -1;
+	quda_quantum_hadamard_gate(1,&lreg);
+	quda_quantum_bit_reset(1,&lreg);
+	CHECK_COMPLEX_RESULT(lreg.states[1].amplitude, 1, 0, "Resetting a dense bit renormalizes");
+	quda_quantum_reg_delete(&lreg);
+
+	// Pauli frame
+	quantum_reg freg;
+	if(quda_quantum_reg_init(&freg,2) == -1) return -1;
+	quda_quantum_reg_set(&freg,0);
+	quda_quantum_reg_set_flags(&freg,QUDA_REG_PAULI_FRAME);
+	quda_quantum_pauli_y_gate(0,&freg);
+	quda_quantum_pauli_x_gate(1,&freg);
+	CHECK_RESULT(freg.num_states == 1 && freg.states[0].state == 0, "Pauli gates only update the frame");
+	quda_quantum_controlled_not_gate(1,0,&freg);
+	CHECK_RESULT(quda_quantum_bit_measure(0,&freg) == 0, "Controlled-not acts through the frame");
+	CHECK_RESULT(freg.states[0].state == 2, "Measurement flushes the frame");
+	CHECK_COMPLEX_RESULT(freg.states[0].amplitude, 0, -1, "Flushed frame keeps its phase");
+	quda_quantum_reg_delete(&freg);
+
+	// Diagonal gate queue
+	quantum_reg zreg;
+	if(quda_quantum_reg_init(&zreg,2) == -1) return -1;
+	quda_quantum_reg_set(&zreg,0);
+	quda_quantum_hadamard_gate(0,&zreg);
+	quda_quantum_hadamard_gate(1,&zreg);
+	quda_quantum_reg_set_flags(&zreg,QUDA_REG_DIAGONAL_QUEUE);
+	quda_quantum_phase_gate(0,&zreg);
+	quda_quantum_phase_gate(0,&zreg);
+	quda_quantum_controlled_phase_gate(1,0,&zreg);
+	quda_quantum_controlled_phase_gate(1,0,&zreg);
+	quda_quantum_controlled_z_gate(0,1,&zreg);
+	CHECK_RESULT(zreg.diag_count == 2, "Diagonal gates are queued and merged by mask");
+	quda_quantum_hadamard_gate(0,&zreg);
+	CHECK_RESULT(zreg.diag_count == 0, "Non-diagonal gates flush the queue");
+	quda_quantum_hadamard_gate(1,&zreg);
+	quda_quantum_reg_flush(&zreg);
+	// The controlled gates cancel, leaving Z on bit 0 (an X on bit 0 after the hadamards)
+	CHECK_RESULT(zreg.num_states == 1 && zreg.states[0].state == 1, "Queued phases interfere correctly");
+	quda_quantum_reg_delete(&zreg);
+
+	// Virtual qubits
+	quantum_reg vreg,ureg;
+	if(quda_quantum_reg_init(&vreg,3) == -1 || quda_quantum_reg_init(&ureg,3) == -1) return -1;
+	quda_quantum_reg_set(&vreg,1);
+	quda_quantum_reg_set_flags(&vreg,QUDA_REG_VIRTUAL_QUBITS);
+	quda_quantum_swap_gate(0,2,&vreg);
+	CHECK_RESULT(vreg.states[0].state == 1, "Swaps only relabel virtual qubits");
+	CHECK_RESULT(quda_quantum_bit_measure(2,&vreg) == 1, "Bit measurement honors the qubit map");
+	uint64_t vres;
+	CHECK_RESULT(quda_quantum_reg_measure(&vreg,&vres,0) == 0 && vres == 4,
+			"Register measurement honors the qubit map");
+	quda_quantum_reg_set(&vreg,5);
+	quda_quantum_reg_set(&ureg,5);
+	quda_quantum_fourier_transform(&vreg);
+	quda_quantum_fourier_transform(&ureg);
+	quda_quantum_reg_materialize(&vreg);
+	quda_quantum_reg_set_repr(&vreg,QUDA_REPR_DENSE);
+	quda_quantum_reg_set_repr(&ureg,QUDA_REPR_DENSE);
+	int vsame = 1;
+	for(int v = 0; v < 8; v++) {
+		complex_t d = quda_complex_sub(vreg.states[v].amplitude,ureg.states[v].amplitude);
+		if(quda_complex_abs_square(d) > 1e-8) vsame = 0;
+	}
+	CHECK_RESULT(vsame, "Relabeled fourier transform matches after materializing");
+	quda_quantum_reg_delete(&vreg);
+	quda_quantum_reg_delete(&ureg);
+
+	// Product-state factors
+	quantum_reg preg;
+	if(quda_quantum_reg_init(&preg,10) == -1) return -1;
+	quda_quantum_reg_set_flags(&preg,QUDA_REG_FACTORED);
+	quda_quantum_reg_set(&preg,0);
+	quda_quantum_hadamard_all(&preg);
+	CHECK_RESULT(preg.num_factors == 10 && preg.factors[0].reg.num_states == 2,
+			"Hadamard on every qubit keeps the factors separate");
+	quda_quantum_bit_reset(9,&preg);
+	quda_quantum_controlled_not_gate(0,9,&preg);
+	CHECK_RESULT(preg.num_factors == 9, "Entangling gates merge factors");
+	int pbit = quda_quantum_bit_measure_and_collapse(0,&preg);
+	CHECK_RESULT(preg.num_factors == 10, "Measurement splits the measured qubit off");
+	CHECK_RESULT(quda_quantum_bit_measure(9,&preg) == pbit, "Merged factor keeps the entanglement");
+	quda_quantum_reg_flush(&preg);
+	CHECK_RESULT(preg.factors == NULL && preg.num_states == 256, "Flushing multiplies the factors out");
+	CHECK_RESULT(quda_check_normalization(&preg) == 0, "Joined factors stay normalized");
+	quda_quantum_reg_delete(&preg);
+
+	// Stabilizer tableau
+	quantum_reg sreg,rreg;
+	if(quda_quantum_reg_init(&sreg,4) == -1 || quda_quantum_reg_init(&rreg,4) == -1) return -1;
+	quda_quantum_reg_set(&sreg,3);
+	quda_quantum_reg_set(&rreg,3);
+	CHECK_RESULT(quda_quantum_reg_set_repr(&sreg,QUDA_REPR_STABILIZER) == 0, "Basis states enter the tableau");
+	srand(35);
+	for(int g = 0; g < 200; g++) {
+		int a = rand() % 4, b = (a + 1 + rand() % 3) % 4;
+		int op = rand() % 9;
+		apply_clifford(op,a,b,&sreg);
+		apply_clifford(op,a,b,&rreg);
+	}
+	CHECK_RESULT(sreg.repr == QUDA_REPR_STABILIZER, "Clifford gates stay in the tableau");
+	quda_quantum_pi_over_8_gate(1,&sreg);
+	quda_quantum_pi_over_8_gate(1,&rreg);
+	CHECK_RESULT(sreg.repr == QUDA_REPR_SPARSE, "Non-Clifford gates leave the tableau");
+	quda_quantum_reg_set_repr(&sreg,QUDA_REPR_DENSE);
+	quda_quantum_reg_set_repr(&rreg,QUDA_REPR_DENSE);
+	complex_t overlap = QUDA_COMPLEX_ZERO;
+	for(int v = 0; v < 16; v++) {
+		overlap = quda_complex_add(overlap,quda_complex_mul(quda_complex_conj(rreg.states[v].amplitude),
+				sreg.states[v].amplitude));
+	}
+	CHECK_RESULT(fabs(quda_complex_abs_square(overlap) - 1) < 1e-3,
+			"Tableau matches the state vector up to a global phase");
+	quda_quantum_reg_set_repr(&sreg,QUDA_REPR_SPARSE);
+	quda_quantum_reg_set(&sreg,0);
+	quda_quantum_reg_set_repr(&sreg,QUDA_REPR_STABILIZER);
+	quda_quantum_hadamard_gate(0,&sreg);
+	quda_quantum_controlled_not_gate(0,1,&sreg);
+	quda_quantum_controlled_not_gate(1,3,&sreg);
+	int sbit = quda_quantum_bit_measure_and_collapse(3,&sreg);
+	uint64_t sres;
+	CHECK_RESULT(quda_quantum_reg_measure_and_collapse(&sreg,&sres) == 0 && sres == (sbit ? 11 : 0) &&
+			sreg.repr == QUDA_REPR_STABILIZER, "Tableau measurements keep the entanglement");
+	quda_quantum_reg_delete(&sreg);
+	quda_quantum_reg_delete(&rreg);
+
+	// 2^32 states are too many to expand, so samples and checks must use the tableau
+	if(quda_quantum_reg_init(&sreg,40) == -1) return -1;
+	quda_quantum_reg_set(&sreg,0);
+	quda_quantum_reg_set_repr(&sreg,QUDA_REPR_STABILIZER);
+	quda_quantum_hadamard_range(0,32,&sreg);
+	quda_quantum_controlled_not_gate(0,39,&sreg);
+	quantum_sampler sqs;
+	double sexp;
+	if(quda_quantum_sampler_init(&sqs,&sreg,0) == -1) return -1;
+	uint64_t sor = 0;
+	int sdok = 1;
+	for(int v = 0; v < 32; v++) {
+		uint64_t sample;
+		sdok &= quda_quantum_sampler_draw(&sqs,&sample) == 0 && (sample >> 39) == (sample & 1);
+		sor |= sample;
+	}
+	quda_quantum_sampler_delete(&sqs);
+	CHECK_RESULT(sdok && sor != 0 && quda_check_normalization(&sreg) == 0
+			&& quda_quantum_z_expectation(1,&sreg,&sexp) == -1 && sreg.repr == QUDA_REPR_STABILIZER,
+			"Tableaus too wide to expand are sampled directly and refuse state queries");
+	quda_quantum_reg_delete(&sreg);
+
+	// Matrix product states
+	quantum_reg mreg,nreg;
+	if(quda_quantum_reg_init(&mreg,5) == -1 || quda_quantum_reg_init(&nreg,5) == -1) return -1;
+	quda_quantum_reg_set(&mreg,6);
+	quda_quantum_reg_set(&nreg,6);
+	quda_quantum_reg_set_repr(&mreg,QUDA_REPR_MPS);
+	quda_quantum_reg_set_repr(&nreg,QUDA_REPR_DENSE);
+	for(int g = 0; g < 100; g++) {
+		int a = rand() % 5, b = (a + 1 + rand() % 4) % 5, c = (b + 1 + rand() % 4) % 5;
+		if(c == a) c = (c + 1) % 5;
+		if(c == b) c = (c + 1) % 5;
+		if(c == a) c = (c + 1) % 5;
+		int op = rand() % 15;
+		apply_gate(op,a,b,c,&mreg);
+		apply_gate(op,a,b,c,&nreg);
+	}
+	CHECK_RESULT(mreg.repr == QUDA_REPR_MPS, "Every gate runs on the tensors");
+	quda_quantum_reg_set_repr(&mreg,QUDA_REPR_DENSE);
+	float mdiff = 0;
+	for(int v = 0; v < 32; v++) {
+		mdiff += quda_complex_abs_square(quda_complex_sub(mreg.states[v].amplitude,nreg.states[v].amplitude));
+	}
+	CHECK_RESULT(mdiff < TOLERANCE(1e-5), "Contracted MPS matches the dense register");
+	quda_quantum_reg_delete(&mreg);
+	quda_quantum_reg_delete(&nreg);
+
+	if(quda_quantum_reg_init(&mreg,40) == -1) return -1;
+	quda_quantum_reg_set(&mreg,0);
+	quda_quantum_reg_set_repr(&mreg,QUDA_REPR_MPS);
+	quda_quantum_reg_set(&mreg,((uint64_t)1 << 39) | 12345);
+	quda_quantum_fourier_transform(&mreg);
+	int mbond = 0;
+	for(int v = 0; v <= 40; v++) {
+		if(mreg.mps_bonds[v] > mbond) mbond = mreg.mps_bonds[v];
+	}
+	CHECK_RESULT(mbond == 1 && mreg.fidelity > 0.999, "Fourier transform of 40 basis qubits stays a product state");
+	quda_quantum_reg_set(&mreg,0);
+	quda_quantum_hadamard_gate(5,&mreg);
+	quda_quantum_controlled_not_gate(5,35,&mreg);
+	int mbit = quda_quantum_bit_measure_and_collapse(35,&mreg);
+	CHECK_RESULT(quda_quantum_bit_measure(5,&mreg) == mbit, "MPS measurement collapses distant entangled bits");
+	quda_quantum_reg_set(&mreg,0);
+	quda_quantum_hadamard_gate(5,&mreg);
+	quda_quantum_controlled_not_gate(5,35,&mreg);
+	quantum_sampler mqs;
+	int mseen = 0;
+	int mok = quda_quantum_reg_flush(&mreg) == -1;
+	if(quda_quantum_sampler_init(&mqs,&mreg,0) == -1) return -1;
+	for(int v = 0; mok && v < 64; v++) {
+		uint64_t sample;
+		mok &= quda_quantum_sampler_draw(&mqs,&sample) == 0;
+		mok &= sample == 0 || sample == (((uint64_t)1 << 35) | (1 << 5));
+		mseen |= (sample == 0) ? 1 : 2;
+	}
+	quda_quantum_sampler_delete(&mqs);
+	CHECK_RESULT(mok && mseen == 3 && mreg.repr == QUDA_REPR_MPS,
+			"Samplers over MPS registers too wide to expand measure a snapshot");
+	quda_quantum_reg_delete(&mreg);
+
+	if(quda_quantum_reg_init(&mreg,2) == -1) return -1;
+	quda_quantum_reg_set(&mreg,0);
+	quda_quantum_reg_set_repr(&mreg,QUDA_REPR_MPS);
+	quda_quantum_reg_set_max_bond(&mreg,1);
+	quda_quantum_hadamard_gate(0,&mreg);
+	quda_quantum_controlled_not_gate(0,1,&mreg);
+	CHECK_RESULT(fabs(mreg.fidelity - 0.5) < 1e-3 && fabs(mreg.discarded - 0.5) < 1e-3,
+			"Bond cap records the discarded weight");
+	quda_quantum_reg_delete(&mreg);
+
+	// Truncating an entangled state keeps the norm, and the fidelity estimates the overlap
+	for(int mode = 0; mode < 2; mode++) {
+		quantum_reg* r = mode ? &mreg : &nreg;
+		if(quda_quantum_reg_init(r,8) == -1) return -1;
+		quda_quantum_reg_set(r,0);
+		quda_quantum_reg_set_repr(r,mode ? QUDA_REPR_MPS : QUDA_REPR_DENSE);
+		quda_quantum_reg_set_max_bond(r,4);
+		for(int q = 0; q < 8; q++) {
+			quda_quantum_hadamard_gate(q,r);
+			quda_quantum_rotate_k_gate(q,r,3);
+		}
+		for(int q = 0; q < 7; q++) {
+			quda_quantum_controlled_not_gate(q,q+1,r);
+		}
+		quda_quantum_fourier_transform(r);
+	}
+	double mfid = mreg.fidelity;
+	quda_quantum_reg_set_repr(&mreg,QUDA_REPR_DENSE);
+	double ore = 0, oim = 0;
+	for(int v = 0; v < 256; v++) {
+		complex_t c = quda_complex_mul(quda_complex_conj(nreg.states[v].amplitude),mreg.states[v].amplitude);
+		ore += c.real;
+		oim += c.imag;
+	}
+	CHECK_RESULT(mfid < 0.99 && fabs((double)quda_states_norm(mreg.states,256) - 1) < TOLERANCE(1e-4)
+		&& fabs(ore*ore + oim*oim - mfid) < 0.05,
+		"Bond truncation keeps the norm and estimates the fidelity");
+	quda_quantum_reg_delete(&mreg);
+	quda_quantum_reg_delete(&nreg);
+
+	// Multi-controlled gates
+	for(int mode = 0; mode < 2; mode++) {
+		quantum_reg creg,dreg;
+		if(quda_quantum_reg_init(&creg,4) == -1 || quda_quantum_reg_init(&dreg,4) == -1) return -1;
+		quda_quantum_reg_set(&creg,0);
+		quda_quantum_reg_set(&dreg,0);
+		quda_quantum_reg_set_repr(&dreg,QUDA_REPR_DENSE);
+		if(mode) quda_quantum_reg_set_repr(&creg,QUDA_REPR_DENSE);
+		for(int q = 0; q < 4; q++) {
+			quda_quantum_hadamard_gate(q,&creg);
+			quda_quantum_hadamard_gate(q,&dreg);
+			quda_quantum_rotate_k_gate(q,&creg,q+2);
+			quda_quantum_rotate_k_gate(q,&dreg,q+2);
+		}
+		// Anti-controls are controls conjugated by X
+		quda_quantum_mc_not_gate(0x1,0x2,3,&creg);
+		quda_quantum_pauli_x_gate(1,&dreg);
+		quda_quantum_toffoli_gate(0,1,3,&dreg);
+		quda_quantum_pauli_x_gate(1,&dreg);
+		quda_quantum_mc_phase_gate(0x3,0,2,&creg);
+		for(int v = 7; v < 16; v += 8) {
+			dreg.states[v].amplitude = quda_complex_mul_i(dreg.states[v].amplitude);
+		}
+		const complex_t hmatrix[4] = { { M_SQRT1_2, 0 }, { M_SQRT1_2, 0 }, { M_SQRT1_2, 0 }, { -M_SQRT1_2, 0 } };
+		quda_quantum_mc_unitary_gate(0,0,1,hmatrix,&creg);
+		quda_quantum_hadamard_gate(1,&dreg);
+		// Controls on bits 0 and 3 and an anti-control on bit 2 only pair states 9 and 11
+		const complex_t umatrix[4] = { { 0.6f, 0 }, { -0.8f, 0 }, { 0, 0.8f }, { 0, 0.6f } };
+		quda_quantum_mc_unitary_gate(0x9,0x4,1,umatrix,&creg);
+		complex_t u0 = dreg.states[9].amplitude, u1 = dreg.states[11].amplitude;
+		dreg.states[9].amplitude = quda_complex_add(quda_complex_mul(umatrix[0],u0),
+				quda_complex_mul(umatrix[1],u1));
+		dreg.states[11].amplitude = quda_complex_add(quda_complex_mul(umatrix[2],u0),
+				quda_complex_mul(umatrix[3],u1));
+		quda_quantum_reg_set_repr(&creg,QUDA_REPR_DENSE);
+		float cdiff = 0;
+		for(int v = 0; v < 16; v++) {
+			cdiff += quda_complex_abs_square(quda_complex_sub(creg.states[v].amplitude,dreg.states[v].amplitude));
+		}
+		if(mode) {
+			CHECK_RESULT(cdiff < 1e-6, "Multi-controlled gates match the single-control gates (dense)");
+		} else {
+			CHECK_RESULT(cdiff < 1e-6, "Multi-controlled gates match the single-control gates (sparse)");
+		}
+		quda_quantum_reg_delete(&creg);
+		quda_quantum_reg_delete(&dreg);
+	}
+
+	// Batched registers
+	quantum_batch qb;
+	if(quda_quantum_batch_init(&qb,1000,3) == -1) return -1;
+	for(int b = 0; b < qb.count; b++) {
+		quda_quantum_batch_set_register(&qb,b,b % 8);
+	}
+	quda_quantum_batch_hadamard_gate(0,&qb);
+	quda_quantum_batch_controlled_y_gate(0,2,&qb);
+	quda_quantum_batch_pi_over_8_gate(2,&qb);
+	quda_quantum_batch_toffoli_gate(2,0,1,&qb);
+	quda_quantum_batch_fredkin_gate(1,0,2,&qb);
+	quda_quantum_batch_controlled_rotate_k_gate(0,1,&qb,3);
+	int bsame = 1;
+	for(int b = 0; b < 8; b++) {
+		quantum_reg breg;
+		if(quda_quantum_reg_init(&breg,3) == -1) return -1;
+		quda_quantum_reg_set(&breg,b);
+		quda_quantum_reg_set_repr(&breg,QUDA_REPR_DENSE);
+		quda_quantum_hadamard_gate(0,&breg);
+		quda_quantum_controlled_y_gate(0,2,&breg);
+		quda_quantum_pi_over_8_gate(2,&breg);
+		quda_quantum_toffoli_gate(2,0,1,&breg);
+		quda_quantum_fredkin_gate(1,0,2,&breg);
+		quda_quantum_controlled_rotate_k_gate(0,1,&breg,3);
+		for(int v = 0; v < 8; v++) {
+			complex_t d = quda_complex_sub(breg.states[v].amplitude,quda_quantum_batch_amplitude(&qb,992+b,v));
+			if(quda_complex_abs_square(d) > 1e-8) bsame = 0;
+		}
+		quda_quantum_reg_delete(&breg);
+	}
+	CHECK_RESULT(bsame, "Batched gates match separate registers");
+	int bits[1000];
+	uint64_t bstates[1000];
+	quda_quantum_batch_bit_measure_and_collapse(0,&qb,bits);
+	quda_quantum_batch_measure(&qb,bstates);
+	int bok = 1;
+	for(int b = 0; b < qb.count; b++) {
+		if((int)(bstates[b] & 1) != bits[b]) bok = 0;
+	}
+	CHECK_RESULT(bok, "Batched measurement collapses each register separately");
+	quda_quantum_batch_delete(&qb);
+
+	// Classical oracles
+	for(int mode = 0; mode < 2; mode++) {
+		quantum_reg oreg;
+		if(quda_quantum_reg_init(&oreg,3) == -1) return -1;
+		quda_quantum_reg_set(&oreg,0);
+		if(mode) quda_quantum_reg_set_repr(&oreg,QUDA_REPR_DENSE);
+		for(int q = 0; q < 3; q++) {
+			quda_quantum_hadamard_gate(q,&oreg);
+		}
+		quda_quantum_add_scratch(3,&oreg);
+		uint64_t one = 1;
+		int ook = quda_classical_oracle(0,3,3,3,square_plus_one,&one,&oreg) == 0;
+		for(uint64_t x = 0; x < 8; x++) {
+			uint64_t index = (square_plus_one(x,&one) << 3) | x;
+			if(mode) {
+				if(fabs(oreg.states[index].amplitude.real - M_SQRT1_2 / 2) > 1e-4) ook = 0;
+			} else {
+				uint64_t state = oreg.states[x].state;
+				if(oreg.num_states != 8 || (state >> 3) != square_plus_one(state & 7,&one)) ook = 0;
+			}
+		}
+		uint64_t table[8];
+		for(uint64_t x = 0; x < 8; x++) {
+			table[x] = square_plus_one(x,&one) | 8; // bits beyond the output are ignored
+		}
+		ook &= quda_classical_oracle_table(0,3,3,3,table,&oreg) == 0;
+		for(uint64_t x = 0; x < 8; x++) {
+			if(mode) {
+				if(fabs(oreg.states[x].amplitude.real - M_SQRT1_2 / 2) > 1e-4) ook = 0;
+			} else {
+				if(oreg.states[x].state >= 8) ook = 0;
+			}
+		}
+		ook &= quda_classical_oracle_table(0,3,2,3,table,&oreg) == -1;
+		if(mode) {
+			CHECK_RESULT(ook, "Oracle XORs f(x) into the output bits and undoes itself (dense)");
+		} else {
+			CHECK_RESULT(ook, "Oracle XORs f(x) into the output bits and undoes itself (sparse)");
+		}
+		quda_quantum_reg_delete(&oreg);
+	}
+
+	// Grover diffusion
+	for(int mode = 0; mode < 2; mode++) {
+		quantum_reg greg;
+		if(quda_quantum_reg_init(&greg,4) == -1) return -1;
+		quda_quantum_reg_set(&greg,0);
+		if(mode) quda_quantum_reg_set_repr(&greg,QUDA_REPR_DENSE);
+		quda_quantum_hadamard_all(&greg);
+		for(int iter = 0; iter < 3; iter++) {
+			quda_quantum_mc_z_gate(0x3,0x4,3,&greg); // marks 11
+			quda_quantum_grover_diffusion(0,4,&greg);
+		}
+		quda_quantum_reg_set_repr(&greg,QUDA_REPR_DENSE);
+		if(mode) {
+			CHECK_RESULT(quda_complex_abs_square(greg.states[11].amplitude) > 0.95,
+				"Three Grover iterations find the marked state (dense)");
+		} else {
+			CHECK_RESULT(quda_complex_abs_square(greg.states[11].amplitude) > 0.95,
+				"Three Grover iterations find the marked state (sparse)");
+		}
+		quda_quantum_reg_delete(&greg);
+	}
+	quantum_reg greg,hreg;
+	if(quda_quantum_reg_init(&greg,4) == -1 || quda_quantum_reg_init(&hreg,4) == -1) return -1;
+	quda_quantum_reg_set(&greg,5);
+	quda_quantum_reg_set(&hreg,5);
+	quda_quantum_hadamard_gate(3,&greg);
+	quda_quantum_hadamard_gate(3,&hreg);
+	quda_quantum_grover_diffusion(1,3,&greg);
+	// Reference: -H (I - 2|00><00|) H on bits 1 and 2, with -I = ZXZX on bit 0
+	quda_quantum_hadamard_range(1,3,&hreg);
+	quda_quantum_pauli_x_gate(2,&hreg);
+	quda_quantum_mc_z_gate(0,0x2,2,&hreg);
+	quda_quantum_pauli_x_gate(2,&hreg);
+	quda_quantum_hadamard_range(1,3,&hreg);
+	quda_quantum_pauli_z_gate(0,&hreg);
+	quda_quantum_pauli_x_gate(0,&hreg);
+	quda_quantum_pauli_z_gate(0,&hreg);
+	quda_quantum_pauli_x_gate(0,&hreg);
+	quda_quantum_reg_set_repr(&greg,QUDA_REPR_DENSE);
+	quda_quantum_reg_set_repr(&hreg,QUDA_REPR_DENSE);
+	float gdiff = 0;
+	for(int v = 0; v < 16; v++) {
+		gdiff += quda_complex_abs_square(quda_complex_sub(greg.states[v].amplitude,hreg.states[v].amplitude));
+	}
+	CHECK_RESULT(gdiff < 1e-6, "Diffusion over a bit range matches the hadamard construction");
+	quda_quantum_reg_delete(&greg);
+	quda_quantum_reg_delete(&hreg);
+
+	// Marginal queries
+	for(int mode = 0; mode < 2; mode++) {
+		quantum_reg preg;
+		if(quda_quantum_reg_init(&preg,4) == -1) return -1;
+		quda_quantum_reg_set(&preg,0);
+		if(mode) quda_quantum_reg_set_repr(&preg,QUDA_REPR_DENSE);
+		quda_quantum_reg_set_flags(&preg,QUDA_REG_VIRTUAL_QUBITS);
+		quda_quantum_hadamard_gate(0,&preg);
+		quda_quantum_controlled_not_gate(0,2,&preg);
+		quda_quantum_pauli_x_gate(3,&preg);
+		quda_quantum_swap_gate(2,3,&preg); // logical bits 2 and 3 now hold X and the CNOT target
+		double p1, zz, hist[8];
+		int pok = quda_quantum_bit_probability(3,&preg,&p1) == 0 && fabs(p1 - 0.5) < TOLERANCE(1e-5);
+		pok &= quda_quantum_bit_probability(2,&preg,&p1) == 0 && fabs(p1 - 1) < TOLERANCE(1e-5);
+		pok &= quda_quantum_z_expectation(0x9,&preg,&zz) == 0 && fabs(zz - 1) < TOLERANCE(1e-5);
+		pok &= quda_quantum_z_expectation(0x3,&preg,&zz) == 0 && fabs(zz) < TOLERANCE(1e-5);
+		pok &= quda_quantum_range_histogram(1,4,&preg,hist) == 0;
+		pok &= fabs(hist[2] - 0.5) < TOLERANCE(1e-5) && fabs(hist[6] - 0.5) < TOLERANCE(1e-5);
+		pok &= quda_quantum_mask_histogram(0x9,&preg,hist) == 0;
+		pok &= fabs(hist[0] - 0.5) < TOLERANCE(1e-5) && fabs(hist[3] - 0.5) < TOLERANCE(1e-5);
+		pok &= preg.num_states == (mode ? 16 : 2);
+		pok &= quda_quantum_mask_histogram(0x10,&preg,hist) == -1;
+		if(mode) {
+			CHECK_RESULT(pok, "Marginals and Z-string expectations follow the qubit map (dense)");
+		} else {
+			CHECK_RESULT(pok, "Marginals and Z-string expectations follow the qubit map (sparse)");
+		}
+		quda_quantum_reg_delete(&preg);
+	}
+
+	// Copy-on-write clones
+	quantum_reg kreg,wreg,mcopy;
+	if(quda_quantum_reg_init(&kreg,3) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_hadamard_range(0,3,&kreg);
+	if(quda_quantum_reg_clone(&wreg,&kreg) == -1 || quda_quantum_reg_clone(&mcopy,&kreg) == -1) return -1;
+	CHECK_RESULT(wreg.states == kreg.states && mcopy.states == kreg.states, "Clones share the stored states");
+	int kbit = quda_quantum_bit_measure_and_collapse(1,&wreg);
+	CHECK_RESULT(wreg.states != kreg.states && wreg.num_states == 4 && wreg.size == 4,
+		"Collapsing a clone copies only the surviving states");
+	quda_quantum_reg_delete(&kreg);
+	quda_quantum_pauli_x_gate(2,&mcopy);
+	int kok = mcopy.num_states == 8;
+	for(int v = 0; v < wreg.num_states; v++) {
+		if(((wreg.states[v].state >> 1) & 1) != (uint64_t)kbit) kok = 0;
+	}
+	double ktotal;
+	kok &= quda_quantum_z_expectation(0,&mcopy,&ktotal) == 0 && fabs(ktotal - 1) < TOLERANCE(1e-5);
+	CHECK_RESULT(kok, "Clones outlive their source and diverge");
+	quda_quantum_reg_delete(&wreg);
+	quda_quantum_reg_delete(&mcopy);
+
+	for(int repr = QUDA_REPR_DENSE; repr <= QUDA_REPR_MPS; repr++) {
+		if(quda_quantum_reg_init(&kreg,3) == -1) return -1;
+		quda_quantum_reg_set(&kreg,0);
+		quda_quantum_reg_set_repr(&kreg,repr);
+		quda_quantum_reg_set_flags(&kreg,QUDA_REG_DIAGONAL_QUEUE);
+		quda_quantum_hadamard_gate(0,&kreg);
+		quda_quantum_phase_gate(0,&kreg);
+		if(quda_quantum_reg_clone(&wreg,&kreg) == -1) return -1;
+		quda_quantum_controlled_not_gate(0,1,&wreg);
+		quda_quantum_controlled_not_gate(0,2,&wreg);
+		double p1,p2;
+		kok = quda_quantum_bit_probability(2,&kreg,&p1) == 0 && p1 < TOLERANCE(1e-5);
+		kok &= quda_quantum_bit_probability(2,&wreg,&p2) == 0 && fabs(p2 - 0.5) < TOLERANCE(1e-5);
+		kok &= quda_quantum_bit_measure_and_collapse(0,&wreg) == quda_quantum_bit_measure(2,&wreg);
+		kok &= quda_quantum_bit_probability(0,&kreg,&p1) == 0 && fabs(p1 - 0.5) < TOLERANCE(1e-5);
+		quda_quantum_reg_delete(&kreg);
+		quda_quantum_reg_delete(&wreg);
+		if(repr == QUDA_REPR_DENSE) {
+			CHECK_RESULT(kok, "Clones of dense registers diverge independently");
+		} else if(repr == QUDA_REPR_STABILIZER) {
+			CHECK_RESULT(kok, "Clones of stabilizer registers diverge independently");
+		} else {
+			CHECK_RESULT(kok, "Clones of MPS registers diverge independently");
+		}
+	}
+
+	if(quda_quantum_reg_init(&kreg,3) == -1) return -1;
+	quda_quantum_reg_set_flags(&kreg,QUDA_REG_FACTORED);
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_hadamard_gate(0,&kreg);
+	if(quda_quantum_reg_clone(&wreg,&kreg) == -1) return -1;
+	quda_quantum_controlled_not_gate(0,2,&wreg);
+	quda_quantum_pauli_x_gate(1,&kreg);
+	kbit = quda_quantum_bit_measure_and_collapse(0,&wreg);
+	kok = quda_quantum_bit_measure(2,&wreg) == kbit && quda_quantum_bit_measure(1,&wreg) == 0;
+	kok &= quda_quantum_bit_measure(2,&kreg) == 0 && quda_quantum_bit_measure(1,&kreg) == 1;
+	CHECK_RESULT(kok, "Clones of factored registers clone their factors");
+	quda_quantum_reg_delete(&wreg);
+	quda_quantum_reg_delete(&kreg);
+
+	// Paired state splitting
+	if(quda_quantum_reg_init(&kreg,2) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_hadamard_gate(0,&kreg);
+	quda_quantum_hadamard_gate(1,&kreg);
+	quda_quantum_hadamard_gate(0,&kreg);
+	CHECK_RESULT(kreg.num_states == 2 && kreg.size == 4,
+		"Hadamard on paired states updates them in place without growing");
+	quda_quantum_reg_delete(&kreg);
+
+	// Memory budgets
+	int steps[8] = { 0 };
+	if(quda_quantum_reg_init(&kreg,5) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_hadamard_range(0,4,&kreg);
+	// Room for the 32 states after the split, but not for those and the old 16 at once
+	quda_quantum_reg_set_budget(&kreg,37*sizeof(quantum_state_t),0,record_pressure,steps);
+	quda_quantum_hadamard_gate(4,&kreg);
+	CHECK_RESULT(steps[0] == 1 && steps[1] == QUDA_PRESSURE_SPILL && kreg.num_states == 32
+		&& fabs(kreg.states[31].amplitude.real - pow(M_SQRT1_2,5)) < TOLERANCE(1e-5),
+		"Splits over budget spill the old states before growing");
+	quda_quantum_reg_delete(&kreg);
+
+	const float tiny = 0.01f;
+	const complex_t rotation[4] = { { sqrt(1 - tiny*tiny), 0 }, { -tiny, 0 }, { tiny, 0 }, { sqrt(1 - tiny*tiny), 0 } };
+	if(quda_quantum_reg_init(&kreg,3) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_mc_unitary_gate(0,0,0,rotation,&kreg);
+	quda_quantum_reg_set_budget(&kreg,40,0,record_pressure,steps);
+	steps[0] = 0;
+	int bres = quda_quantum_hadamard_gate(1,&kreg);
+	double bp;
+	CHECK_RESULT(bres == -1 && steps[0] == 1 && steps[1] == QUDA_PRESSURE_FAIL && kreg.num_states == 2
+		&& quda_quantum_bit_probability(0,&kreg,&bp) == 0 && fabs(bp - tiny*tiny) < TOLERANCE(1e-6),
+		"Splits that cannot fit fail and leave the register intact");
+	quda_quantum_reg_set_budget(&kreg,70,1e-3,record_pressure,steps);
+	steps[0] = 0;
+	bres = quda_quantum_hadamard_gate(1,&kreg);
+	CHECK_RESULT(bres == 0 && steps[0] == 1 && steps[1] == QUDA_PRESSURE_TRUNCATE && kreg.num_states == 2
+		&& kreg.fidelity < 1,
+		"Splits over budget truncate negligible states first");
+	quda_quantum_reg_delete(&kreg);
+
+	// Four negligible states out of eight, and a split that needs eight slots even without them
+	if(quda_quantum_reg_init(&kreg,4) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_mc_unitary_gate(0,0,0,rotation,&kreg);
+	quda_quantum_hadamard_gate(1,&kreg);
+	quda_quantum_hadamard_gate(2,&kreg);
+	quda_quantum_reg_set_budget(&kreg,5*sizeof(quantum_state_t),1e-3,record_pressure,steps);
+	steps[0] = 0;
+	bres = quda_quantum_hadamard_gate(3,&kreg);
+	CHECK_RESULT(bres == -1 && steps[0] == 1 && steps[1] == QUDA_PRESSURE_FAIL && kreg.num_states == 8
+		&& kreg.fidelity == 1,
+		"Splits do not truncate when that would not make them fit");
+	steps[0] = 0;
+	bres = quda_quantum_reg_set_repr(&kreg,QUDA_REPR_DENSE);
+	CHECK_RESULT(bres == -1 && steps[0] == 1 && steps[1] == QUDA_PRESSURE_FAIL
+		&& kreg.repr == QUDA_REPR_SPARSE && kreg.num_states == 8,
+		"Dense buffers over budget fail and leave the register sparse");
+	quda_quantum_reg_delete(&kreg);
+
+	// Dense partitions
+	if(quda_quantum_reg_init(&kreg,5) == -1) return -1;
+	if(quda_quantum_reg_init(&nreg,5) == -1) return -1;
+	quda_quantum_reg_set_shards(&kreg,8);
+	quda_quantum_reg_set_shards(&nreg,1);
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_reg_set(&nreg,0);
+	if(quda_quantum_reg_set_repr(&kreg,QUDA_REPR_DENSE) == -1) return -1;
+	if(quda_quantum_reg_set_repr(&nreg,QUDA_REPR_DENSE) == -1) return -1;
+	int nok = 1;
+	for(int q = 0; q < 5; q++) {
+		quda_quantum_mc_unitary_gate(0,0,q,rotation,&kreg);
+		quda_quantum_mc_unitary_gate(0,0,q,rotation,&nreg);
+	}
+	for(int g = 0; g < 15*5; g++) {
+		// Targets and controls cover both the low bits and the partition bits 2-4
+		int a = g/15, b = (a + 1 + g % 4) % 5, c;
+		for(c=0;c == a || c == b;c++);
+		apply_gate(g % 15,a,b,c,&kreg);
+		apply_gate(g % 15,a,b,c,&nreg);
+	}
+	for(int v = 0; v < 32; v++) {
+		nok &= quda_complex_abs_square(quda_complex_sub(kreg.states[v].amplitude,
+				nreg.states[v].amplitude)) < TOLERANCE(TOLERANCE(1e-10));
+	}
+	quda_quantum_add_scratch(1,&kreg);
+	CHECK_RESULT(nok && kreg.num_states == 64 && kreg.states[40].state == 40
+		&& kreg.states[40].amplitude.real == 0 && kreg.states[7].amplitude.real == nreg.states[7].amplitude.real,
+		"Partitioned dense registers match a single partition");
+	quda_quantum_reg_delete(&nreg);
+	quda_quantum_reg_delete(&kreg);
+
+	// Process shards
+	if(quda_quantum_reg_init(&kreg,7) == -1) return -1;
+	if(quda_quantum_reg_init(&nreg,7) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	quda_quantum_reg_set(&nreg,0);
+	for(int q = 0; q < 7; q++) {
+		quda_quantum_mc_unitary_gate(0,0,q,rotation,&kreg);
+		quda_quantum_mc_unitary_gate(0,0,q,rotation,&nreg);
+	}
+	if(quda_quantum_reg_set_repr(&nreg,QUDA_REPR_DENSE) == -1) return -1;
+	// A parallel reduction before and in every process checks that workers can use OpenMP
+	quantum_state_t* wide = calloc(1 << 18,sizeof(quantum_state_t));
+	if(wide == NULL) return -1;
+	wide[7].amplitude = QUDA_COMPLEX_ONE;
+	#ifdef _OPENMP
+	int shard_threads = omp_get_max_threads();
+	omp_set_num_threads(4);
+	#endif
+	quda_accum_t wide_norm = quda_states_norm(wide,1 << 18);
+	// Four processes run from here on until the shards are gathered
+	int rank = quda_shard_start(&kreg,2);
+	int sok = rank >= 0 && kreg.num_states == 32 && kreg.states[0].state == (uint64_t)rank << 5;
+	sok &= quda_states_norm(wide,1 << 18) == wide_norm;
+	for(int g = 0; g < 15*7; g++) {
+		// Bits 5 and 6 select the shard
+		int a = g/15, b = (a + 1 + g % 6) % 7, c;
+		for(c=0;c == a || c == b;c++);
+		apply_gate(g % 15,a,b,c,&kreg);
+		apply_gate(g % 15,a,b,c,&nreg);
+	}
+	sok &= quda_shard_finish(&kreg) == 0 && kreg.repr == QUDA_REPR_DENSE && kreg.num_states == 128;
+	for(int v = 0; sok && v < 128; v++) {
+		sok &= kreg.states[v].state == (uint64_t)v && quda_complex_abs_square(quda_complex_sub(
+				kreg.states[v].amplitude,nreg.states[v].amplitude)) < TOLERANCE(TOLERANCE(1e-10));
+	}
+	CHECK_RESULT(sok, "Registers sharded over processes match an unsharded register");
+	#ifdef _OPENMP
+	omp_set_num_threads(shard_threads);
+	#endif
+	free(wide);
+	quda_quantum_reg_delete(&nreg);
+	quda_quantum_reg_delete(&kreg);
+
+	// Exchanges with a worker that is gone fail instead of waiting for it
+	if(quda_quantum_reg_init(&kreg,7) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	rank = quda_shard_start(&kreg,1);
+	if(rank == 1) exit(0);
+	sok = rank == 0 && quda_quantum_hadamard_gate(6,&kreg) == -1;
+	sok &= quda_shard_finish(&kreg) == -1 && kreg.repr == QUDA_REPR_SPARSE && kreg.num_states == 1;
+	CHECK_RESULT(sok, "Sharded registers report a lost worker");
+	quda_quantum_reg_delete(&kreg);
+
+	// Deterministic reductions
+	const complex_t tilt[4] = { { cos(0.3), 0 }, { -sin(0.3), 0 }, { sin(0.3), 0 }, { cos(0.3), 0 } };
+	if(quda_quantum_reg_init(&kreg,18) == -1) return -1;
+	quda_quantum_reg_set(&kreg,0);
+	if(quda_quantum_reg_set_repr(&kreg,QUDA_REPR_DENSE) == -1) return -1;
+	for(int q = 0; q < 18; q++) {
+		quda_quantum_mc_unitary_gate(0,0,q,tilt,&kreg);
+	}
+	quda_accum_t norms[2], probs[2];
+	uint64_t draws[2][8];
+	double zexp[2], bitp[2], rhist[2][32];
+	quantum_reg grov[2];
+	for(int run = 0; run < 2; run++) {
+		#ifdef _OPENMP
+		int threads = omp_get_max_threads();
+		omp_set_num_threads(run ? 4 : 1);
+		#endif
+		norms[run] = quda_states_norm(kreg.states,kreg.num_states);
+		probs[run] = quda_states_prob(kreg.states,kreg.num_states,1 << 17,1 << 17);
+		srand(50);
+		for(int d = 0; d < 8; d++) {
+			if(quda_quantum_reg_measure(&kreg,&draws[run][d],0) == -1) return -1;
+		}
+		if(quda_quantum_z_expectation(0x3000f,&kreg,&zexp[run]) == -1) return -1;
+		if(quda_quantum_bit_probability(17,&kreg,&bitp[run]) == -1) return -1;
+		if(quda_quantum_mask_histogram(0x2000f,&kreg,rhist[run]) == -1) return -1;
+		// One group spanning the register sums its mean across the threads
+		if(quda_quantum_reg_clone(&grov[run],&kreg) == -1) return -1;
+		if(quda_quantum_grover_diffusion(0,18,&grov[run]) == -1) return -1;
+		#ifdef _OPENMP
+		omp_set_num_threads(threads);
+		#endif
+	}
+	int rok = norms[0] == norms[1] && probs[0] == probs[1];
+	for(int d = 0; d < 8; d++) {
+		rok &= draws[0][d] == draws[1][d];
+	}
+	CHECK_RESULT(rok && fabs((double)norms[0] - 1) < TOLERANCE(2e-6)
+		&& fabs((double)probs[0] - sin(0.3)*sin(0.3)) < TOLERANCE(2e-6),
+		"Reductions are identical on one and several threads");
+	rok = zexp[0] == zexp[1] && bitp[0] == bitp[1] && fabs(bitp[0] - sin(0.3)*sin(0.3)) < TOLERANCE(2e-6)
+		&& fabs(zexp[0] - pow(cos(0.6),6)) < TOLERANCE(2e-5);
+	for(int h = 0; h < 32; h++) {
+		rok &= rhist[0][h] == rhist[1][h];
+	}
+	for(int v = 0; v < grov[0].num_states; v++) {
+		rok &= quda_complex_eq(grov[0].states[v].amplitude,grov[1].states[v].amplitude);
+	}
+	CHECK_RESULT(rok, "State queries and Grover means are identical on one and several threads");
+	quda_quantum_reg_delete(&grov[0]);
+	quda_quantum_reg_delete(&grov[1]);
+	// The state selected is the one a running sum over the states reaches 'f' in
+	quda_accum_t f = 0.6, below = 0;
+	int chosen = quda_states_select(kreg.states,kreg.num_states,f);
+	for(int v = 0; v < chosen; v++) {
+		below += quda_complex_abs_square(kreg.states[v].amplitude);
+	}
+	CHECK_RESULT(chosen > 0 && below <= f + TOLERANCE(1e-6)
+		&& below + quda_complex_abs_square(kreg.states[chosen].amplitude) > f - TOLERANCE(1e-6)
+		&& quda_states_select(kreg.states,kreg.num_states,2) == -1,
+		"Selection descends to the state holding the cumulative probability");
+	quda_quantum_reg_delete(&kreg);
+
+	// Classical post-processing
+	uint64_t nums[8], denoms[8];
+	int count = quda_classical_convergents(314159,100000,0,nums,denoms,8);
+	CHECK_RESULT(count == 8 && nums[3] == 355 && denoms[3] == 113,
+		"Integer convergents of 3.14159 include 355/113");
+	count = quda_classical_convergents(314159,100000,110,nums,denoms,8);
+	CHECK_RESULT(count == 3 && denoms[2] == 106, "Convergents stop at the denominator limit");
+	CHECK_RESULT(quda_classical_find_period(7,15,12,16,1) == 4, "Period of 7 mod 15 from 12/16");
+	CHECK_RESULT(quda_classical_find_period(7,15,8,16,1) == 0, "Period 4 not found from 8/16 alone");
+	CHECK_RESULT(quda_classical_find_period(7,15,8,16,2) == 4, "Period 4 found as a multiple of 2");
+	CHECK_RESULT(quda_mod_pow_bin(65521,65520,65537) == quda_mod_pow_simple(65521,65520,65537),
+		"Binary modular exponentiation does not overflow");
+	uint64_t num = 4, denom = 16;
+	quda_classical_continued_fraction_expansion(&num,&denom);
+	CHECK_RESULT(num == 1 && denom == 4, "Continued fraction expansion of 4/16");
+
   return 0;
 }